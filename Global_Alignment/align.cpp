@@ -7,6 +7,7 @@
 
 #include <piusb.hpp>
 #include "aligner.hpp"
+#include "timestamp.hpp"
 
 #include <fcntl.h>   // For file handling
 #include <termios.h> // Terminal IO
@@ -20,83 +21,150 @@
             do { if (DEBUG) fprintf(stderr, fmt, __VA_ARGS__); } while (0)
 
 
-int main(int argc, char* argv[])
+static int legs = 6;
+static int max_moves = 0;
+
+static struct option long_options[] = 
 {
-	int c;
+	{"laser"       , required_argument , 0    , 'l'} ,
+	{"power"       , required_argument , 0    , 'p'} ,
+	{"shutter"     , required_argument , 0    , 's'} ,
+	{"mirror"      , required_argument , 0    , 'm'} ,
+	{"bringup"     , no_argument       , 0    , 'b'} ,
+	{"legs"        , required_argument , 0    , 'n'} ,
+	{"max-moves"   , required_argument , 0    , 'x'} ,
+	{"pose"        , required_argument , 0    , 'P'} ,
+	{"session"     , optional_argument , 0    , 'S'} ,
+	{"help"        , no_argument       , 0    , 'h'} ,
+	{NULL          , 0                 , NULL ,  0 }
+};
 
-	static struct option long_options[] = 
+/* One option, from the command line or a session line */
+static void command(Align &align, int c, const char *arg)
+{
+	switch (c) 
 	{
-		{"laser"       , required_argument , 0    , 'l'} ,
-		{"power"       , required_argument , 0    , 'p'} ,
-		{"shutter"     , required_argument , 0    , 's'} ,
-        	{"mirror"      , required_argument , 0    , 'm'} ,
-        	{"help"        , no_argument       , 0    , 'h'} ,
-        	{NULL          , 0                 , NULL ,  0 }
-    	};
+		case 'l':
+			if (!strcmp(arg, "on"))
+				align.sLaserOn();
+			if (!strcmp(arg, "off"))
+				align.sLaserOff();
+			break;
+		case 'p':
+			if (!strcmp(arg, "on"))
+				align.powerOn();
+			if (!strcmp(arg, "off"))
+				align.powerOff();
+			break;
+		case 's':
+			if (!strcmp(arg, "calibrate"))
+				align.shutterCalibrate();
+			if (!strcmp(arg, "recalibrate"))
+				align.shutterCalibrate(true);
+			if (!strcmp(arg, "open"))
+				align.shutterOpen();
+			if (!strcmp(arg, "close"))
+				align.shutterClose();
+			break;
+		case 'm':
+			if (!strcmp(arg, "calibrate"))
+				align.mirrorCalibrate();
+			else if (!strcmp(arg, "recalibrate"))
+				align.mirrorCalibrate(true);
+			else if (!strcmp(arg, "a"))
+				align.mirrorPos(0);
+			else if (!strcmp(arg, "b"))
+				align.mirrorPos(1);
+			else if (!strcmp(arg, "c"))
+				align.mirrorPos(2);
+			else
+				align.mirrorStep(atoi(arg));
+			break;
+		case 'b':
+			align.bringUp(legs, max_moves);
+			break;
+		case 'n':
+			legs = atoi(arg);
+			break;
+		case 'x':
+			max_moves = atoi(arg);
+			break;
+		case 'P':
+			align.pose(arg);
+			break;
+		case 'h': 
+		default:
+			align.help();
+			break;
+	}
+}
 
-	int option_index = 0;
-	while (true)
-	{
-        	c = getopt_long(argc, argv, "l:p:s:m:r:h", long_options, &option_index);
-        	if (c == (-1)) break;
-		Align align;
-		switch (c) 
-		{
-            		case 0:
-                		printf ("option %s", long_options[option_index].name);
-                		if (optarg)
-                	    		printf (" with arg %s", optarg);
-                		printf ("\n");
-                		break;
-            		case 'l':
-				if (!strcmp(optarg, "on"))
-                    			align.sLaserOn();
-                		if (!strcmp(optarg, "off"))
-                    			align.sLaserOff();
-                		break;
-           		case 'p':
-            			if (!strcmp(optarg, "on"))
-                    			align.powerOn();
-                		if (!strcmp(optarg, "off"))
-                    			align.powerOff();
-                		break;
-            		case 's':
-				if (!strcmp(optarg, "calibrate"))
-                    			align.shutterCalibrate();
-				if (!strcmp(optarg, "open"))
-                    			align.shutterOpen();
-                		if (!strcmp(optarg, "close"))
-                    			align.shutterClose();
-                		break;
-            		case 'm':
-				if (!strcmp(optarg, "calibrate"))
-                    			align.mirrorCalibrate();
-				else
-					{
-						if (!strcmp(optarg, "a"))
-							align.mirrorPos(0);
-						if (!strcmp(optarg, "b"))
-							align.mirrorPos(1);
-						if (!strcmp(optarg, "c"))
-							align.mirrorPos(2);
+/*
+ * Runs the options in a file (or stdin), one per line without the dashes,
+ * e.g. "mirror 100", on one Align so the devices stay open between them.
+ * Every command is timed.
+ */
+static int session(const char *path)
+{
+	FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	if (f == NULL) {
+		fprintf(stderr, "ERROR: Cannot open %s\n", path);
+		return EXIT_FAILURE;
+	}
 
-						int step = atoi(argv[2]);
-						align.mirrorStep(step);
-					}
-						
-                		break;
-			case 'h': 
-				align.help();
-				break;
+	Align align;
+	char line[256];
+	int n = 0, errors = 0;
+	int64_t start = timestampNs();
+	while (fgets(line, sizeof(line), f)) {
+		char name[64], arg[192] = "";
+		if (sscanf(line, " %63s %191s", name, arg) < 1 || name[0] == '#')
+			continue;
 
-			case '?':
-				break;
+		const char *option = name[0] == '-' && name[1] == '-' ? name + 2 : name;
+		struct option *o = long_options;
+		while (o->name && strcmp(o->name, option))
+			o++;
+		if (o->name == NULL || o->val == 'S' || (o->has_arg == required_argument && !arg[0])) {
+			fprintf(stderr, "ERROR: %s", line);
+			errors++;
+			continue;
+		}
 
-			default:
-				align.help();
-				//printf ("?? getopt returned character code 0%o ??\n", c);
-				break;
+		int64_t t = timestampNs();
+		command(align, o->val, arg);
+		printf("[%10.3f ms] %s %s\n", (timestampNs() - t) * 1e-6, o->name, arg);
+		fflush(stdout);
+		n++;
+	}
+	if (f != stdin)
+		fclose(f);
+
+	double ms = (timestampNs() - start) * 1e-6;
+	printf("%d commands in %.3f ms, %.3f ms each%s\n", n, ms, n ? ms / n : 0.0,
+	       errors ? ", some lines not understood" : "");
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+	int c;
+	int option_index = 0;
+	while (true)
+	{
+		c = getopt_long(argc, argv, "l:p:s:m:bn:x:P:S::h", long_options, &option_index);
+		if (c == (-1)) break;
+		if (c == '?')
+			continue;
+		if (c == 'S') {
+			// --session file as well as --session=file
+			if (optarg == NULL && optind < argc && argv[optind][0] != '-')
+				optarg = argv[optind];
+			return session(optarg ? optarg : "-");
 		}
+
+		Align align;
+		command(align, c, optarg);
 	}
 	return 0;
 }
@@ -1,5 +1,6 @@
 #include "piusb.hpp"
 #include "aligner.hpp"
+#include "platform.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,104 +9,240 @@
 #include <iostream>
 #include <time.h>
 #include <unistd.h>
+#include <string>
+#include <vector>
 
 using namespace std;
 
-void Align::sLaserOn()
+/* Relay bit on or off. EXIT_FAILURE if the relay board is not there */
+int Align::setRelay(int bit, bool on)
+{
+	Relay *relay = relayBoard();
+	if (!relay->isOpen()) {
+		cout << "Relay board NOT OPEN.\n";
+		return EXIT_FAILURE;
+	}
+	state_.relay(relay->usbId(), relay->setState(bit,on));
+	return EXIT_SUCCESS;
+}
+
+int Align::sLaserOn()
 {	
 	int laser = 0;
-	Relay relay;	
-	relay.setState(laser,true);
+	if (setRelay(laser, true) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
 	cout << "Laser ON.\n";
+	return EXIT_SUCCESS;
 }
 
-void Align::sLaserOff()
+int Align::sLaserOff()
 {	
 	int laser = 0;
-	Relay relay;	
-	relay.setState(laser,false);	
+	if (setRelay(laser, false) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
 	cout << "Laser OFF.\n";
+	return EXIT_SUCCESS;
 }
 
-void Align::powerOn()
+int Align::powerOn()
 {	
 	int power = 1;
-	Relay relay;	
-	relay.setState(power,true);
+	if (setRelay(power, true) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
 	cout << "Battery ON.\n";
+	return EXIT_SUCCESS;
 }
 
-void Align::powerOff()
+int Align::powerOff()
 {	
 	int power = 1;
-	Relay relay;	
-	relay.setState(power,false);	
+	if (setRelay(power, false) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
 	cout << "Battery OFF.\n";
+	return EXIT_SUCCESS;
 }
 
-void Align::shutterCalibrate()
+int Align::shutterCalibrate(bool force)
 {
-	int calibrate = -350;
-	int velocity = 1;
-	Twister twister;
-	twister.setVelocity(velocity);
-	twister.setPosition(calibrate);
-	twister.setZero();
+	Twister *twister = shutter();
+	if (force)
+		state_.forget(twister->usbId());
+	if (calibrateShutter(twister, NULL, &state_) != EXIT_SUCCESS) {
+		cout << "Shutter NOT CALIBRATED.\n";
+		return EXIT_FAILURE;
+	}
 	cout << "Shutter CALIBRATED.\n";
+	return EXIT_SUCCESS;
 }
 
-void Align::shutterOpen()
+int Align::shutterMove(Twister *twister, int position, bool *moved)
 {
 	int velocity = 1;
+	*moved = false;
+	if (!twister->isOpen()) {
+		cout << "Shutter NOT OPEN.\n";
+		return EXIT_FAILURE;
+	}
+	string id = twister->usbId();
+	DeviceState s;
+	if (state_.lookup(id, &s) && s.confirmed && s.position == position &&
+	    twister->getPosition() == position)
+		return EXIT_SUCCESS;
+
+	twister->setVelocity(velocity);
+	state_.commanded(id, position, velocity);
+	if (twister->setPosition(position) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	state_.confirmed(id, position);
+	*moved = true;
+	return EXIT_SUCCESS;
+}
+
+int Align::shutterOpen()
+{
 	int open = 370;
-	Twister twister;
-	twister.setVelocity(velocity);
-	twister.setPosition(open);
-	cout << "Shutter OPEN.\n";
+	bool moved;
+	if (shutterMove(shutter(), open, &moved) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (moved)
+		cout << "Shutter OPEN.\n";
+	else
+		cout << "Shutter already OPEN.\n";
+	return EXIT_SUCCESS;
 }
 
-void Align::shutterClose()
+int Align::shutterClose()
 {
-	int velocity = 1;
 	int close = 0;
-	Twister twister;
-	twister.setVelocity(velocity);
-	twister.setPosition(close);
-	cout << "Shutter CLOSED.\n";
+	bool moved;
+	if (shutterMove(shutter(), close, &moved) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (moved)
+		cout << "Shutter CLOSED.\n";
+	else
+		cout << "Shutter already CLOSED.\n";
+	return EXIT_SUCCESS;
 }
 
-void Align::mirrorCalibrate()
+int Align::mirrorCalibrate(bool force)
 {
-	int velocity = 10;
-	int cal1 = 2100;
-	int cal2 = 0;
-	Motor motor;
-	motor.setVelocity(velocity);
-	motor.setPosition(cal1);
-	motor.setPosition(cal2);
+	Motor *motor = mirror();
+	if (force)
+		state_.forget(motor->usbId());
+	if (calibrateMirror(motor, NULL, &state_) != EXIT_SUCCESS) {
+		cout << "Mirror NOT CALIBRATED\n";
+		return EXIT_FAILURE;
+	}
 	cout << "Mirror POSITION CALIBRATED\n";
+	return EXIT_SUCCESS;
 }
 
-void Align::mirrorStep(int step)
+int Align::mirrorMove(Motor *motor, int position, bool *moved)
 {
 	int velocity = 10;
-	Motor motor;
-	motor.setVelocity(velocity);
-	int current_pos = motor.getPosition();
+	*moved = false;
+	if (!motor->isOpen()) {
+		cout << "Mirror NOT OPEN.\n";
+		return EXIT_FAILURE;
+	}
+	string id = motor->usbId();
+	DeviceState s;
+	if (state_.lookup(id, &s) && s.confirmed && s.position == position &&
+	    motor->getPosition() == position)
+		return EXIT_SUCCESS;
+
+	motor->setVelocity(velocity);
+	state_.commanded(id, position, velocity);
+	if (motor->setPosition(position) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	state_.confirmed(id, position);
+	*moved = true;
+	return EXIT_SUCCESS;
+}
+
+int Align::mirrorStep(int step)
+{
+	Motor *motor = mirror();
+	bool moved;
+	if (!motor->isOpen()) {
+		cout << "Mirror NOT OPEN.\n";
+		return EXIT_FAILURE;
+	}
+	int current_pos = motor->getPosition();
 	int new_pos = current_pos + step;
-	motor.setPosition(new_pos);
-	cout << "Position set: " << motor.getPosition() << endl;
+	if (new_pos > MOTOR_MAX_POSITION)
+		new_pos = MOTOR_MAX_POSITION;
+	if (new_pos < MOTOR_MIN_POSITION)
+		new_pos = MOTOR_MIN_POSITION;
+	if (mirrorMove(motor, new_pos, &moved) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	cout << "Position set: " << motor->getPosition() << endl;
+	return EXIT_SUCCESS;
 }
 
-void Align::mirrorPos(int pos)
+int Align::mirrorPos(int pos)
 {
-	int velocity = 10;
-	Motor motor;
-	motor.setVelocity(velocity);
+	Motor *motor = mirror();
 	int _position[3] = {_a, _b, _c};
 	int new_pos = _position[pos];
-	motor.setPosition(new_pos);
-	cout << "Position set: " << motor.getPosition() << endl;	
+	bool moved;
+	if (mirrorMove(motor, new_pos, &moved) != EXIT_SUCCESS)
+		return EXIT_FAILURE;
+	if (!moved)
+		cout << "Mirror already there. ";
+	cout << "Position set: " << motor->getPosition() << endl;	
+	return EXIT_SUCCESS;
+}
+
+/* Mirror is the first USB-MO, the legs the ones after it */
+static int addLegs(Platform *platform, int legs)
+{
+	vector<string> names(legs);
+	vector<const char *> select(legs);
+	for (int i=0; i<legs; i++) {
+		names[i] = "index:" + to_string(i + 1);
+		select[i] = names[i].c_str();
+	}
+	return platform->addLegs(legs, select.data());
+}
+
+int Align::bringUp(int legs, int max_moves)
+{
+	release();
+	Platform platform(max_moves);
+	platform.setStateCache(&state_);
+	platform.addMirror("index:0");
+	addLegs(&platform, legs);
+	platform.addShutter();
+
+	int status = platform.bringUp();
+	platform.printTimings(stdout);
+	cout << (status == EXIT_SUCCESS ? "Platform READY.\n" : "Platform NOT READY.\n");
+	return status;
+}
+
+int Align::pose(const char *targets)
+{
+	vector<int> pose;
+	for (const char *p = targets; *p; ) {
+		pose.push_back(atoi(p));
+		p += strcspn(p, ",");
+		if (*p == ',')
+			p++;
+	}
+
+	release();
+	Platform platform;
+	platform.setStateCache(&state_);
+	if (addLegs(&platform, pose.size()) != (int) pose.size()) {
+		cout << "Not all legs opened.\n";
+		return EXIT_FAILURE;
+	}
+	vector<LegMove> moves;
+	int status = platform.moveLegs(pose.data(), &moves);
+	printLegMoves(stdout, moves);
+	cout << (status == EXIT_SUCCESS ? "Pose SET.\n" : "Pose NOT SET.\n");
+	return status;
 }
 
 int Align::help () {
@@ -125,15 +262,21 @@ int Align::help () {
         "\n    --shutter <calibrate>            IMPORTANT!!!		                  "
         "\n                                     Calibrates the shutter                    "
         "\n                                     Be sure to calibrate before first use     "
+        "\n                                     Skipped when the state file (PIUSB_STATE, "
+        "\n                                     default ~/.piusb_state) and the shutter   "
+        "\n                                     agree it was calibrated                   "
+        "\n    --shutter <recalibrate>          Calibrates the shutter in any case        "
         "\n                                                                               "
         "\n    --shutter <open|close>           Open or close the shutter                 "
         "\n                                                                               "
 	"\n    --mirror <calibrate>             IMPORTANT!!!		                  "
         "\n                                     Calibrates the mirror                     "
         "\n                                     Be sure to calibrate before first use     "
+        "\n                                     Skipped like --shutter calibrate          "
+        "\n    --mirror <recalibrate>           Calibrates the mirror in any case         "
 	"\n                                                                               "
         "\n    --mirror <step>                  Extend or retract motor by a number of    "
- 	"\n                                     steps. Range is from 0 - 2000. If steps   "
+ 	"\n                                     steps. Range is from 0 - 2100. If steps   "
  	"\n                                     requested go beyond limit, motor will be  "
  	"\n                                     sent to limit.                            "
         "\n                                     + int to extend / - int to retract        "
@@ -141,7 +284,22 @@ int Align::help () {
 	"\n    --mirror <position>		Go to one of three set positions (a, b, c)"
 	"\n					'a' = 0                                   "
 	"\n					'b' = 1030                                "
-	"\n					'c' = 2000		                  "
+	"\n					'c' = 2070		                  "
+        "\n                                                                               "
+        "\n    --bringup                        Home the legs and calibrate the mirror and"
+        "\n                                     shutter, all at once                      "
+        "\n    --legs <n>                       Legs homed by --bringup (default 6)       "
+        "\n    --max-moves <n>                  Actuators moving at once in --bringup     "
+        "\n                                     (default 0, no limit). Give --legs and    "
+        "\n                                     --max-moves before --bringup              "
+        "\n                                                                               "
+        "\n    --pose <p1,p2,...>               Move the legs to these positions, all     "
+        "\n                                     arriving together                         "
+        "\n                                                                               "
+        "\n    --session [file]                 Run the options in file (default stdin),  "
+        "\n                                     one per line without the dashes, e.g.     "
+        "\n                                     'mirror 100', keeping the devices open.   "
+        "\n                                     Prints the time of every command          "
         "\n                                                                               "
         "\n   --help                            Print this message.                       ";
     printf("%s\n", usage);
@@ -152,9 +310,46 @@ return 0;
 
 Align::Align()
 {
+	relay_ = NULL;
+	twister_ = NULL;
+	motor_ = NULL;
+	state_.load();
 }
 
 Align::~Align()
 {
+	release();
+}
+
+/* Devices are opened on first use and held until release() */
+Relay *Align::relayBoard()
+{
+	if (relay_ == NULL)
+		relay_ = new Relay;
+	return relay_;
+}
+
+Twister *Align::shutter()
+{
+	if (twister_ == NULL)
+		twister_ = new Twister;
+	return twister_;
+}
+
+Motor *Align::mirror()
+{
+	if (motor_ == NULL)
+		motor_ = new Motor;
+	return motor_;
+}
+
+void Align::release()
+{
+	delete relay_;
+	delete twister_;
+	delete motor_;
+	relay_ = NULL;
+	twister_ = NULL;
+	motor_ = NULL;
 }
 
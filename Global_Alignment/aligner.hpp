@@ -1,4 +1,9 @@
 #include <libusb-1.0/libusb.h>
+#include "statecache.hpp"
+
+class Motor;
+class Relay;
+class Twister;
 
 class Align
 {
@@ -6,18 +11,40 @@ class Align
 		Align();
 		~Align();
 
-		void sLaserOn();
-		void sLaserOff();
-		void powerOn();
-		void powerOff();
-		void shutterCalibrate();	
-		void shutterOpen();
-		void shutterClose();
-		void mirrorCalibrate();
-		void mirrorStep(int step);
-		void mirrorPos(int pos);
+		/* Each returns EXIT_FAILURE if the device is not there or the move failed */
+		int sLaserOn();
+		int sLaserOff();
+		int powerOn();
+		int powerOff();
+		int shutterCalibrate(bool force = false);	
+		int shutterOpen();
+		int shutterClose();
+		int mirrorCalibrate(bool force = false);
+		int mirrorStep(int step);
+		int mirrorPos(int pos);
+		int bringUp(int legs, int max_moves);
+		int pose(const char *targets);
 		int help();
+
+		/* Closes the devices held open since their first use */
+		void release();
 	private:
+		Relay *relayBoard();
+		Twister *shutter();
+		Motor *mirror();
+
+		int setRelay(int bit, bool on);
+
+		/* Move unless the state file and the device agree it is there */
+		int shutterMove(Twister *twister, int position, bool *moved);
+		int mirrorMove(Motor *motor, int position, bool *moved);
+
+		/* Positions and relay bits from earlier runs (PIUSB_STATE) */
+		StateCache state_;
+		Relay *relay_;
+		Twister *twister_;
+		Motor *motor_;
+
 		const static int _a = 0;
 		const static int _b = 1030;
 		const static int _c = 2070;
@@ -0,0 +1,427 @@
+#include "archive.hpp"
+#include "samplelog.hpp"    // logCrc32
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define MAX_VARINT  10
+
+static inline uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t u)
+{
+    return (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+}
+
+static inline size_t putVarint(uint8_t *p, uint64_t u)
+{
+    size_t n = 0;
+    while (u >= 0x80) {
+        p[n++] = (uint8_t) u | 0x80;
+        u >>= 7;
+    }
+    p[n++] = (uint8_t) u;
+    return n;
+}
+
+/* Returns 0 if the varint runs past end */
+static inline size_t getVarint(const uint8_t *p, const uint8_t *end, uint64_t *u)
+{
+    uint64_t r = 0;
+    for (size_t n=0; n<MAX_VARINT && p+n<end; n++) {
+        r |= (uint64_t) (p[n] & 0x7F) << (7*n);
+        if (!(p[n] & 0x80)) {
+            *u = r;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * ArchiveWriter
+ */
+
+ArchiveWriter::ArchiveWriter()
+{
+    fd_ = -1;
+    used_ = 0;
+    t_prev_ = dt_prev_ = 0;
+    v_prev_ = dv_prev_ = 0;
+    samples_ = 0;
+    offset_ = 0;
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    close();
+}
+
+int ArchiveWriter::open(const char *path, ArchiveMode mode, int64_t t_unit_ns, uint32_t block_samples)
+{
+    if (fd_ >= 0)
+        close();
+
+    fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        fprintf(stderr, "ERROR: Cannot create %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    memset(&header_, 0, sizeof(header_));
+    memcpy(header_.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header_.version = ARCHIVE_VERSION;
+    header_.mode = mode;
+    header_.t_unit_ns = t_unit_ns > 0 ? t_unit_ns : 1;
+    header_.block_samples = block_samples > 1 ? block_samples : 2;
+
+    if (write(fd_, &header_, sizeof(header_)) != sizeof(header_)) {
+        fprintf(stderr, "ERROR: Cannot write %s\n", path);
+        ::close(fd_);
+        fd_ = -1;
+        return EXIT_FAILURE;
+    }
+
+    // Worst case two full varints per sample
+    payload_.assign(header_.block_samples * 2 * MAX_VARINT, 0);
+    index_.clear();
+    block_.count = 0;
+    used_ = 0;
+    samples_ = 0;
+    offset_ = sizeof(header_);
+    return EXIT_SUCCESS;
+}
+
+int ArchiveWriter::close()
+{
+    if (fd_ < 0)
+        return EXIT_SUCCESS;
+
+    int status = writeBlock();
+
+    ArchiveFooter footer;
+    footer.magic = ARCHIVE_INDEX_MAGIC;
+    footer.blocks = index_.size();
+    footer.index_offset = offset_;
+
+    struct iovec iov[2];
+    iov[0].iov_base = index_.data();
+    iov[0].iov_len = index_.size() * sizeof(ArchiveIndexEntry);
+    iov[1].iov_base = &footer;
+    iov[1].iov_len = sizeof(footer);
+    if (writev(fd_, iov, 2) != (ssize_t) (iov[0].iov_len + iov[1].iov_len))
+        status = EXIT_FAILURE;
+
+    ::close(fd_);
+    fd_ = -1;
+    return status;
+}
+
+int ArchiveWriter::append(int64_t t_ns, int64_t value)
+{
+    if (fd_ < 0)
+        return EXIT_FAILURE;
+
+    int64_t t = t_ns / header_.t_unit_ns;
+
+    if (block_.count == 0) {
+        if (!index_.empty() && t < index_.back().t_last)
+            return EXIT_FAILURE;
+        block_.t_first = t;
+        block_.v_first = value;
+        dt_prev_ = 0;
+        dv_prev_ = 0;
+    }
+    else {
+        if (t < t_prev_)
+            return EXIT_FAILURE;
+
+        int64_t dt = t - t_prev_;
+        used_ += putVarint(&payload_[used_], zigzag(dt - dt_prev_));
+        dt_prev_ = dt;
+
+        int64_t dv = value - v_prev_;
+        if (header_.mode == ARCHIVE_DELTA_OF_DELTA) {
+            used_ += putVarint(&payload_[used_], zigzag(dv - dv_prev_));
+            dv_prev_ = dv;
+        }
+        else
+            used_ += putVarint(&payload_[used_], zigzag(dv));
+    }
+
+    t_prev_ = t;
+    v_prev_ = value;
+    block_.t_last = t;
+    block_.count++;
+    samples_++;
+
+    if (block_.count == header_.block_samples)
+        return writeBlock();
+    return EXIT_SUCCESS;
+}
+
+int ArchiveWriter::writeBlock()
+{
+    if (block_.count == 0)
+        return EXIT_SUCCESS;
+
+    block_.magic = ARCHIVE_BLOCK_MAGIC;
+    block_.bytes = used_;
+    block_.crc = logCrc32(payload_.data(), used_);
+
+    ArchiveIndexEntry entry;
+    entry.offset = offset_;
+    entry.t_first = block_.t_first;
+    entry.t_last = block_.t_last;
+    entry.count = block_.count;
+    entry.reserved = 0;
+    index_.push_back(entry);
+
+    struct iovec iov[2];
+    iov[0].iov_base = &block_;
+    iov[0].iov_len = sizeof(block_);
+    iov[1].iov_base = payload_.data();
+    iov[1].iov_len = used_;
+
+    size_t bytes = sizeof(block_) + used_;
+    ssize_t written = writev(fd_, iov, 2);
+    block_.count = 0;
+    used_ = 0;
+    if (written != (ssize_t) bytes) {
+        fprintf(stderr, "ERROR: Archive write failed: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    offset_ += bytes;
+    return EXIT_SUCCESS;
+}
+
+bool ArchiveWriter::isOpen() const
+{
+    return fd_ >= 0;
+}
+
+uint64_t ArchiveWriter::samples() const
+{
+    return samples_;
+}
+
+uint64_t ArchiveWriter::bytes() const
+{
+    return offset_ + used_;
+}
+
+/*
+ * ArchiveReader
+ */
+
+ArchiveReader::ArchiveReader()
+{
+    fd_ = -1;
+    samples_ = 0;
+    recovered_ = false;
+}
+
+ArchiveReader::~ArchiveReader()
+{
+    close();
+}
+
+int ArchiveReader::open(const char *path)
+{
+    close();
+
+    fd_ = ::open(path, O_RDONLY);
+    if (fd_ < 0) {
+        fprintf(stderr, "ERROR: Cannot open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    fstat(fd_, &st);
+    int64_t size = st.st_size;
+
+    if (pread(fd_, &header_, sizeof(header_), 0) != sizeof(header_) ||
+        memcmp(header_.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 ||
+        header_.version != ARCHIVE_VERSION) {
+        fprintf(stderr, "ERROR: %s is not a version %d archive\n", path, ARCHIVE_VERSION);
+        close();
+        return EXIT_FAILURE;
+    }
+
+    ArchiveFooter footer;
+    bool indexed = size >= (int64_t) (sizeof(header_) + sizeof(footer)) &&
+        pread(fd_, &footer, sizeof(footer), size - sizeof(footer)) == sizeof(footer) &&
+        footer.magic == ARCHIVE_INDEX_MAGIC &&
+        footer.index_offset + (int64_t) (footer.blocks * sizeof(ArchiveIndexEntry) + sizeof(footer)) == size;
+
+    if (indexed) {
+        index_.resize(footer.blocks);
+        size_t bytes = footer.blocks * sizeof(ArchiveIndexEntry);
+        if (pread(fd_, index_.data(), bytes, footer.index_offset) != (ssize_t) bytes)
+            indexed = false;
+    }
+
+    if (!indexed) {
+        // No footer: the writer did not get to close(). Walk the blocks
+        index_.clear();
+        int64_t offset = sizeof(header_);
+        ArchiveBlock block;
+        while (pread(fd_, &block, sizeof(block), offset) == sizeof(block) &&
+               block.magic == ARCHIVE_BLOCK_MAGIC &&
+               offset + (int64_t) (sizeof(block) + block.bytes) <= size) {
+            ArchiveIndexEntry entry;
+            entry.offset = offset;
+            entry.t_first = block.t_first;
+            entry.t_last = block.t_last;
+            entry.count = block.count;
+            entry.reserved = 0;
+            index_.push_back(entry);
+            offset += sizeof(block) + block.bytes;
+        }
+        recovered_ = true;
+    }
+
+    for (size_t b=0; b<index_.size(); b++)
+        samples_ += index_[b].count;
+    return EXIT_SUCCESS;
+}
+
+int ArchiveReader::close()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+    index_.clear();
+    samples_ = 0;
+    recovered_ = false;
+    return EXIT_SUCCESS;
+}
+
+const ArchiveHeader &ArchiveReader::header() const
+{
+    return header_;
+}
+
+uint64_t ArchiveReader::samples() const
+{
+    return samples_;
+}
+
+size_t ArchiveReader::blocks() const
+{
+    return index_.size();
+}
+
+int64_t ArchiveReader::firstTime() const
+{
+    return index_.empty() ? 0 : index_.front().t_first * header_.t_unit_ns;
+}
+
+int64_t ArchiveReader::lastTime() const
+{
+    return index_.empty() ? 0 : index_.back().t_last * header_.t_unit_ns;
+}
+
+bool ArchiveReader::recovered() const
+{
+    return recovered_;
+}
+
+int ArchiveReader::readBlock(size_t b, std::vector<int64_t> *t, std::vector<int64_t> *v)
+{
+    if (b >= index_.size())
+        return EXIT_FAILURE;
+
+    ArchiveBlock block;
+    if (pread(fd_, &block, sizeof(block), index_[b].offset) != sizeof(block) ||
+        block.magic != ARCHIVE_BLOCK_MAGIC)
+        return EXIT_FAILURE;
+
+    buffer_.resize(block.bytes);
+    if (pread(fd_, buffer_.data(), block.bytes, index_[b].offset + sizeof(block)) != (ssize_t) block.bytes ||
+        logCrc32(buffer_.data(), block.bytes) != block.crc) {
+        fprintf(stderr, "ERROR: Archive block %zu is corrupt\n", b);
+        return EXIT_FAILURE;
+    }
+
+    const uint8_t *p = buffer_.data();
+    const uint8_t *end = p + block.bytes;
+    int64_t unit = header_.t_unit_ns;
+    bool dod = header_.mode == ARCHIVE_DELTA_OF_DELTA;
+
+    int64_t tick = block.t_first, dt = 0;
+    int64_t value = block.v_first, dv = 0;
+    t->push_back(tick * unit);
+    v->push_back(value);
+
+    for (uint32_t i=1; i<block.count; i++) {
+        uint64_t u1, u2;
+        size_t n1 = getVarint(p, end, &u1);
+        size_t n2 = n1 ? getVarint(p + n1, end, &u2) : 0;
+        if (n2 == 0) {
+            fprintf(stderr, "ERROR: Archive block %zu is truncated\n", b);
+            return EXIT_FAILURE;
+        }
+        p += n1 + n2;
+
+        dt += unzigzag(u1);
+        tick += dt;
+        if (dod) {
+            dv += unzigzag(u2);
+            value += dv;
+        }
+        else
+            value += unzigzag(u2);
+
+        t->push_back(tick * unit);
+        v->push_back(value);
+    }
+    return EXIT_SUCCESS;
+}
+
+size_t ArchiveReader::read(int64_t t_from, int64_t t_to, std::vector<int64_t> *t,
+                           std::vector<int64_t> *v, size_t *decoded)
+{
+    int64_t from = t_from / header_.t_unit_ns;
+    int64_t to = t_to / header_.t_unit_ns;
+
+    // First block that ends at or after the start of the range
+    size_t lo = 0, hi = index_.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (index_[mid].t_last < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    size_t n = 0, blocks = 0;
+    std::vector<int64_t> bt, bv;
+    for (size_t b=lo; b<index_.size() && index_[b].t_first <= to; b++) {
+        bt.clear();
+        bv.clear();
+        if (readBlock(b, &bt, &bv) != EXIT_SUCCESS)
+            continue;
+        blocks++;
+        for (size_t i=0; i<bt.size(); i++) {
+            if (bt[i] < t_from || bt[i] > t_to)
+                continue;
+            t->push_back(bt[i]);
+            v->push_back(bv[i]);
+            n++;
+        }
+    }
+    if (decoded)
+        *decoded = blocks;
+    return n;
+}
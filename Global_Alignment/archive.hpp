@@ -0,0 +1,141 @@
+#ifndef _ARCHIVE_HPP_
+#define _ARCHIVE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+/*
+ * Compressed archive of one integer series, e.g. DLS distances in 0.1 mm.
+ *
+ *    ArchiveHeader                              32 bytes
+ *    block: ArchiveBlock + payload              40 + a few bytes per sample
+ *    ...
+ *    index: ArchiveIndexEntry per block         32 bytes each
+ *    ArchiveFooter                              16 bytes
+ *
+ * Timestamps are stored in ticks of t_unit_ns as zigzag varint
+ * delta-of-deltas, so a steady sample rate costs one byte per sample.
+ * Values are zigzag varint deltas (or delta-of-deltas, for ramps): a
+ * series that barely moves costs one byte per sample too.
+ *
+ * Blocks decode on their own. The index at the end lets a time-range read
+ * touch only the blocks it needs; if the writer died before writing it,
+ * the reader rebuilds it by walking the block headers.
+ */
+
+#define ARCHIVE_MAGIC         "STEWARC"
+#define ARCHIVE_VERSION       1
+#define ARCHIVE_BLOCK_MAGIC   0x4B4C4241      // "ABLK"
+#define ARCHIVE_INDEX_MAGIC   0x58444941      // "AIDX"
+
+enum ArchiveMode {
+    ARCHIVE_DELTA           = 0,
+    ARCHIVE_DELTA_OF_DELTA  = 1
+};
+
+struct ArchiveHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t mode;              // ArchiveMode of the values
+    int64_t  t_unit_ns;         // timestamp resolution
+    uint32_t block_samples;     // samples per full block
+    uint32_t reserved;
+};
+
+struct ArchiveBlock {
+    uint32_t magic;             // ARCHIVE_BLOCK_MAGIC
+    uint32_t count;             // samples in the block
+    uint32_t bytes;             // payload size
+    uint32_t crc;               // CRC-32 of the payload
+    int64_t  t_first;           // ticks
+    int64_t  t_last;
+    int64_t  v_first;
+};
+
+struct ArchiveIndexEntry {
+    int64_t  offset;            // of the ArchiveBlock in the file
+    int64_t  t_first;           // ticks
+    int64_t  t_last;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct ArchiveFooter {
+    uint32_t magic;             // ARCHIVE_INDEX_MAGIC
+    uint32_t blocks;
+    int64_t  index_offset;
+};
+
+class ArchiveWriter {
+    public:
+        ArchiveWriter();
+        ~ArchiveWriter();
+
+        int open(const char *path, ArchiveMode mode = ARCHIVE_DELTA,
+                 int64_t t_unit_ns = 1000, uint32_t block_samples = 4096);
+        /* Writes the last block, the index and the footer */
+        int close();
+
+        /* EXIT_FAILURE if t_ns is older than the previous sample */
+        int append(int64_t t_ns, int64_t value);
+
+        bool isOpen() const;
+        uint64_t samples() const;
+        /* Bytes in the file so far, header and block headers included */
+        uint64_t bytes() const;
+
+    private:
+        int writeBlock();
+
+        int fd_;
+        ArchiveHeader header_;
+        ArchiveBlock block_;
+        std::vector<uint8_t> payload_;      // sized for a full block in open()
+        size_t used_;
+        int64_t t_prev_, dt_prev_;
+        int64_t v_prev_, dv_prev_;
+        std::vector<ArchiveIndexEntry> index_;
+        uint64_t samples_;
+        uint64_t offset_;
+};
+
+class ArchiveReader {
+    public:
+        ArchiveReader();
+        ~ArchiveReader();
+
+        int open(const char *path);
+        int close();
+
+        const ArchiveHeader &header() const;
+        uint64_t samples() const;
+        size_t blocks() const;
+        int64_t firstTime() const;      // ns
+        int64_t lastTime() const;
+
+        /* True if the index was rebuilt because the footer was missing */
+        bool recovered() const;
+
+        /* Appends block b to t/v (ns, values). EXIT_FAILURE on a bad checksum */
+        int readBlock(size_t b, std::vector<int64_t> *t, std::vector<int64_t> *v);
+
+        /*
+         * Appends the samples with t_from <= t <= t_to, decoding only the
+         * blocks that overlap the range. Returns the number of samples read
+         * and, in *decoded, the number of blocks decoded.
+         */
+        size_t read(int64_t t_from, int64_t t_to, std::vector<int64_t> *t,
+                    std::vector<int64_t> *v, size_t *decoded = NULL);
+
+    private:
+        int fd_;
+        ArchiveHeader header_;
+        std::vector<ArchiveIndexEntry> index_;
+        std::vector<uint8_t> buffer_;
+        uint64_t samples_;
+        bool recovered_;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <getopt.h>  // Argument parsing
+
+#include "piusb.hpp"
+#include "aligner.hpp"
+#include "dls.hpp"
+#include "procedure.hpp"
+
+static int help()
+{
+    char usage [] = "\nbringup: the alignment bring-up, independent devices at once       "
+        "\n                                                                   "
+        "\nRuns: power on, laser on, shutter calibrate and open, mirror        "
+        "\ncalibrate and to position b, then DLS tracking. The relay, shutter, "
+        "\nmirror and DLS work in parallel; a step waits only for the steps it "
+        "\nneeds and for its device. Prints the timing of every step and the   "
+        "\ncritical path.                                                      "
+        "\n                                                                   "
+        "\nUsage: bringup [arguments]                                         "
+        "\n   e.g. bringup --dls /dev/ttyUSB0                                 "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --dls <port>          Check DLS tracking starts on this port   "
+        "\n                          as the last step (default: no DLS)       "
+        "\n    --sequential          One step after the other, as separate    "
+        "\n                          align/dls calls would                    "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+/* A DLS stops tracking on its port when destroyed: only made once the port is open */
+static int openDLS(DLS **dls, const char *port)
+{
+    int fd = open(port, O_RDWR | O_NOCTTY | O_SYNC);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: %d opening %s: %s\n", errno, port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    *dls = new DLS;
+    (*dls)->setFD(fd);
+    (*dls)->stopTracking();
+    return EXIT_SUCCESS;
+}
+
+static int startTracking(DLS *dls)
+{
+    dls->startTracking();
+    int distance = dls->readTracking();
+    if (distance < 0)
+        return EXIT_FAILURE;
+    printf("DLS tracking, %d\n", distance);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    const char *port = NULL;
+    bool sequential = false;
+
+    static struct option long_options[] = {
+        {"dls"       , required_argument , 0    , 'd'} ,
+        {"sequential", no_argument       , 0    , 's'} ,
+        {"help"      , no_argument       , 0    , 'h'} ,
+        {NULL        , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "d:sh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'd':
+                port = optarg;
+                break;
+            case 's':
+                sequential = true;
+                break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+
+    // Each device is opened by the first step that uses it
+    Align align;
+    Procedure p;
+    p.add("power on",          {"relay"},   {},                                  [&] { return align.powerOn(); });
+    p.add("laser on",          {"relay"},   {"power on"},                        [&] { return align.sLaserOn(); });
+    p.add("shutter calibrate", {"shutter"}, {"power on"},                        [&] { return align.shutterCalibrate(); });
+    p.add("shutter open",      {"shutter"}, {"shutter calibrate", "laser on"},   [&] { return align.shutterOpen(); });
+    p.add("mirror calibrate",  {"mirror"},  {"power on"},                        [&] { return align.mirrorCalibrate(); });
+    p.add("mirror b",          {"mirror"},  {"mirror calibrate"},                [&] { return align.mirrorPos(1); });
+    DLS *dls = NULL;
+    if (port) {
+        p.add("dls open",      {"dls"},     {},                                  [&] { return openDLS(&dls, port); });
+        p.add("dls tracking",  {"dls"},     {"dls open", "mirror b", "shutter open"},
+              [&] { return startTracking(dls); });
+    }
+
+    int status = p.run(!sequential);
+    p.printReport(stdout);
+    delete dls;
+    return status;
+}
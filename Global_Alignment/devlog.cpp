@@ -0,0 +1,80 @@
+#include "devlog.hpp"
+
+#include "spdlog/async.h"
+#include "spdlog/sinks/rotating_file_sink.h"
+#include "spdlog/sinks/stdout_color_sinks.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+/*
+ * Built into libstewart.so only, so libdls.so and libpiusb.so, and any
+ * program using both, share a single logger.
+ */
+
+static std::mutex init_mutex;
+static std::shared_ptr<spdlog::details::thread_pool> pool;
+static std::shared_ptr<spdlog::logger> logger;
+static std::atomic<spdlog::logger *> current(nullptr);
+
+static void create(const char *file, int level, size_t max_size, size_t max_files, size_t queue_size)
+{
+    std::vector<spdlog::sink_ptr> sinks;
+
+    spdlog::sink_ptr console = std::make_shared<spdlog::sinks::stderr_color_sink_mt>();
+    console->set_level(spdlog::level::warn);
+    sinks.push_back(console);
+
+    if (file && *file) {
+        try {
+            sinks.push_back(std::make_shared<spdlog::sinks::rotating_file_sink_mt>(file, max_size, max_files));
+        }
+        catch (const spdlog::spdlog_ex &ex) {
+            fprintf(stderr, "ERROR: Cannot open log file %s: %s\n", file, ex.what());
+        }
+    }
+
+    pool = std::make_shared<spdlog::details::thread_pool>(queue_size, 1);
+    logger = std::make_shared<spdlog::async_logger>("devices", sinks.begin(), sinks.end(), pool,
+                                                    spdlog::async_overflow_policy::overrun_oldest);
+    logger->set_level((spdlog::level::level_enum) level);
+    logger->flush_on(spdlog::level::err);
+    current.store(logger.get(), std::memory_order_release);
+}
+
+int devlogInit(const char *file, int level, size_t max_size, size_t max_files, size_t queue_size)
+{
+    std::lock_guard<std::mutex> lock(init_mutex);
+    if (logger) {
+        fprintf(stderr, "WARNING: devlogInit called after the logger was created\n");
+        return EXIT_FAILURE;
+    }
+    create(file, level, max_size, max_files, queue_size);
+    return EXIT_SUCCESS;
+}
+
+spdlog::logger *devlog()
+{
+    spdlog::logger *l = current.load(std::memory_order_acquire);
+    if (l)
+        return l;
+
+    std::lock_guard<std::mutex> lock(init_mutex);
+    if (!logger) {
+        int level = SPDLOG_LEVEL_INFO;
+        const char *env = getenv("DEVLOG_LEVEL");
+        if (env)
+            level = spdlog::level::from_str(env);
+        create(getenv("DEVLOG_FILE"), level, 5 * 1024 * 1024, 3, 8192);
+    }
+    return logger.get();
+}
+
+void devlogFlush()
+{
+    devlog()->flush();
+}
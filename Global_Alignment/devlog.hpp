@@ -0,0 +1,47 @@
+#ifndef _DEVLOG_HPP_
+#define _DEVLOG_HPP_
+
+/*
+ * Logging for the device libraries (libdls, libpiusb).
+ *
+ * Messages are fmt style:  DEVLOG_ERROR("error {} from tcgetattr", errno);
+ *
+ * Calls below SPDLOG_ACTIVE_LEVEL compile to nothing, arguments included.
+ * The Makefile sets it from LOGLEVEL (make exe LOGLEVEL=SPDLOG_LEVEL_TRACE).
+ *
+ * All messages go through one asynchronous logger: the calling thread only
+ * formats into a queue slot, console and file writes happen on the logger's
+ * own thread. If the queue fills up the oldest message is dropped, so a
+ * serial or USB thread never waits on a terminal or a disk.
+ */
+#ifndef SPDLOG_ACTIVE_LEVEL
+#define SPDLOG_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
+#endif
+
+#include "spdlog/spdlog.h"
+#include "spdlog/fmt/bin_to_hex.h"
+
+/*
+ * Sets up the logger: warnings and errors on stderr, and with a file
+ * everything from level up in a rotating log (max_size bytes x max_files).
+ *
+ * Call it first thing in main(). Without it the first message creates the
+ * logger from the environment: DEVLOG_FILE=<path>, DEVLOG_LEVEL=<trace|debug|info|...>.
+ * Returns EXIT_FAILURE if a logger already exists.
+ */
+int devlogInit(const char *file, int level = SPDLOG_LEVEL_INFO,
+               size_t max_size = 5 * 1024 * 1024, size_t max_files = 3,
+               size_t queue_size = 8192);
+
+spdlog::logger *devlog();
+
+/* Asks the logger thread to flush the sinks */
+void devlogFlush();
+
+#define DEVLOG_TRACE(...)    SPDLOG_LOGGER_TRACE(devlog(), __VA_ARGS__)
+#define DEVLOG_DEBUG(...)    SPDLOG_LOGGER_DEBUG(devlog(), __VA_ARGS__)
+#define DEVLOG_INFO(...)     SPDLOG_LOGGER_INFO(devlog(), __VA_ARGS__)
+#define DEVLOG_WARN(...)     SPDLOG_LOGGER_WARN(devlog(), __VA_ARGS__)
+#define DEVLOG_ERROR(...)    SPDLOG_LOGGER_ERROR(devlog(), __VA_ARGS__)
+
+#endif
@@ -1,8 +1,9 @@
 #ifndef _LIBDLS_HPP_
 #define _LIBDLS_HPP_
 
-#include "spdlog/spdlog.h"
-#include "spdlog/fmt/ostr.h"
+#include "devlog.hpp"
+
+class DriftModel;
 
 class DLS {
 public:
@@ -45,14 +46,28 @@ public:
     int setOutputFilter(int nsamples, int nspikes, int nerrors);
     int getSignalQuality();
 
+    /*
+     * Temperature-drift compensation of every distance read, using the
+     * last readTemperature(). With learn the model is fitted as well,
+     * only do that while the target is not moving.
+     */
+    int setDriftModel(DriftModel *model, bool learn);
+
     int help();
 private:
     bool userCalibrated_;
     int fd_;
 
+    DriftModel *drift_;
+    int driftChannel_;
+    bool driftLearn_;
+    int temperature_;
+    int traceChannel_;      // -1 unless IOTRACE_FILE is recording
+
     int setInterfaceAttribs (int speed, int parity);
     void setBlocking (int should_block);
     int rxData();
+    int compensate(int distance);
 
     int serialRead (char *read_data);
     int serialWrite (char *write_data, int write_size);
@@ -0,0 +1,242 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <getopt.h>  // Argument parsing
+
+#include "archive.hpp"
+#include "samplelog.hpp"
+#include "timestamp.hpp"
+
+static int help()
+{
+    char usage [] = "\ndlsarc: compressed DLS distance archives                      "
+        "\n                                                                   "
+        "\nUsage: dlsarc [arguments]                                          "
+        "\n   e.g. dls --archive night.dla -c                                 "
+        "\n        dlsarc --dump night.dla --from 3600 --to 3660              "
+        "\n        dlsarc --from-log dls.slog --out dls.dla                   "
+        "\n        dlsarc --bench 576000                                      "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --info <file>         Samples, blocks, time span, bytes/sample "
+        "\n    --dump <file>         Print t[s] distance[mm]                  "
+        "\n    --from <s> --to <s>   Only this range (s from the first sample)"
+        "\n    --from-log <file>     Archive the DLS records of a sample log  "
+        "\n    --out <file>          ... into this archive                    "
+        "\n    --bench <samples>     Compression ratio and encode/decode MB/s "
+        "\n                          on a simulated 20 Hz run (576000 is 8 h) "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+static int info(const char *path)
+{
+    ArchiveReader arc;
+    if (arc.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    FILE *f = fopen(path, "r");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+
+    const ArchiveHeader &h = arc.header();
+    printf("%s: version %u, %s, %lld ns ticks, %u samples/block%s\n", path, h.version,
+           h.mode == ARCHIVE_DELTA_OF_DELTA ? "delta-of-delta" : "delta",
+           (long long) h.t_unit_ns, h.block_samples,
+           arc.recovered() ? ", index rebuilt (not closed)" : "");
+    printf("%llu samples in %zu blocks, %.3f s\n", (unsigned long long) arc.samples(), arc.blocks(),
+           (arc.lastTime() - arc.firstTime()) * 1e-9);
+    if (arc.samples())
+        printf("%ld bytes, %.2f bytes/sample\n", size, (double) size / arc.samples());
+    return EXIT_SUCCESS;
+}
+
+static int dump(const char *path, double from, double to)
+{
+    ArchiveReader arc;
+    if (arc.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    int64_t t0 = arc.firstTime();
+    std::vector<int64_t> t, v;
+    size_t blocks;
+    arc.read(t0 + (int64_t) (from * 1e9), to < 0 ? INT64_MAX : t0 + (int64_t) (to * 1e9), &t, &v, &blocks);
+
+    for (size_t i=0; i<t.size(); i++)
+        printf("%10.4f %6.1f mm\n", (t[i] - t0) * 1e-9, v[i] / 10.0);
+    fprintf(stderr, "# %zu samples, %zu of %zu blocks decoded\n", t.size(), blocks, arc.blocks());
+    return EXIT_SUCCESS;
+}
+
+static int fromLog(const char *path, const char *out)
+{
+    SampleLogReader log;
+    if (log.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    ArchiveWriter arc;
+    if (arc.open(out) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    for (size_t b=0; b<log.blocks(); b++) {
+        uint32_t n;
+        const LogRecord *r = log.block(b, &n);
+        for (uint32_t i=0; i<n; i++)
+            if (r[i].type == LOG_DLS)
+                arc.append(r[i].t_ns, llround(r[i].v[0]));
+    }
+    fprintf(stderr, "%llu samples, %llu bytes\n", (unsigned long long) arc.samples(),
+            (unsigned long long) arc.bytes());
+    return arc.close();
+}
+
+/*
+ * 20 Hz with ~100 us of scheduling jitter, distance 0.1 mm steps: slow
+ * thermal drift, +-1 digit of noise, a few jumps when something moves.
+ */
+static int bench(long n)
+{
+    std::vector<int64_t> t(n), v(n);
+    srand(1);
+    int64_t now = 1000000000LL;
+    double drift = 0;
+    int64_t base = 25000;
+    size_t text = 0;
+    char line[64];
+    for (long i=0; i<n; i++) {
+        now += 50000000LL + (rand() % 200000) - 100000;
+        drift += ((rand() % 2001) - 1000) * 1e-5;
+        if (rand() % 20000 == 0)
+            base += (rand() % 2001) - 1000;
+        t[i] = now;
+        v[i] = base + llround(drift) + (rand() % 3) - 1;
+        text += snprintf(line, sizeof(line), "%10.4f %6.1f mm\n", (now - t[0]) * 1e-9, v[i] / 10.0);
+    }
+    double raw = n * 16.0;     // int64 time + int64 value
+
+    const char *path = "/tmp/dlsarc-bench.dla";
+    const char *mode_name[2] = { "delta", "delta-of-delta" };
+
+    printf("%ld samples (%.1f h at 20 Hz), raw %.1f MB, text %.1f MB\n",
+           n, n / 20.0 / 3600, raw / 1e6, text / 1e6);
+    for (int mode=0; mode<2; mode++) {
+        ArchiveWriter w;
+        int64_t t0 = timestampNs();
+        w.open(path, (ArchiveMode) mode);
+        for (long i=0; i<n; i++)
+            w.append(t[i], v[i]);
+        w.close();
+        double encode = (timestampNs() - t0) * 1e-9;
+        double bytes = w.bytes();
+
+        ArchiveReader r;
+        std::vector<int64_t> rt, rv;
+        rt.reserve(n);
+        rv.reserve(n);
+        t0 = timestampNs();
+        r.open(path);
+        for (size_t b=0; b<r.blocks(); b++)
+            r.readBlock(b, &rt, &rv);
+        double decode = (timestampNs() - t0) * 1e-9;
+
+        long bad = 0;
+        for (long i=0; i<n; i++)
+            if (rt[i] / 1000 != t[i] / 1000 || rv[i] != v[i])
+                bad++;
+
+        // One minute out of the middle
+        rt.clear();
+        rv.clear();
+        size_t blocks;
+        t0 = timestampNs();
+        r.read(t[n/2], t[n/2] + 60000000000LL, &rt, &rv, &blocks);
+        double range = (timestampNs() - t0) * 1e-9;
+
+        printf("%-15s %7.2f bytes/sample  ratio %5.1f (raw) %5.1f (text)  encode %6.1f MB/s"
+               "  decode %6.1f MB/s  1 min range: %zu samples, %zu blocks, %.2f ms%s\n",
+               mode_name[mode], bytes / n, raw / bytes, text / bytes, raw / encode / 1e6,
+               raw / decode / 1e6, rt.size(), blocks, range * 1e3, bad ? "  MISMATCH" : "");
+    }
+    remove(path);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc==1) return help();
+
+    const char *info_path = NULL;
+    const char *dump_path = NULL;
+    const char *log_path = NULL;
+    const char *out_path = NULL;
+    double from = 0, to = -1;
+    long bench_samples = 0;
+
+    static struct option long_options[] = {
+        {"info"     , required_argument , 0    , 'i'} ,
+        {"dump"     , required_argument , 0    , 'd'} ,
+        {"from"     , required_argument , 0    , 'f'} ,
+        {"to"       , required_argument , 0    , 't'} ,
+        {"from-log" , required_argument , 0    , 'l'} ,
+        {"out"      , required_argument , 0    , 'o'} ,
+        {"bench"    , required_argument , 0    , 'b'} ,
+        {"help"     , no_argument       , 0    , 'h'} ,
+        {NULL       , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "i:d:f:t:l:o:b:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'i':
+                info_path = optarg;
+                break;
+            case 'd':
+                dump_path = optarg;
+                break;
+            case 'f':
+                from = atof(optarg);
+                break;
+            case 't':
+                to = atof(optarg);
+                break;
+            case 'l':
+                log_path = optarg;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'b':
+                bench_samples = atol(optarg);
+                if (bench_samples <= 0) {
+                    fprintf(stderr, "ERROR: --bench %s: expected a number of samples\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+
+    if (info_path)
+        return info(info_path);
+    if (dump_path)
+        return dump(dump_path, from, to);
+    if (log_path) {
+        if (!out_path) {
+            fprintf(stderr, "ERROR: --from-log needs --out <file>\n");
+            return EXIT_FAILURE;
+        }
+        return fromLog(log_path, out_path);
+    }
+    if (bench_samples > 0)
+        return bench(bench_samples);
+    return help();
+}
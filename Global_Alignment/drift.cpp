@@ -0,0 +1,143 @@
+#include "drift.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define P_INIT  1e6     // initial covariance: know nothing about the slope
+#define P_MAX   1e8     // no forgetting above this (temperature flat, P would wind up)
+
+DriftModel::DriftModel(double lambda)
+{
+    lambda_ = lambda;
+}
+
+int DriftModel::channel(const char *name)
+{
+    for (size_t i=0; i<channels_.size(); i++)
+        if (channels_[i].name == name)
+            return i;
+
+    Channel c;
+    c.name = name;
+    c.t_ref = 0;
+    c.offset = 0;
+    c.slope = 0;
+    c.p[0] = P_INIT;
+    c.p[1] = 0;
+    c.p[2] = P_INIT;
+    c.n = 0;
+    channels_.push_back(c);
+    return channels_.size() - 1;
+}
+
+void DriftModel::update(int channel, double temperature, double value)
+{
+    Channel &c = channels_[channel];
+
+    if (c.n == 0) {
+        c.t_ref = temperature;
+        c.offset = value;
+    }
+    c.n++;
+
+    double d = temperature - c.t_ref;
+    double lambda = (c.p[0] + c.p[2] > P_MAX) ? 1.0 : lambda_;
+
+    // P * phi, phi = [1, d]
+    double pp0 = c.p[0] + c.p[1] * d;
+    double pp1 = c.p[1] + c.p[2] * d;
+    double denom = lambda + pp0 + pp1 * d;
+    double k0 = pp0 / denom;
+    double k1 = pp1 / denom;
+
+    double err = value - (c.offset + c.slope * d);
+    c.offset += k0 * err;
+    c.slope  += k1 * err;
+
+    c.p[0] = (c.p[0] - k0 * pp0) / lambda;
+    c.p[1] = (c.p[1] - k0 * pp1) / lambda;
+    c.p[2] = (c.p[2] - k1 * pp1) / lambda;
+}
+
+double DriftModel::slope(int channel) const
+{
+    return channels_[channel].slope;
+}
+
+double DriftModel::offset(int channel) const
+{
+    return channels_[channel].offset;
+}
+
+uint64_t DriftModel::samples(int channel) const
+{
+    return channels_[channel].n;
+}
+
+int DriftModel::channels() const
+{
+    return channels_.size();
+}
+
+const char *DriftModel::name(int channel) const
+{
+    return channels_[channel].name.c_str();
+}
+
+int DriftModel::load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return EXIT_SUCCESS;
+
+    char line[512];
+    char name[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#')
+            continue;
+
+        Channel c;
+        unsigned long long n;
+        if (sscanf(line, "%255s %lf %lf %lf %lf %lf %lf %llu", name, &c.t_ref, &c.offset,
+                   &c.slope, &c.p[0], &c.p[1], &c.p[2], &n) != 8) {
+            fprintf(stderr, "WARNING: %s: bad line %s", path, line);
+            continue;
+        }
+        c.n = n;
+        c.name = name;
+        channels_[channel(name)] = c;
+    }
+    fclose(f);
+    return EXIT_SUCCESS;
+}
+
+int DriftModel::save(const char *path) const
+{
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Cannot write %s\n", tmp);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(f, "# channel t_ref offset slope P00 P01 P11 samples\n");
+    for (size_t i=0; i<channels_.size(); i++) {
+        const Channel &c = channels_[i];
+        fprintf(f, "%s %.17g %.17g %.17g %.17g %.17g %.17g %llu\n", c.name.c_str(), c.t_ref,
+                c.offset, c.slope, c.p[0], c.p[1], c.p[2], (unsigned long long) c.n);
+    }
+
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+
+    if (rename(tmp, path) != 0) {
+        fprintf(stderr, "ERROR: Cannot replace %s\n", path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
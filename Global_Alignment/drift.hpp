@@ -0,0 +1,65 @@
+#ifndef _DRIFT_HPP_
+#define _DRIFT_HPP_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * Online temperature-drift model, one per channel:
+ *
+ *    value = offset + slope * (T - t_ref)
+ *
+ * fitted by recursive least squares with exponential forgetting, so slow
+ * changes of the optics are followed. correct() removes the temperature
+ * term only, the offset (the signal we care about) is left alone:
+ *
+ *    corrected = value - slope * (T - t_ref)
+ *
+ * Learning only makes sense while the true value is not moving (beam
+ * parked, actuators idle); correction is always safe to apply.
+ */
+class DriftModel {
+    public:
+        DriftModel(double lambda = 0.9995);
+
+        /* Index of the named channel, created on first use */
+        int channel(const char *name);
+
+        /* One RLS step, ~20 flops */
+        void update(int channel, double temperature, double value);
+
+        /* One multiply-add */
+        double correct(int channel, double temperature, double value) const
+        {
+            const Channel &c = channels_[channel];
+            return value - c.slope * (temperature - c.t_ref);
+        }
+
+        double slope(int channel) const;
+        double offset(int channel) const;
+        uint64_t samples(int channel) const;
+        int channels() const;
+        const char *name(int channel) const;
+
+        /* Missing file is not an error: the model starts empty */
+        int load(const char *path);
+        /* Written to <path>.tmp then renamed, a crash never leaves half a file */
+        int save(const char *path) const;
+
+    private:
+        struct Channel {
+            std::string name;
+            double t_ref;      // temperature of the first sample
+            double offset;
+            double slope;
+            double p[3];       // covariance P00 P01 P11
+            uint64_t n;
+        };
+
+        std::vector<Channel> channels_;
+        double lambda_;
+};
+
+#endif
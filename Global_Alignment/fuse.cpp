@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <fcntl.h>   // For file handling
+#include <getopt.h>  // Argument parsing
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "dls.hpp"
+#include "fusion.hpp"
+#include "periodic.hpp"
+#include "piusb.hpp"
+#include "psd.hpp"
+#include "rtprofile.hpp"
+#include "timestamp.hpp"
+
+int kbhit(void);
+
+static std::atomic<bool> running;
+
+static int help()
+{
+    char usage [] = "\nfuse: PSD, DLS and actuator positions on one timeline          "
+        "\n                                                                   "
+        "\nUsage: fuse [arguments] > data.csv                                 "
+        "\n   e.g. fuse --psd /dev/ttyACM0 --dls /dev/ttyUSB0 --motor --rate 50"
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --psd <tty>           Add a PSD board (repeatable)             "
+        "\n    --discover            Add every /dev/ttyACM* PSD board         "
+        "\n    --dls <tty>           Track the DIMETIX range-finder           "
+        "\n    --motor               Poll the USB-MO motor position           "
+        "\n    --twister             Poll the USB-Twister position            "
+        "\n    --rate <Hz>           Merged record rate (default 100)         "
+        "\n    --latency <ms>        How long to wait for late samples        "
+        "\n                          (default 200)                            "
+        "\n    --hold                Sample-and-hold instead of linear        "
+        "\n                          interpolation                            "
+        "\n    --seconds <s>         Stop after s seconds (default: any key)  "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+static void forwardPSD(PSDBus *bus, Fusion *fusion, std::vector<int> streams)
+{
+    uint64_t cursor = bus->head();
+    PSDSample samples[256];
+    while (running) {
+        if (!bus->wait(cursor, 100))
+            continue;
+        size_t n = bus->read(&cursor, samples, 256);
+        for (size_t i=0; i<n; i++) {
+            double v[5] = {samples[i].x[0], samples[i].y[0], samples[i].x[1], samples[i].y[1],
+                           samples[i].temperature};
+            fusion->push(streams[samples[i].board], samples[i].t_ns, v);
+        }
+    }
+}
+
+static void trackDLS(DLS *dls, Fusion *fusion, int stream)
+{
+    rtEnterThread(RT_ACQUIRE, "dls");
+    dls->stopTracking();
+    dls->startTracking();
+    while (running) {
+        int distance = dls->readTracking();
+        int64_t t = timestampNs();
+        if (distance < 0)
+            continue;
+        double v = distance / 10.0;
+        fusion->push(stream, t, &v);
+    }
+    dls->stopTracking();
+}
+
+#define POSITION_PERIOD_NS 10000000LL
+
+template <class Device>
+static void pollPosition(Device *device, Fusion *fusion, int stream)
+{
+    // getPosition() has no error return: a failed read shows in the counters
+    uint64_t failures = device->usbStats().read.failures;
+
+    // Stamp the middle of the USB round trip
+    int64_t t0 = timestampNs();
+    double v = device->getPosition();
+    int64_t t1 = timestampNs();
+
+    if (device->usbStats().read.failures != failures)
+        return;
+    fusion->push(stream, t0 + (t1 - t0) / 2, &v);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc==1) return help();
+
+    std::vector<const char *> psd_ports;
+    bool discover = false;
+    const char *dls_port = NULL;
+    bool motor = false;
+    bool twister = false;
+    double rate = 100.0;
+    double latency_ms = 200.0;
+    Fusion::Interpolation mode = Fusion::LINEAR;
+    double seconds = 0;
+
+    static struct option long_options[] = {
+        {"psd"      , required_argument , 0    , 'p'} ,
+        {"discover" , no_argument       , 0    , 'D'} ,
+        {"dls"      , required_argument , 0    , 'd'} ,
+        {"motor"    , no_argument       , 0    , 'm'} ,
+        {"twister"  , no_argument       , 0    , 't'} ,
+        {"rate"     , required_argument , 0    , 'r'} ,
+        {"latency"  , required_argument , 0    , 'l'} ,
+        {"hold"     , no_argument       , 0    , 'H'} ,
+        {"seconds"  , required_argument , 0    , 's'} ,
+        {"help"     , no_argument       , 0    , 'h'} ,
+        {NULL       , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "p:Dd:mtr:l:Hs:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'p': psd_ports.push_back(optarg);  break;
+            case 'D': discover = true;              break;
+            case 'd': dls_port = optarg;            break;
+            case 'm': motor = true;                 break;
+            case 't': twister = true;               break;
+            case 'r': rate = atof(optarg);          break;
+            case 'l': latency_ms = atof(optarg);    break;
+            case 'H': mode = Fusion::HOLD;          break;
+            case 's': seconds = atof(optarg);       break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+    if (rate <= 0) {
+        fprintf(stderr, "ERROR: --rate must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    int64_t period = (int64_t) (1e9 / rate);
+    // A stream that has been silent for 5 periods is reported as missing
+    int64_t stale = 5 * period + (int64_t) (latency_ms * 1e6);
+    Fusion fusion(period, (int64_t) (latency_ms * 1e6));
+
+    rtLockMemory();     // RT_PROFILE: before the buffers and threads
+    PSDBus bus;
+    PSDHub hub(&bus);
+    for (size_t i=0; i<psd_ports.size(); i++)
+        hub.addBoard(psd_ports[i], PSDCalibration::identity());
+    if (discover)
+        hub.discover();
+
+    std::vector<int> psd_streams;
+    for (size_t i=0; i<hub.boards(); i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "psd%d", (int) i);
+        psd_streams.push_back(fusion.addStream(name, 5, mode, stale));
+    }
+
+    DLS *dls = NULL;
+    int dls_stream = -1;
+    if (dls_port) {
+        int fd = open (dls_port, O_RDWR | O_NOCTTY | O_SYNC);
+        if (fd < 0) {
+            fprintf(stderr, "ERROR: %d opening %s: %s\n", errno, dls_port, strerror (errno));
+            return EXIT_FAILURE;
+        }
+        dls = new DLS;
+        dls->setFD(fd);
+        dls_stream = fusion.addStream("dls", 1, mode, stale);
+    }
+
+    int motor_stream = motor ? fusion.addStream("motor", 1, Fusion::HOLD, stale) : -1;
+    int twister_stream = twister ? fusion.addStream("twister", 1, Fusion::HOLD, stale) : -1;
+
+    if (fusion.columns() == 0) {
+        fprintf(stderr, "ERROR: Nothing to fuse\n");
+        return EXIT_FAILURE;
+    }
+
+    running = true;
+    std::vector<std::thread> threads;
+    if (hub.boards()) {
+        hub.start();
+        threads.push_back(std::thread(forwardPSD, &bus, &fusion, psd_streams));
+    }
+    if (dls_stream >= 0)
+        threads.push_back(std::thread(trackDLS, dls, &fusion, dls_stream));
+
+    printf("t, %s\n", fusion.header().c_str());
+
+    int64_t t0 = timestampNs();
+    int64_t end = seconds > 0 ? t0 + (int64_t) (seconds * 1e9) : 0;
+    Fusion::Record records[64];
+
+    // Output on one thread, the USB round trips of the position polls on the other
+    PeriodicScheduler scheduler(2);
+    Motor *motor_device = motor_stream >= 0 ? new Motor : NULL;
+    Twister *twister_device = twister_stream >= 0 ? new Twister : NULL;
+    if (motor_device)
+        scheduler.add("motor", POSITION_PERIOD_NS, [&](int64_t) {
+            pollPosition(motor_device, &fusion, motor_stream);
+        }, OVERRUN_SKIP, 1);
+    if (twister_device)
+        scheduler.add("twister", POSITION_PERIOD_NS, [&](int64_t) {
+            pollPosition(twister_device, &fusion, twister_stream);
+        }, OVERRUN_SKIP, 1, POSITION_PERIOD_NS / 2);
+
+    // Records come out in batches, no need to wake up for every period
+    int64_t output_period = period;
+    if (output_period < 5000000)   output_period = 5000000;
+    if (output_period > 100000000) output_period = 100000000;
+    scheduler.add("output", output_period, [&](int64_t release) {
+        size_t n;
+        while ((n = fusion.poll(release, records, 64)) > 0) {
+            for (size_t i=0; i<n; i++) {
+                printf("%.6f", (records[i].t_ns - t0) * 1e-9);
+                for (int col=0; col<records[i].columns; col++)
+                    printf(", %.6e", records[i].v[col]);
+                printf("\n");
+            }
+        }
+    });
+    scheduler.start();
+
+    while (end ? timestampNs() < end : !kbhit())
+        usleep(20000);
+
+    running = false;
+    scheduler.stop();
+    for (size_t i=0; i<threads.size(); i++)
+        threads[i].join();
+    hub.stop();
+    delete dls;
+    delete motor_device;
+    delete twister_device;
+
+    for (int i=0; i<fusion.streams(); i++) {
+        Fusion::StreamStats s = fusion.stats(i);
+        fprintf(stderr, "# stream %d: pushed %llu reordered %llu late %llu overwritten %llu\n", (int) i,
+                (unsigned long long) s.pushed, (unsigned long long) s.reordered,
+                (unsigned long long) s.late, (unsigned long long) s.overwritten);
+    }
+    scheduler.printStats(stderr, "# task ");
+    return 0;
+}
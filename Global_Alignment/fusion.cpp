@@ -0,0 +1,192 @@
+#include "fusion.hpp"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+Fusion::Fusion(int64_t period_ns, int64_t latency_ns, size_t depth)
+{
+    period_ns_ = period_ns;
+    latency_ns_ = latency_ns;
+    depth_ = depth < 2 ? 2 : depth;
+    columns_ = 0;
+    next_t_ns_ = 0;
+}
+
+int Fusion::addStream(const char *name, int channels, Interpolation mode, int64_t stale_ns)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (channels < 1 || channels > FUSION_MAX_CHANNELS || columns_ + channels > FUSION_MAX_COLUMNS) {
+        fprintf(stderr, "ERROR: Fusion: no room for %d channels of %s\n", channels, name);
+        return -1;
+    }
+    if (next_t_ns_ != 0) {
+        fprintf(stderr, "ERROR: Fusion: streams must be added before the first poll\n");
+        return -1;
+    }
+
+    Stream s;
+    s.name = name;
+    s.channels = channels;
+    s.column = columns_;
+    s.mode = mode;
+    s.stale_ns = stale_ns;
+    s.ring.resize(depth_);
+    s.first = 0;
+    s.count = 0;
+    memset(&s.stats, 0, sizeof s.stats);
+
+    streams_.push_back(s);
+    columns_ += channels;
+    return streams_.size() - 1;
+}
+
+const Fusion::Sample &Fusion::at(const Stream &s, size_t i) const
+{
+    return s.ring[(s.first + i) % s.ring.size()];
+}
+
+int Fusion::push(int stream, int64_t t_ns, const double *values)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (stream < 0 || stream >= (int) streams_.size())
+        return EXIT_FAILURE;
+    Stream &s = streams_[stream];
+    s.stats.pushed++;
+
+    // Its grid point is already out
+    if (next_t_ns_ != 0 && t_ns < next_t_ns_ - period_ns_) {
+        s.stats.late++;
+        return EXIT_FAILURE;
+    }
+
+    size_t size = s.ring.size();
+    if (s.count == size) {
+        s.first = (s.first + 1) % size;
+        s.count--;
+        s.stats.overwritten++;
+    }
+
+    // Usually an append; otherwise slide newer samples up by one
+    size_t pos = s.count;
+    while (pos > 0 && at(s, pos-1).t_ns > t_ns)
+        pos--;
+    if (pos != s.count)
+        s.stats.reordered++;
+    for (size_t i=s.count; i>pos; i--)
+        s.ring[(s.first + i) % size] = s.ring[(s.first + i - 1) % size];
+
+    Sample &dst = s.ring[(s.first + pos) % size];
+    dst.t_ns = t_ns;
+    memcpy(dst.v, values, s.channels * sizeof(double));
+    s.count++;
+    return EXIT_SUCCESS;
+}
+
+void Fusion::evaluate(const Stream &s, int64_t t, double *out) const
+{
+    // Last sample at or before t (binary search on the ordered ring)
+    size_t lo = 0, hi = s.count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (at(s, mid).t_ns <= t) lo = mid + 1;
+        else                      hi = mid;
+    }
+
+    for (int c=0; c<s.channels; c++)
+        out[c] = NAN;
+    if (lo == 0)
+        return;
+
+    const Sample &a = at(s, lo-1);
+    bool a_fresh = (s.stale_ns == 0 || t - a.t_ns <= s.stale_ns);
+
+    if (s.mode == LINEAR && lo < s.count) {
+        const Sample &b = at(s, lo);
+        bool b_fresh = (s.stale_ns == 0 || b.t_ns - t <= s.stale_ns);
+        if (a_fresh || b_fresh) {
+            double w = (b.t_ns == a.t_ns) ? 0.0 : (double) (t - a.t_ns) / (b.t_ns - a.t_ns);
+            for (int c=0; c<s.channels; c++)
+                out[c] = a.v[c] + w * (b.v[c] - a.v[c]);
+        }
+        return;
+    }
+
+    if (a_fresh)
+        for (int c=0; c<s.channels; c++)
+            out[c] = a.v[c];
+}
+
+void Fusion::trim(Stream &s, int64_t t)
+{
+    // Keep the last sample at or before t, it brackets the next grid point
+    while (s.count >= 2 && at(s, 1).t_ns <= t) {
+        s.first = (s.first + 1) % s.ring.size();
+        s.count--;
+    }
+}
+
+size_t Fusion::poll(int64_t now, Record *out, size_t max)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (next_t_ns_ == 0) {
+        int64_t start = 0;
+        for (size_t i=0; i<streams_.size(); i++)
+            if (streams_[i].count && (start == 0 || at(streams_[i], 0).t_ns < start))
+                start = at(streams_[i], 0).t_ns;
+        if (start == 0)
+            return 0;
+        next_t_ns_ = (start / period_ns_ + 1) * period_ns_;
+    }
+
+    size_t n = 0;
+    while (n < max && next_t_ns_ <= now - latency_ns_) {
+        Record &r = out[n++];
+        r.t_ns = next_t_ns_;
+        r.columns = columns_;
+        for (size_t i=0; i<streams_.size(); i++) {
+            evaluate(streams_[i], next_t_ns_, r.v + streams_[i].column);
+            trim(streams_[i], next_t_ns_);
+        }
+        next_t_ns_ += period_ns_;
+    }
+    return n;
+}
+
+int Fusion::streams() const
+{
+    return streams_.size();
+}
+
+int Fusion::columns() const
+{
+    return columns_;
+}
+
+std::string Fusion::header() const
+{
+    std::string h;
+    for (size_t i=0; i<streams_.size(); i++) {
+        for (int c=0; c<streams_[i].channels; c++) {
+            if (!h.empty())
+                h += ", ";
+            h += streams_[i].name;
+            if (streams_[i].channels > 1) {
+                char idx[16];
+                snprintf(idx, sizeof(idx), ".%d", c);
+                h += idx;
+            }
+        }
+    }
+    return h;
+}
+
+Fusion::StreamStats Fusion::stats(int stream)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return streams_[stream].stats;
+}
@@ -0,0 +1,104 @@
+#ifndef _FUSION_HPP_
+#define _FUSION_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define FUSION_MAX_CHANNELS 8     // per stream
+#define FUSION_MAX_COLUMNS  32    // per merged record
+
+/*
+ * Merges independently timestamped streams (PSD centroids, DLS distance,
+ * motor/twister positions, ...) onto one regular time grid.
+ *
+ * Every stream lives in a fixed-size ring ordered by time, so memory is
+ * bounded by depth * streams no matter how long a session runs. Producers
+ * may push from any thread and a little out of order: a sample is slotted
+ * into place as long as its grid point has not been emitted yet. Anything
+ * older than that is counted as late and dropped.
+ *
+ * A grid point t is emitted once t <= now - latency, i.e. every stream had
+ * `latency` to deliver the samples around t.
+ */
+class Fusion {
+    public:
+        enum Interpolation {
+            HOLD   = 0,   // last sample at or before t
+            LINEAR = 1    // straight line between the samples around t
+        };
+
+        struct Record {
+            int64_t  t_ns;
+            int      columns;
+            double   v[FUSION_MAX_COLUMNS];   // NaN where a stream had no usable data
+        };
+
+        struct StreamStats {
+            uint64_t pushed;
+            uint64_t reordered;    // arrived out of order but in time
+            uint64_t late;         // arrived after its grid point was emitted
+            uint64_t overwritten;  // pushed out of a full ring before use
+        };
+
+        Fusion(int64_t period_ns, int64_t latency_ns, size_t depth = 1024);
+
+        /*
+         * Registers a stream. Its channels become the next `channels`
+         * columns of every record. Samples older than stale_ns at the grid
+         * point are not used (0 = never stale). Returns the stream id or -1.
+         */
+        int addStream(const char *name, int channels, Interpolation mode, int64_t stale_ns = 0);
+
+        /* Thread safe */
+        int push(int stream, int64_t t_ns, const double *values);
+
+        /*
+         * Fills out with every grid point that is ready at time now and
+         * returns how many were written (at most max).
+         */
+        size_t poll(int64_t now, Record *out, size_t max);
+
+        int streams() const;
+        int columns() const;
+        /* "name.0,name.1,..." style header */
+        std::string header() const;
+
+        StreamStats stats(int stream);
+
+    private:
+        struct Sample {
+            int64_t t_ns;
+            double  v[FUSION_MAX_CHANNELS];
+        };
+
+        struct Stream {
+            std::string name;
+            int channels;
+            int column;
+            Interpolation mode;
+            int64_t stale_ns;
+
+            std::vector<Sample> ring;
+            size_t first;
+            size_t count;
+            StreamStats stats;
+        };
+
+        const Sample &at(const Stream &s, size_t i) const;
+        void evaluate(const Stream &s, int64_t t, double *out) const;
+        void trim(Stream &s, int64_t t);
+
+        std::vector<Stream> streams_;
+        std::mutex mutex_;
+        int64_t period_ns_;
+        int64_t latency_ns_;
+        size_t depth_;
+        int columns_;
+        int64_t next_t_ns_;   // next grid point to emit, 0 = not started
+};
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef _HISTOGRAM_HPP_
+#define _HISTOGRAM_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Log-bucketed histogram of durations in ns: 8 buckets per power of two
+ * (within 12.5 %), covering 1 ns to the full int64 range in 4 KB.
+ * record() is a couple of shifts and an increment, cheap enough for every
+ * USB transfer or loop iteration.
+ *
+ * Not locked: record from one thread; a copy taken from another thread
+ * may be a sample behind.
+ */
+#define HISTOGRAM_SUB_BITS  3
+#define HISTOGRAM_SUB       (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS   (64 * HISTOGRAM_SUB)
+
+class LogHistogram {
+    public:
+        LogHistogram() { reset(); }
+
+        void reset()
+        {
+            memset(counts_, 0, sizeof(counts_));
+            count_ = 0;
+            sum_ = 0;
+            min_ = INT64_MAX;
+            max_ = 0;
+        }
+
+        void record(int64_t ns)
+        {
+            if (ns < 0)
+                ns = 0;
+            counts_[bucket(ns)]++;
+            count_++;
+            sum_ += ns;
+            if (ns < min_) min_ = ns;
+            if (ns > max_) max_ = ns;
+        }
+
+        void merge(const LogHistogram &other)
+        {
+            for (int i=0; i<HISTOGRAM_BUCKETS; i++)
+                counts_[i] += other.counts_[i];
+            count_ += other.count_;
+            sum_ += other.sum_;
+            if (other.min_ < min_) min_ = other.min_;
+            if (other.max_ > max_) max_ = other.max_;
+        }
+
+        uint64_t count() const { return count_; }
+        int64_t min() const { return count_ ? min_ : 0; }
+        int64_t max() const { return max_; }
+        int64_t mean() const { return count_ ? sum_ / (int64_t) count_ : 0; }
+
+        /* Upper edge of the bucket holding the p-th percentile (0-100) */
+        int64_t percentile(double p) const
+        {
+            if (count_ == 0)
+                return 0;
+            uint64_t rank = (uint64_t) (p / 100.0 * count_);
+            if (rank >= count_)
+                rank = count_ - 1;
+            uint64_t seen = 0;
+            for (int i=0; i<HISTOGRAM_BUCKETS; i++) {
+                seen += counts_[i];
+                if (seen > rank) {
+                    int64_t upper = lower(i + 1) - 1;
+                    return upper < max_ ? upper : max_;
+                }
+            }
+            return max_;
+        }
+
+        /* Non-empty buckets as "lower-upper count" lines, upper in us */
+        void print(FILE *f, const char *indent) const
+        {
+            for (int i=0; i<HISTOGRAM_BUCKETS; i++)
+                if (counts_[i])
+                    fprintf(f, "%s%12.3f - %12.3f us %10llu\n", indent, lower(i) * 1e-3,
+                            (lower(i + 1) - 1) * 1e-3, (unsigned long long) counts_[i]);
+        }
+
+        /* Smallest value falling in bucket i */
+        static int64_t lower(int i)
+        {
+            if (i < HISTOGRAM_SUB)
+                return i;
+            int shift = i / HISTOGRAM_SUB - 1;
+            if (shift + HISTOGRAM_SUB_BITS >= 63)
+                return INT64_MAX;
+            return (int64_t) (HISTOGRAM_SUB + i % HISTOGRAM_SUB) << shift;
+        }
+
+        static int bucket(int64_t ns)
+        {
+            if (ns < HISTOGRAM_SUB)
+                return ns;
+            int top = 63 - __builtin_clzll(ns);             // ns >= 2^top
+            int shift = top - HISTOGRAM_SUB_BITS;
+            return (shift + 1) * HISTOGRAM_SUB + ((ns >> shift) & (HISTOGRAM_SUB - 1));
+        }
+
+    private:
+        uint64_t counts_[HISTOGRAM_BUCKETS];
+        uint64_t count_;
+        int64_t sum_;
+        int64_t min_;
+        int64_t max_;
+};
+
+#endif
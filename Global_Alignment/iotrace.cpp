@@ -0,0 +1,356 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <getopt.h>  // Argument parsing
+
+#include <algorithm>
+#include <vector>
+
+#include "piusb.hpp"
+#include "psd.hpp"
+#include "timestamp.hpp"
+#include "trace.hpp"
+
+static int help()
+{
+    char usage [] = "\niotrace: replays recorded tty and USB traffic                   "
+        "\n                                                                   "
+        "\nRecord a session with IOTRACE_FILE=<file> in the environment of    "
+        "\ndls, psdhub, motor, align, ...                                     "
+        "\n                                                                   "
+        "\nUsage: iotrace [arguments]                                         "
+        "\n   e.g. IOTRACE_FILE=run.trc psdhub --port /dev/ttyACM0            "
+        "\n        iotrace --info run.trc                                     "
+        "\n        iotrace --serve run.trc         (then dls --port /dev/pts/N)"
+        "\n        iotrace --bench run.trc --fast                             "
+        "\n        PIUSB_REPLAY=run.trc motor ...                             "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --info <trace>        Channels, events and bytes               "
+        "\n    --serve <trace>       A pty per tty channel, started on Enter  "
+        "\n    --bench <trace>       Replay the PSD streams through PSDHub and"
+        "\n                          the USB devices through Picard           "
+        "\n    --fast                As fast as possible (default: recorded   "
+        "\n                          pace)                                    "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+static bool isUsb(const char *name)
+{
+    return strncmp(name, "usb ", 4) == 0;
+}
+
+static bool hasKind(const std::vector<const TraceEvent *> &events, int kind)
+{
+    for (size_t i=0; i<events.size(); i++)
+        if (events[i]->kind == kind)
+            return true;
+    return false;
+}
+
+static void printStats(const char *name, const ReplayStats &s, double seconds, bool paced)
+{
+    printf("%-24s %9llu events %11llu bytes %10.0f B/s %6llu mismatches",
+           name, (unsigned long long) s.events, (unsigned long long) s.bytes,
+           seconds > 0 ? s.bytes / seconds : 0.0, (unsigned long long) s.mismatches);
+    if (paced)
+        printf("   late <= %.3f ms", s.max_late_ns * 1e-6);
+    printf("\n");
+}
+
+static int info(const char *path)
+{
+    TraceReader trace;
+    if (trace.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    printf("%-24s %9s %11s %11s %11s %9s\n", "channel", "events", "rx bytes", "tx bytes", "transfers", "seconds");
+    for (int c=0; c<trace.channels(); c++) {
+        const std::vector<const TraceEvent *> &events = trace.events(c);
+        uint64_t rx = 0, tx = 0, transfers = 0;
+        for (size_t i=0; i<events.size(); i++) {
+            const TraceEvent *e = events[i];
+            if (e->kind == TRACE_TTY_RX || e->kind == TRACE_USB_READ)
+                rx += e->length;
+            if (e->kind == TRACE_TTY_TX || e->kind == TRACE_USB_WRITE)
+                tx += e->length;
+            if (e->kind == TRACE_USB_READ || e->kind == TRACE_USB_WRITE)
+                transfers++;
+        }
+        double seconds = events.empty() ? 0 : (events.back()->t_ns - events.front()->t_ns) * 1e-9;
+        printf("%-24s %9zu %11llu %11llu %11llu %9.3f\n", trace.name(c), events.size(),
+               (unsigned long long) rx, (unsigned long long) tx, (unsigned long long) transfers, seconds);
+    }
+    return EXIT_SUCCESS;
+}
+
+static int serve(const char *path, bool paced)
+{
+    TraceReader trace;
+    if (trace.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    std::vector<TtyReplay *> players;
+    std::vector<int> channels;
+    for (int c=0; c<trace.channels(); c++) {
+        if (isUsb(trace.name(c))) {
+            printf("%-24s PIUSB_REPLAY=%s%s\n", trace.name(c), path, paced ? " PIUSB_REPLAY_PACED=1" : "");
+            continue;
+        }
+        TtyReplay *player = new TtyReplay(&trace, c, paced);
+        const char *slave = player->open();
+        if (slave == NULL)
+            return EXIT_FAILURE;
+        printf("%-24s %s\n", trace.name(c), slave);
+        players.push_back(player);
+        channels.push_back(c);
+    }
+    if (players.empty()) {
+        fprintf(stderr, "ERROR: No tty channels in %s\n", path);
+        return EXIT_FAILURE;
+    }
+
+    printf("Open the ports, then press Enter to start\n");
+    fflush(stdout);
+    getchar();
+
+    int64_t base = timestampNs();
+    for (size_t i=0; i<players.size(); i++)
+        players[i]->start(base);
+    for (size_t i=0; i<players.size(); i++)
+        players[i]->wait(-1);
+    double seconds = (timestampNs() - base) * 1e-9;
+
+    for (size_t i=0; i<players.size(); i++) {
+        printStats(trace.name(channels[i]), players[i]->stats(), seconds, paced);
+        delete players[i];
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Streams with nothing written to them (the PSD boards) go through a
+ * PSDHub. In paced replay the latency of a sample is measured from the
+ * recorded time of the bytes that completed its line.
+ */
+static int benchTty(TraceReader &trace, bool paced)
+{
+    std::vector<int> channels;
+    for (int c=0; c<trace.channels(); c++) {
+        if (isUsb(trace.name(c)))
+            continue;
+        if (hasKind(trace.events(c), TRACE_TTY_TX)) {
+            printf("%-24s request/response, skipped (iotrace --serve, dls --port)\n", trace.name(c));
+            continue;
+        }
+        channels.push_back(c);
+    }
+    if (channels.empty())
+        return EXIT_SUCCESS;
+
+    PSDBus bus(1 << 18);
+    PSDHub hub(&bus);
+    std::vector<TtyReplay *> players;
+    std::vector<std::vector<int64_t> > line_due(channels.size());
+
+    for (size_t i=0; i<channels.size(); i++) {
+        TtyReplay *player = new TtyReplay(&trace, channels[i], paced);
+        const char *slave = player->open();
+        if (slave == NULL || hub.addBoard(slave, PSDCalibration::identity()) < 0)
+            return EXIT_FAILURE;
+        players.push_back(player);
+
+        // Recorded time of every line end; the hub drops the first (partial) line
+        const std::vector<const TraceEvent *> &events = trace.events(channels[i]);
+        bool first = true;
+        for (size_t k=0; k<events.size(); k++) {
+            const uint8_t *p = TraceReader::payload(events[k]);
+            for (uint32_t j=0; j<events[k]->length; j++)
+                if (p[j] == '\n') {
+                    if (!first)
+                        line_due[i].push_back(events[k]->t_ns - trace.startTime());
+                    first = false;
+                }
+        }
+    }
+
+    hub.start();
+    int64_t base = timestampNs();
+    for (size_t i=0; i<players.size(); i++)
+        players[i]->start(base);
+
+    uint64_t cursor = bus.head();
+    uint64_t samples = 0, lost = 0;
+    std::vector<int64_t> latency;
+    std::vector<PSDSample> buf(512);
+    size_t finished = 0;
+    int64_t idle_since = 0;
+    int64_t last = base;
+    while (true) {
+        uint64_t l = 0;
+        size_t n = bus.read(&cursor, buf.data(), buf.size(), &l);
+        lost += l;
+        samples += n;
+        if (n)
+            last = timestampNs();
+        for (size_t i=0; paced && i<n; i++) {
+            const std::vector<int64_t> &due = line_due[buf[i].board];
+            if (buf[i].seq < due.size())
+                latency.push_back(buf[i].t_ns - (base + due[buf[i].seq]));
+        }
+
+        // Done once every player has finished and the hub has gone quiet
+        if (finished < players.size()) {
+            finished = 0;
+            for (size_t i=0; i<players.size(); i++)
+                finished += players[i]->wait(0);
+            idle_since = 0;
+        }
+        else if (n == 0) {
+            if (idle_since == 0)
+                idle_since = timestampNs();
+            else if (timestampNs() - idle_since > 100000000LL)
+                break;
+        }
+        else
+            idle_since = 0;
+        if (n == 0)
+            bus.wait(cursor, 10);
+    }
+    double seconds = (last - base) * 1e-9;
+    hub.stop();
+
+    for (size_t i=0; i<players.size(); i++) {
+        printStats(trace.name(channels[i]), players[i]->stats(), seconds, paced);
+        delete players[i];
+    }
+    printf("PSDHub: %llu samples in %.3f s, %.0f samples/s, %llu lost\n",
+           (unsigned long long) samples, seconds, samples / seconds, (unsigned long long) lost);
+
+    if (!latency.empty()) {
+        std::sort(latency.begin(), latency.end());
+        printf("PSDHub: line latency p50 %.3f ms  p99 %.3f ms  max %.3f ms\n",
+               latency[latency.size() / 2] * 1e-6, latency[latency.size() * 99 / 100] * 1e-6,
+               latency.back() * 1e-6);
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Each recorded USB device is opened through Picard and sent its recorded transfers */
+static int benchUsb(const char *path, TraceReader &trace, bool paced)
+{
+    setenv("PIUSB_REPLAY", path, 1);
+    setenv("PIUSB_REPLAY_PACED", paced ? "1" : "0", 1);
+    double total = 0;
+
+    for (int c=0; c<trace.channels(); c++) {
+        // "usb vid:pid <selector>", or "usb vid:pid #n" if opened without one
+        unsigned int vid, pid;
+        char select[96] = "";
+        if (sscanf(trace.name(c), "usb %x:%x %95s", &vid, &pid, select) < 2)
+            continue;
+
+        Picard device;
+        if (device.usbOpen(vid, pid, select[0] == '#' ? NULL : select) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+
+        const std::vector<const TraceEvent *> &events = trace.events(c);
+        std::vector<int64_t> latency;
+        int64_t start = timestampNs();
+        for (size_t i=0; i<events.size(); i++) {
+            unsigned char data[64] = {0};
+            int length = events[i]->length < sizeof(data) ? events[i]->length : sizeof(data);
+            int64_t t = timestampNs();
+            if (events[i]->kind == TRACE_USB_WRITE) {
+                memcpy(data, TraceReader::payload(events[i]), length);
+                device.usbWrite(data, length);
+            }
+            else if (events[i]->kind == TRACE_USB_READ)
+                device.usbRead(data, length);
+            else
+                continue;
+            latency.push_back(timestampNs() - t);
+        }
+        double seconds = (timestampNs() - start) * 1e-9;
+        total += seconds;
+        device.usbClose();
+
+        if (latency.empty())
+            continue;
+        std::sort(latency.begin(), latency.end());
+        printf("%-24s %9zu transfers %10.0f /s   p50 %.3f us  max %.3f us\n", trace.name(c),
+               latency.size(), latency.size() / seconds,
+               latency[latency.size() / 2] * 1e-3, latency.back() * 1e-3);
+    }
+
+    ReplayStats s = usbReplayStats();
+    if (s.events)
+        printStats("Picard", s, total, paced);
+    return EXIT_SUCCESS;
+}
+
+static int bench(const char *path, bool paced)
+{
+    TraceReader trace;
+    if (trace.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    printf("%s replay of %s\n", paced ? "Paced" : "Fast", path);
+    if (benchTty(trace, paced) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    return benchUsb(path, trace, paced);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc==1) return help();
+
+    const char *info_path = NULL;
+    const char *serve_path = NULL;
+    const char *bench_path = NULL;
+    bool paced = true;
+
+    static struct option long_options[] = {
+        {"info"     , required_argument , 0    , 'i'} ,
+        {"serve"    , required_argument , 0    , 's'} ,
+        {"bench"    , required_argument , 0    , 'b'} ,
+        {"fast"     , no_argument       , 0    , 'f'} ,
+        {"help"     , no_argument       , 0    , 'h'} ,
+        {NULL       , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "i:s:b:fh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'i':
+                info_path = optarg;
+                break;
+            case 's':
+                serve_path = optarg;
+                break;
+            case 'b':
+                bench_path = optarg;
+                break;
+            case 'f':
+                paced = false;
+                break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+
+    if (info_path)
+        return info(info_path);
+    if (serve_path)
+        return serve(serve_path, paced);
+    if (bench_path)
+        return bench(bench_path, paced);
+    return help();
+}
@@ -1,4 +1,7 @@
 #include "dls.hpp"
+#include "devlog.hpp"
+#include "drift.hpp"
+#include "trace.hpp"
 
 #include <errno.h>
 #include <cstring>
@@ -9,12 +12,18 @@
 #include <fcntl.h>   // For file handling
 #include <termios.h> // Terminal IO
 #include <cmath>     // For fabs
+#include <climits>
 
 #define MAX_READ_SIZE 20
 
 DLS::DLS()
 {
     userCalibrated_ = false;
+    drift_ = NULL;
+    driftChannel_ = -1;
+    driftLearn_ = false;
+    temperature_ = INT_MIN;
+    traceChannel_ = -1;
 }
 
 DLS::~DLS()
@@ -37,13 +46,18 @@ int DLS::serialRead (char *read_data)
             i+=1;
         }
     }
+    if (traceChannel_ >= 0)
+        traceWriter()->record(traceChannel_, TRACE_TTY_RX, read_data, i<MAX_READ_SIZE-1 ? i+1 : i);
     return EXIT_SUCCESS;
 }
 
 int DLS::serialWrite (char *write_data, int write_size)
 {
-    // Write Command
+    // Write Command (without the trailing \r\n in the log)
+    DEVLOG_TRACE("tx {}", fmt::string_view(write_data, strcspn(write_data, "\r\n")));
     write (fd_, write_data, write_size-1);
+    if (traceChannel_ >= 0)
+        traceWriter()->record(traceChannel_, TRACE_TTY_TX, write_data, write_size-1);
     return EXIT_SUCCESS;
 }
 
@@ -55,6 +69,8 @@ int DLS::readTemperature () {
 
     if (temperature < 0)
         printErrorMsg(temperature);
+    else
+        temperature_ = temperature;
 
     return (temperature);
 }
@@ -136,6 +152,8 @@ int DLS::readTracking ()
     // Failure
     if (status < 0)
         printErrorMsg(status);
+    else
+        distance = compensate(distance);
 
     return (distance);
 }
@@ -146,7 +164,7 @@ int DLS::measureDistance () {
     if (userCalibrated_) {
         char write_data[] = "s0ug\r\n";
         serialWrite(write_data, sizeof(write_data)/sizeof(write_data[0]));
-        spdlog::trace("%s\n", "User calibrated");
+        DEVLOG_TRACE("User calibrated");
     }
     else {
         char write_data[] = "s0g\r\n";
@@ -159,6 +177,8 @@ int DLS::measureDistance () {
 
     if (status < 0)
         printErrorMsg(status);
+    else
+        distance = compensate(distance);
 
     return distance;
 }
@@ -171,7 +191,7 @@ int DLS::rxData () {
     serialRead(read_data);
     int ret = 0;
 
-    //spdlog::error(("Read data: %s", read_data);
+    DEVLOG_TRACE("rx {}", fmt::string_view(read_data, strcspn(read_data, "\r\n")));
 
     // Check for error indicator (@) and parse error value.
     if (read_data[2]=='@') {
@@ -238,18 +258,18 @@ int DLS::setOutputFilter (int nsamples, int nspikes, int nerrors)
         nsamples = atoi (aa_str);
     if (nsamples > 32){
 	nsamples = 32;
-	spdlog::trace("WARNING: average set to max. value= 32 samples \n");}
+	DEVLOG_WARN("average set to max. value= 32 samples");}
     if (nspikes < 0)
         nspikes = atoi (bb_str);
     if (nerrors < 0)
         nerrors = atoi (cc_str);
 
-    spdlog::trace("samples %i\n", nsamples);
-    spdlog::trace("spikes %i\n", nspikes);
-    spdlog::trace("errors %i\n", nerrors);
+    DEVLOG_DEBUG("samples {}", nsamples);
+    DEVLOG_DEBUG("spikes {}", nspikes);
+    DEVLOG_DEBUG("errors {}", nerrors);
 
     if (2*nspikes+nerrors > 0.4 * nsamples) {
-        spdlog::error("ERROR: Make sure that (2*nspikes + nerrors) <= 0.4 * nsamples\n");
+        DEVLOG_ERROR("Make sure that (2*nspikes + nerrors) <= 0.4 * nsamples");
         nspikes = atoi (bb_str);
         nerrors = atoi (cc_str);
         nsamples = atoi (aa_str);
@@ -282,7 +302,6 @@ int DLS::setOffset(int offset)
 {
     char write_data[] = "s0uof+xxxxxxxx\r\n";
     sprintf(write_data, "s0uof+%08i\r\n", offset);
-    spdlog::trace("%s", write_data);
 
     serialWrite(write_data, sizeof(write_data)/sizeof(write_data[0]));
 
@@ -290,11 +309,11 @@ int DLS::setOffset(int offset)
     if (status < 0)
         printErrorMsg(status);
 
-    spdlog::trace("%i", status);
+    DEVLOG_DEBUG("offset status {}", status);
 
     status |= saveConfiguration();
 
-    spdlog::trace("%i", status);
+    DEVLOG_DEBUG("save status {}", status);
 
     return(status);
 }
@@ -330,7 +349,7 @@ int DLS::setGain(float gain)
 
     char write_data[] = "s0uga+xxxxxxxx+yyyyyyyy\r\n";
     sprintf(write_data, "s0uga+%08i+%08i\r\n", gain_numer, gain_denom);
-    spdlog::trace("%s\n", write_data);
+    DEVLOG_DEBUG("gain {} ~ {}/{}", gain, gain_numer, gain_denom);
     serialWrite(write_data, sizeof(write_data)/sizeof(write_data[0]));
 
     int status = rxData();
@@ -362,7 +381,7 @@ int DLS::setInterfaceAttribs (int speed, int parity)
     memset (&tty, 0, sizeof tty);
     if (tcgetattr (fd_, &tty) != 0)
     {
-        spdlog::error("error %d from tcgetattr", errno);
+        DEVLOG_ERROR("error {} from tcgetattr", errno);
         return -1;
     }
 
@@ -397,7 +416,7 @@ int DLS::setInterfaceAttribs (int speed, int parity)
 
     if (tcsetattr (fd_, TCSANOW, &tty) != 0)
     {
-        spdlog::error("error %d from tcsetattr", errno);
+        DEVLOG_ERROR("error {} from tcsetattr", errno);
         return -1;
     }
     return 0;
@@ -409,7 +428,7 @@ void DLS::setBlocking (int should_block)
     memset (&tty, 0, sizeof tty);
     if (tcgetattr (fd_, &tty) != 0)
     {
-        spdlog::error("error %d from tggetattr", errno);
+        DEVLOG_ERROR("error {} from tcgetattr", errno);
         return;
     }
 
@@ -417,7 +436,7 @@ void DLS::setBlocking (int should_block)
     tty.c_cc[VTIME] = 5;            // 0.5 seconds read timeout
 
     if (tcsetattr (fd_, TCSANOW, &tty) != 0)
-        spdlog::error("error %d setting term attributes", errno);
+        DEVLOG_ERROR("error {} setting term attributes", errno);
 }
 
 int DLS::setFD (int fd)
@@ -426,48 +445,81 @@ int DLS::setFD (int fd)
     setInterfaceAttribs (B115200, 0);   // set speed to 115,200 bps, 8n1 (no parity)
     setBlocking (0);                    // set no blocking
     //stopTracking();
+
+    // Name the trace channel after the tty the fd was opened on
+    if (traceWriter()) {
+        char link[64], port[256];
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        ssize_t n = readlink(link, port, sizeof(port)-1);
+        port[n > 0 ? n : 0] = '\0';
+        traceChannel_ = traceWriter()->channel(port);
+    }
+    return EXIT_SUCCESS;
+}
+
+int DLS::setDriftModel (DriftModel *model, bool learn)
+{
+    drift_ = model;
+    driftLearn_ = learn;
+    driftChannel_ = -1;
     return EXIT_SUCCESS;
 }
 
+// Distances and temperatures are in 0.1 mm and 0.1 C
+int DLS::compensate (int distance)
+{
+    if (drift_ == NULL || temperature_ == INT_MIN)
+        return distance;
+
+    // Resolved here, so the order of setUserCalibrated and setDriftModel does not matter
+    if (driftChannel_ < 0)
+        driftChannel_ = drift_->channel(userCalibrated_ ? "dls.user" : "dls");
+    double temperature = temperature_ / 10.0;
+    if (driftLearn_)
+        drift_->update(driftChannel_, temperature, distance);
+    return (int) lround(drift_->correct(driftChannel_, temperature, distance));
+}
+
 int DLS::setUserCalibrated (bool enabled)
 {
     userCalibrated_ = enabled;
+    driftChannel_ = -1;
     return EXIT_SUCCESS;
 }
 
 void DLS::printErrorMsg (int err)
 {
-    char msg [200] = "";
+    const char *msg;
     switch(err)
     {
-        case -203: sprintf(msg, "Wrong syntax in command, prohibited parameter in command entry or non-valid result"); break;
-        case -210: sprintf(msg, "Not in tracking mode, start tracking mode first"); break;
-        case -211: sprintf(msg, "Sampling too fast, set the sampling time to a larger value"); break;
-        case -212: sprintf(msg, "Command cannot be executed because tracking mode is active, first use command sNc to stop tracking mode"); break;
-        case -220: sprintf(msg, "Communication error, check configuration settings"); break;
-        case -230: sprintf(msg, "Distance value overflow caused by wrong user configuration. Change user offset (and/or user gain)");                            break;
-        case -231: sprintf(msg, "Wrong mode for digital input status read, activate DI1");                            break;
-        case -232: sprintf(msg, "Digital output 1 cannot be set if configured as digital input");                            break;
-        case -233: sprintf(msg, "Number cannot be displayed. (Check Output Format)");                            break;
-        case -234: sprintf(msg, "Distance out of range.");                            break;
-        case -236: sprintf(msg, "Digital output manual mode cannot be activated when configured as digital input");                            break;
-        case -252: sprintf(msg, "Temperature too high (Contact Dimetix!). ");                            break;
-        case -253: sprintf(msg, "Temperature too low (Contact Dimetix!)");                            break;
-        case -254: sprintf(msg, "Bad signal from target, It takes too long to measure according distance. Use white surface or reflective target");                            break;
-        case -255: sprintf(msg, "Received signal too weak or target lost in moving target characteristic (Use different target and distances)");                            break;
-        case -256: sprintf(msg, "Received signal too strong (Use different target and distances)");                            break;
-        case -258: sprintf(msg, "Power supply voltage is too high");                            break;
-        case -259: sprintf(msg, "Power supply voltage is too low");                            break;
-        case -260: sprintf(msg, "Distance cannot be calculated because of ambiguous targets");                            break;
-        case -263: sprintf(msg, "Too much light; Use only Dimetix reflective target plate. \n In moving target characteristic, distance jump occured");                            break;
-        case -264: sprintf(msg, "Too much light, measuring on reflective targets not possible.");                            break;
-        case -330: sprintf(msg, "Acceleration of target too strong or distance jump (in moving target characteristic only).");                            break;
-        case -331: sprintf(msg, "Over speed of target");                            break;
-        case -360: sprintf(msg, "Configured measuring time is too short, set longer time or use 0");                            break;
-        case -361: sprintf(msg, "Configured measuring time is too long, set shorter time");                            break;
-        default:   sprintf(msg, "Uh-oh, unknown error code.");  break;
+        case -203: msg = "Wrong syntax in command, prohibited parameter in command entry or non-valid result"; break;
+        case -210: msg = "Not in tracking mode, start tracking mode first"; break;
+        case -211: msg = "Sampling too fast, set the sampling time to a larger value"; break;
+        case -212: msg = "Command cannot be executed because tracking mode is active, first use command sNc to stop tracking mode"; break;
+        case -220: msg = "Communication error, check configuration settings"; break;
+        case -230: msg = "Distance value overflow caused by wrong user configuration. Change user offset (and/or user gain)"; break;
+        case -231: msg = "Wrong mode for digital input status read, activate DI1"; break;
+        case -232: msg = "Digital output 1 cannot be set if configured as digital input"; break;
+        case -233: msg = "Number cannot be displayed. (Check Output Format)"; break;
+        case -234: msg = "Distance out of range."; break;
+        case -236: msg = "Digital output manual mode cannot be activated when configured as digital input"; break;
+        case -252: msg = "Temperature too high (Contact Dimetix!). "; break;
+        case -253: msg = "Temperature too low (Contact Dimetix!)"; break;
+        case -254: msg = "Bad signal from target, It takes too long to measure according distance. Use white surface or reflective target"; break;
+        case -255: msg = "Received signal too weak or target lost in moving target characteristic (Use different target and distances)"; break;
+        case -256: msg = "Received signal too strong (Use different target and distances)"; break;
+        case -258: msg = "Power supply voltage is too high"; break;
+        case -259: msg = "Power supply voltage is too low"; break;
+        case -260: msg = "Distance cannot be calculated because of ambiguous targets"; break;
+        case -263: msg = "Too much light; Use only Dimetix reflective target plate. \n In moving target characteristic, distance jump occured"; break;
+        case -264: msg = "Too much light, measuring on reflective targets not possible."; break;
+        case -330: msg = "Acceleration of target too strong or distance jump (in moving target characteristic only)."; break;
+        case -331: msg = "Over speed of target"; break;
+        case -360: msg = "Configured measuring time is too short, set longer time or use 0"; break;
+        case -361: msg = "Configured measuring time is too long, set shorter time"; break;
+        default:   msg = "Uh-oh, unknown error code."; break;
     }
-    spdlog::error("ERROR %i: %s\n", err, msg);
+    DEVLOG_ERROR("ERROR {}: {}", err, msg);
 }
 
 int DLS::help () {
@@ -528,7 +580,18 @@ int DLS::help () {
         "\n   --errors <max errors>             Set max. number of errors to supress      "
         "\n                                        (See manual page 16 for details)       "
         "\n                                                                               "
-        "\n   --help                            Print this message.                       ";
+        "\n   --record <file>                   Also write --continuous readings to a     "
+        "\n                                     binary sample log (give it first)         "
+        "\n   --archive <file>                  Same into a compressed distance archive   "
+        "\n                                     (see dlsarc)                              "
+        "\n   --npy <file>                      Same into a NumPy .npy file               "
+        "\n                                                                               "
+        "\n   --help                            Print this message.                       "
+        "\n                                                                               "
+        "\n   Environment:                                                                "
+        "\n   DEVLOG_FILE=<file>                Log to a rotating file as well as stderr  "
+        "\n   DEVLOG_LEVEL=<level>              trace, debug, info (default), warn, err   "
+        "\n   IOTRACE_FILE=<file>               Record the raw tty traffic (see iotrace)  ";
     printf("%s\n", usage);
 return 0;
 }
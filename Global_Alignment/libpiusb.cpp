@@ -2,6 +2,9 @@
 //      g++ -o motor motor.cpp -lusb-1.0
 //
 #include "piusb.hpp"
+#include "devlog.hpp"
+#include "timestamp.hpp"
+#include "usbsim.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -11,133 +14,628 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
 #define ENDPOINT    1
 
 #define VELOCITY 0x8
 
-#define DEBUG       0
-#define debug_print(fmt, ...) \
-            do { if (DEBUG) fprintf(stderr, fmt, __VA_ARGS__); } while (0)
+/*
+ * LibusbTransport: the device itself
+ */
+
+/*
+ * One libusb context for the whole process, and the device list of the
+ * current UsbEnumeration (NULL: every open lists the bus itself)
+ */
+static std::mutex usb_mutex;
+static libusb_context *usb_ctx = NULL;
+static int usb_users = 0;
+static libusb_device **usb_list = NULL;
+static ssize_t usb_list_count = 0;
+static int usb_list_holds = 0;
+
+static libusb_context *usbContext()
+{
+    std::lock_guard<std::mutex> lock(usb_mutex);
+    if (usb_ctx == NULL) {
+        if (libusb_init(&usb_ctx) < 0) {
+            DEVLOG_ERROR("Problem Initiating Device");
+            usb_ctx = NULL;
+            return NULL;
+        }
+        /* Set verbosity level */
+        libusb_set_debug(usb_ctx, 3);
+    }
+    usb_users++;
+    return usb_ctx;
+}
 
-int Picard::usbOpen(int vid, int pid)
+static void usbContextRelease()
 {
-    /* pointer pointer to list of devices */
-    libusb_device **devs;
-    /* create a libusb instance */
-    libusb_context *ctx = NULL;
+    std::lock_guard<std::mutex> lock(usb_mutex);
+    if (--usb_users == 0 && usb_list_holds == 0) {
+        libusb_exit(usb_ctx);
+        usb_ctx = NULL;
+    }
+}
 
-    /* initialize libusb instance */
-    int status = libusb_init(&ctx);
-    if (status < 0) {
-        fprintf(stderr, "ERROR: Problem Initiating Device\n");
-        return EXIT_FAILURE;
+UsbEnumeration::UsbEnumeration()
+{
+    libusb_context *ctx = usbContext();
+    context_ = ctx != NULL;
+    std::lock_guard<std::mutex> lock(usb_mutex);
+    if (usb_list_holds++ == 0 && ctx) {
+        usb_list_count = libusb_get_device_list(ctx, &usb_list);
+        if (usb_list_count < 0) {
+            DEVLOG_ERROR("Problem Getting Device");
+            usb_list = NULL;
+        }
+        else
+            DEVLOG_DEBUG("{} devices in list", usb_list_count);
     }
+}
 
-    /* Set verbosity level */
-    libusb_set_debug(ctx, 3);
+UsbEnumeration::~UsbEnumeration()
+{
+    {
+        std::lock_guard<std::mutex> lock(usb_mutex);
+        if (--usb_list_holds == 0 && usb_list) {
+            libusb_free_device_list(usb_list, 1);
+            usb_list = NULL;
+        }
+    }
+    if (context_)
+        usbContextRelease();
+}
 
-    /* get the list of devices */
-    int cnt = libusb_get_device_list(ctx, &devs);
-    if (cnt < 0) {
-        fprintf(stderr, "ERROR: Problem Getting Device\n");
-        return EXIT_FAILURE;
+/* "bus-port.port..." (stable across replugging into the same socket) */
+static std::string busPath(libusb_device *dev)
+{
+    char path[64];
+    int len = snprintf(path, sizeof(path), "%d", libusb_get_bus_number(dev));
+#if defined(LIBUSB_API_VERSION) && LIBUSB_API_VERSION >= 0x01000102
+    uint8_t ports[8];
+    int n = libusb_get_port_numbers(dev, ports, sizeof(ports));
+    for (int i=0; i<n && len < (int) sizeof(path) - 4; i++)
+        len += snprintf(path + len, sizeof(path) - len, "%c%d", i ? '.' : '-', ports[i]);
+#else
+    // libusb < 1.0.16 has no port numbers, fall back to the device address
+    snprintf(path + len, sizeof(path) - len, ":%d", libusb_get_device_address(dev));
+#endif
+    return path;
+}
+
+/* Devices with this vid/pid in bus path order, referenced (unref when done) */
+static std::vector<std::pair<std::string, libusb_device *> > findDevices(libusb_context *ctx, int vid, int pid)
+{
+    std::vector<std::pair<std::string, libusb_device *> > found;
+
+    std::lock_guard<std::mutex> lock(usb_mutex);
+    libusb_device **devs = usb_list;
+    ssize_t cnt = usb_list_count;
+    if (devs == NULL) {
+        cnt = libusb_get_device_list(ctx, &devs);
+        if (cnt < 0) {
+            DEVLOG_ERROR("Problem Getting Device");
+            return found;
+        }
+        DEVLOG_DEBUG("{} devices in list", cnt);
     }
 
-    debug_print("%i %s", cnt, "devices in list\n");
+    for (ssize_t i=0; i<cnt; i++) {
+        struct libusb_device_descriptor desc;
+        if (libusb_get_device_descriptor(devs[i], &desc) == 0 && desc.idVendor == vid && desc.idProduct == pid)
+            found.push_back(std::make_pair(busPath(devs[i]), libusb_ref_device(devs[i])));
+    }
+
+    /* Done with the list, free it */
+    if (devs != usb_list)
+        libusb_free_device_list(devs, 1);
+
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+class LibusbTransport : public UsbTransport {
+    public:
+        LibusbTransport() : dev_handle(NULL), ctx(NULL) {}
+
+        int open(int vid, int pid, const char *select);
+        int close();
+        int write(unsigned char *data, int length, int *count);
+        int read (unsigned char *data, int length, int *count);
+        std::string serial() const { return serial_; }
+
+    private:
+        void release();
+
+        libusb_device_handle *dev_handle;
+        libusb_context *ctx;
+        std::string serial_;
+};
+
+int LibusbTransport::open(int vid, int pid, const char *select)
+{
+    /* shared libusb instance */
+    ctx = usbContext();
+    if (ctx == NULL)
+        return EXIT_FAILURE;
+
+    /* index:<n>, path:<bus-port.port>, serial:<string> or just the serial */
+    int index = 0;
+    const char *path = NULL;
+    const char *serial = NULL;
+    if (select && !strncmp(select, "index:", 6))
+        index = atoi(select + 6);
+    else if (select && !strncmp(select, "path:", 5))
+        path = select + 5;
+    else if (select && *select)
+        serial = strncmp(select, "serial:", 7) ? select : select + 7;
 
     /* Open the desired device and return a handle */
-    dev_handle = libusb_open_device_with_vid_pid(ctx, vid, pid);
+    std::vector<std::pair<std::string, libusb_device *> > found = findDevices(ctx, vid, pid);
+    for (size_t i=0; i<found.size() && dev_handle == NULL; i++) {
+        if ((path && found[i].first != path) || (!path && !serial && (int) i != index))
+            continue;
+        if (libusb_open(found[i].second, &dev_handle) != 0) {
+            dev_handle = NULL;
+            continue;
+        }
+        struct libusb_device_descriptor desc;
+        unsigned char text[128] = {0};
+        libusb_get_device_descriptor(found[i].second, &desc);
+        if (desc.iSerialNumber == 0 ||
+            libusb_get_string_descriptor_ascii(dev_handle, desc.iSerialNumber, text, sizeof(text)) < 0)
+            text[0] = 0;
+        if (serial && strcmp((const char *) text, serial) != 0) {
+            libusb_close(dev_handle);
+            dev_handle = NULL;
+            continue;
+        }
+        serial_ = text[0] ? (const char *) text : "path:" + found[i].first;
+        DEVLOG_DEBUG("USB Device {:04x}:{:04x} Opened at {}", vid, pid, found[i].first);
+    }
+    for (size_t i=0; i<found.size(); i++)
+        libusb_unref_device(found[i].second);
 
     if(dev_handle == NULL) {
-        fprintf(stderr, "ERROR: Cannot open USB Device. Disconnected?\n");
+        DEVLOG_ERROR("Cannot open USB Device {:04x}:{:04x} {}. Disconnected?", vid, pid, select ? select : "");
+        usbContextRelease();
+        ctx = NULL;
         return EXIT_FAILURE;
     }
-    else {
-        debug_print("%s\n", "USB Device Opened");
-    }
-
-    /* Done with the list, free it */
-    libusb_free_device_list(devs, 1);
 
     /*   Check if the kernel driver is attached
      *   If so, detach it.  */
     if (libusb_kernel_driver_active(dev_handle, 0) == 1) {
-        debug_print("%s\n", "Kernel Driver is Active... detaching");
+        DEVLOG_DEBUG("Kernel Driver is Active... detaching");
         if (libusb_detach_kernel_driver(dev_handle, 0) == 0)
-            debug_print("%s\n", "Kernel Driver Successfully Detached");
+            DEVLOG_DEBUG("Kernel Driver Successfully Detached");
         else {
-            fprintf(stderr, "ERROR: Failed to Detach Kernel Driver\n");
+            DEVLOG_ERROR("Failed to Detach Kernel Driver");
+            release();
             return EXIT_FAILURE;
         }
     }
 
     /* claim usb interface */
-    status = libusb_claim_interface(dev_handle, 0);
+    int status = libusb_claim_interface(dev_handle, 0);
     if(status < 0) {
-        fprintf(stderr, "ERROR: Cannot Claim Interface\n");
+        DEVLOG_ERROR("Cannot Claim Interface");
+        release();
         return EXIT_FAILURE;
     }
     else
-        debug_print("%s\n", "Succesfully Claimed Interface\n");
+        DEVLOG_DEBUG("Succesfully Claimed Interface");
 
     /* fini */
     return EXIT_SUCCESS;
 }
 
-int Picard::usbClose()
+int LibusbTransport::close()
 {
+    if (dev_handle == NULL)
+        return EXIT_FAILURE;
+
     /* release the claimed interface */
     int status = libusb_release_interface(dev_handle, 0);
     if(status!=0) {
-        fprintf(stderr, "ERROR: Failed to release USB Interface\n");
+        DEVLOG_ERROR("Failed to release USB Interface");
         return 1;
     }
 
-    debug_print("%s\n", "Successfully Released Interface");
+    DEVLOG_DEBUG("Successfully Released Interface");
 
-    /* Close the device */
-    libusb_close(dev_handle);
-    /* Close our usb instance */
-    libusb_exit(ctx);
+    release();
     return EXIT_SUCCESS;
 }
 
-int Picard::usbWrite(unsigned char *data, int length)
+/* Closes the device and drops our reference to the usb instance */
+void LibusbTransport::release()
 {
-    debug_print("%s", "Writing Data: ");
-    for (int i=0; i<7; i++) {
-        debug_print("%02X", data[i]);
+    libusb_close(dev_handle);
+    dev_handle = NULL;
+    usbContextRelease();
+    ctx = NULL;
+}
+
+int LibusbTransport::write(unsigned char *data, int length, int *count)
+{
+    DEVLOG_TRACE("Writing Data: {:Xsn}", spdlog::to_hex(data, data + length));
+
+    *count = 0;
+    int status = libusb_bulk_transfer(dev_handle, (ENDPOINT | LIBUSB_ENDPOINT_OUT), data, length, count, 0);
+    if (status != 0 || *count != length) {
+        DEVLOG_ERROR("Write Failed: {} ({} bytes)", libusb_error_name(status), *count);
+        return EXIT_FAILURE;
     }
-    debug_print("%s", "\n");
-
-    int count;
-    int status = libusb_bulk_transfer(dev_handle, (ENDPOINT | LIBUSB_ENDPOINT_OUT), data, length, &count, 0);
-    if (status == 0 && count == 8)
-        debug_print("%s\n", "Write Successful");
-    else {
-        printf("Write Failed");
+    return EXIT_SUCCESS;
+}
+
+int LibusbTransport::read (unsigned char *data, int length, int *count)
+{
+    *count = 0;
+    int status = libusb_bulk_transfer(dev_handle, (ENDPOINT | LIBUSB_ENDPOINT_IN), data, length, count, 0);
+    if (status != 0 || *count != length) {
+        DEVLOG_ERROR("Read Failed: {} ({} bytes)", libusb_error_name(status), *count);
         return EXIT_FAILURE;
     }
+
+    DEVLOG_TRACE("Read Data: {:Xsn}", spdlog::to_hex(data, data + length));
     return EXIT_SUCCESS;
 }
 
+/*
+ * RecordTransport: another transport, with every transfer added to the trace
+ */
+
+/*
+ * Channel of a device: by its selector, or the nth device with this vid/pid
+ * opened by the process (only stable when they are opened one at a time)
+ */
+static std::string channelName(int vid, int pid, const char *select)
+{
+    static std::mutex mutex;
+    static std::map<int, int> opened;
+
+    char name[96];
+    if (select && *select) {
+        snprintf(name, sizeof(name), "usb %04x:%04x %s", vid, pid, select);
+        return name;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    snprintf(name, sizeof(name), "usb %04x:%04x #%d", vid, pid, opened[vid << 16 | pid]++);
+    return name;
+}
+
+class RecordTransport : public UsbTransport {
+    public:
+        RecordTransport(UsbTransport *usb, TraceWriter *trace) : usb_(usb), trace_(trace), channel_(-1) {}
+        ~RecordTransport() { delete usb_; }
+
+        int open(int vid, int pid, const char *select)
+        {
+            channel_ = trace_->channel(channelName(vid, pid, select).c_str());
+            int status = usb_->open(vid, pid, select);
+            if (status == EXIT_SUCCESS)
+                trace_->record(channel_, TRACE_USB_OPEN, NULL, 0);
+            return status;
+        }
+
+        int close()
+        {
+            trace_->record(channel_, TRACE_USB_CLOSE, NULL, 0);
+            return usb_->close();
+        }
+
+        int write(unsigned char *data, int length, int *count)
+        {
+            int status = usb_->write(data, length, count);
+            if (status == EXIT_SUCCESS)
+                trace_->record(channel_, TRACE_USB_WRITE, data, *count);
+            return status;
+        }
+
+        int read (unsigned char *data, int length, int *count)
+        {
+            int status = usb_->read(data, length, count);
+            if (status == EXIT_SUCCESS)
+                trace_->record(channel_, TRACE_USB_READ, data, *count);
+            return status;
+        }
+
+        std::string serial() const { return usb_->serial(); }
+
+    private:
+        UsbTransport *usb_;
+        TraceWriter *trace_;
+        int channel_;
+};
+
+/*
+ * ReplayTransport: answers from PIUSB_REPLAY
+ */
+
+/* The trace and the totals, shared by every replayed device */
+static std::mutex replay_mutex;
+static TraceReader *replay_trace = NULL;
+static bool replay_paced = false;
+static int64_t replay_base_ns = 0;
+static ReplayStats replay_stats;
+
+static TraceReader *replayTrace()
+{
+    std::lock_guard<std::mutex> lock(replay_mutex);
+    if (replay_trace == NULL) {
+        replay_trace = new TraceReader;
+        if (replay_trace->open(getenv("PIUSB_REPLAY")) != EXIT_SUCCESS)
+            DEVLOG_ERROR("Cannot replay {}", getenv("PIUSB_REPLAY"));
+        const char *paced = getenv("PIUSB_REPLAY_PACED");
+        replay_paced = paced && atoi(paced);
+    }
+    return replay_trace;
+}
+
+ReplayStats usbReplayStats()
+{
+    std::lock_guard<std::mutex> lock(replay_mutex);
+    return replay_stats;
+}
+
+class ReplayTransport : public UsbTransport {
+    public:
+        ReplayTransport() : events_(NULL), next_(0) {}
+
+        int open(int vid, int pid, const char *select)
+        {
+            TraceReader *trace = replayTrace();
+            std::string name = channelName(vid, pid, select);
+            int channel = trace->channel(name.c_str());
+            if (channel < 0) {
+                DEVLOG_ERROR("Cannot open USB Device {:04x}:{:04x}. Not in the replayed trace ({})", vid, pid, name);
+                return EXIT_FAILURE;
+            }
+            events_ = &trace->events(channel);
+            name_ = name;
+            next_ = 0;
+            start_ns_ = trace->startTime();
+
+            // Paced replay starts the recording's clock at the first open
+            std::lock_guard<std::mutex> lock(replay_mutex);
+            if (replay_base_ns == 0 && !events_->empty())
+                replay_base_ns = timestampNs() - ((*events_)[0]->t_ns - start_ns_);
+            DEVLOG_DEBUG("USB Device {:04x}:{:04x} replayed from {}", vid, pid, name);
+            return EXIT_SUCCESS;
+        }
+
+        int close()
+        {
+            events_ = NULL;
+            return EXIT_SUCCESS;
+        }
+
+        int write(unsigned char *data, int length, int *count)
+        {
+            *count = events_ ? length : 0;
+            const TraceEvent *e = next(TRACE_USB_WRITE);
+            bool same = e && (int) e->length == length && !memcmp(TraceReader::payload(e), data, length);
+            if (!same)
+                DEVLOG_DEBUG("Replay mismatch: {:Xsn}", spdlog::to_hex(data, data + length));
+
+            std::lock_guard<std::mutex> lock(replay_mutex);
+            replay_stats.events++;
+            replay_stats.bytes += length;
+            if (!same)
+                replay_stats.mismatches++;
+            return events_ ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        int read (unsigned char *data, int length, int *count)
+        {
+            // Past the end of the recording the device keeps its last answer
+            *count = 0;
+            const TraceEvent *e = next(TRACE_USB_READ);
+            if (e)
+                last_.assign(TraceReader::payload(e), TraceReader::payload(e) + e->length);
+            if (last_.empty()) {
+                DEVLOG_ERROR("Read Failed: nothing recorded");
+                return EXIT_FAILURE;
+            }
+            memset(data, 0, length);
+            *count = (int) last_.size() < length ? last_.size() : length;
+            memcpy(data, last_.data(), *count);
+
+            std::lock_guard<std::mutex> lock(replay_mutex);
+            replay_stats.events++;
+            replay_stats.bytes += *count;
+            return EXIT_SUCCESS;
+        }
+
+        std::string serial() const { return name_; }
+
+    private:
+        /* The next recorded event of this kind, waited for when paced */
+        const TraceEvent *next(int kind)
+        {
+            if (events_ == NULL)
+                return NULL;
+            while (next_ < events_->size() && (*events_)[next_]->kind != kind)
+                next_++;
+            if (next_ == events_->size())
+                return NULL;
+
+            const TraceEvent *e = (*events_)[next_++];
+            if (replay_paced) {
+                int64_t due = replay_base_ns + (e->t_ns - start_ns_);
+                struct timespec ts = { (time_t) (due / 1000000000LL), (long) (due % 1000000000LL) };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+                int64_t late = timestampNs() - due;
+                std::lock_guard<std::mutex> lock(replay_mutex);
+                if (late > replay_stats.max_late_ns)
+                    replay_stats.max_late_ns = late;
+            }
+            return e;
+        }
+
+        const std::vector<const TraceEvent *> *events_;
+        std::string name_;
+        size_t next_;
+        int64_t start_ns_;
+        std::vector<unsigned char> last_;
+};
+
+/*
+ * Picard
+ */
+
+static bool usbSimulated()
+{
+    return getenv("PIUSB_SIM") && atoi(getenv("PIUSB_SIM"));
+}
+
+static UsbTransport *usbTransport()
+{
+    if (getenv("PIUSB_REPLAY"))
+        return new ReplayTransport;
+
+    UsbTransport *usb;
+    if (usbSimulated())
+        usb = new SimTransport;
+    else
+        usb = new LibusbTransport;
+    if (traceWriter())
+        return new RecordTransport(usb, traceWriter());
+    return usb;
+}
+
+static void count(UsbDirectionStats *s, int status, int length, int count, int64_t ns)
+{
+    s->transfers++;
+    s->bytes += count;
+    if (status != EXIT_SUCCESS) {
+        s->failures++;
+        if (count > 0 && count < length)
+            s->short_transfers++;
+    }
+    s->latency.record(ns);
+}
+
+static void printDirection(FILE *f, const char *name, const UsbDirectionStats &s, bool histogram)
+{
+    const LogHistogram &h = s.latency;
+    fprintf(f, "  %-5s %9llu transfers %10llu bytes %6llu failed %6llu short"
+               "   us: mean %.1f p50 %.1f p99 %.1f max %.1f\n",
+            name, (unsigned long long) s.transfers, (unsigned long long) s.bytes,
+            (unsigned long long) s.failures, (unsigned long long) s.short_transfers,
+            h.mean() * 1e-3, h.percentile(50) * 1e-3, h.percentile(99) * 1e-3, h.max() * 1e-3);
+    if (histogram)
+        h.print(f, "        ");
+}
+
+void printUsbStats(FILE *f, const UsbStats &stats, bool histogram)
+{
+    fprintf(f, "USB %04x:%04x\n", stats.vid, stats.pid);
+    printDirection(f, "write", stats.write, histogram);
+    printDirection(f, "read", stats.read, histogram);
+}
+
+Picard::Picard()
+{
+    transport_ = NULL;
+    open_ = false;
+    stats_.vid = 0;
+    stats_.pid = 0;
+    resetUsbStats();
+}
+
+Picard::~Picard()
+{
+    delete transport_;
+}
+
+int Picard::usbOpen(int vid, int pid, const char *select)
+{
+    delete transport_;
+    transport_ = usbTransport();
+    resetUsbStats();
+    stats_.vid = vid;
+    stats_.pid = pid;
+    open_ = transport_->open(vid, pid, select) == EXIT_SUCCESS;
+    return open_ ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+bool Picard::isOpen() const
+{
+    return open_;
+}
+
+std::string Picard::usbId() const
+{
+    if (!open_)
+        return "";
+    char id[16];
+    snprintf(id, sizeof(id), "%04x:%04x/", stats_.vid, stats_.pid);
+    return id + transport_->serial();
+}
+
+int Picard::usbClose()
+{
+    if (!open_)
+        return EXIT_FAILURE;
+    open_ = false;
+
+    const char *print = getenv("PIUSB_STATS");
+    if (print && atoi(print))
+        printUsbStats(stderr, stats_, atoi(print) > 1);
+    return transport_->close();
+}
+
+int Picard::usbWrite(unsigned char *data, int length)
+{
+    if (!open_)
+        return EXIT_FAILURE;
+
+    int n = 0;
+    int64_t t = timestampNs();
+    int status = transport_->write(data, length, &n);
+    count(&stats_.write, status, length, n, timestampNs() - t);
+    return status;
+}
+
 int Picard::usbRead (unsigned char *data, int length)
 {
-    int count;
-    int status = libusb_bulk_transfer(dev_handle, (ENDPOINT | LIBUSB_ENDPOINT_IN), data, length, &count, 0);
-    if (status == 0 && count == length)
-        debug_print("%s\n", "Read Successful");
-    else {
-        printf("Read Failed");
+    if (!open_)
         return EXIT_FAILURE;
-    }
 
-    debug_print("%s", "Read Data: ");
-    for (int i=0; i<7; i++) {
-        debug_print("%02X", data[i]);
+    int n = 0;
+    int64_t t = timestampNs();
+    int status = transport_->read(data, length, &n);
+    count(&stats_.read, status, length, n, timestampNs() - t);
+    return status;
+}
+
+UsbStats Picard::usbStats() const
+{
+    return stats_;
+}
+
+void Picard::resetUsbStats()
+{
+    UsbDirectionStats *dir[] = { &stats_.write, &stats_.read };
+    for (int i=0; i<2; i++) {
+        dir[i]->transfers = 0;
+        dir[i]->bytes = 0;
+        dir[i]->failures = 0;
+        dir[i]->short_transfers = 0;
+        dir[i]->latency.reset();
     }
-    debug_print("%s", "\n");
-    return EXIT_SUCCESS;
 }
 
 Twister::Twister() {
@@ -200,11 +698,45 @@ int Twister::getPosition ()
     return (position);
 }
 
-Motor::Motor() {
-    usbOpen(vendor_id, product_id);
+Motor::Motor(const char *select) {
+    usbOpen(vendor_id, product_id, select);
     setVelocity(VELOCITY);
 }
 
+static void openLeg(Motor **leg, const char *select)
+{
+    *leg = new Motor(select);
+}
+
+int openMotors(int n, const char *const *select, Motor **legs)
+{
+    // Only the real bus is worth listing once for every leg
+    UsbEnumeration *enumeration = NULL;
+    if (!getenv("PIUSB_REPLAY") && !usbSimulated())
+        enumeration = new UsbEnumeration;
+
+    std::vector<std::string> index(n);
+    std::vector<std::thread> threads;
+    for (int i=0; i<n; i++) {
+        index[i] = "index:" + std::to_string(i);
+        const char *leg = select && select[i] ? select[i] : index[i].c_str();
+        threads.push_back(std::thread(openLeg, &legs[i], leg));
+    }
+
+    int opened = 0;
+    for (int i=0; i<n; i++) {
+        threads[i].join();
+        if (legs[i]->isOpen())
+            opened++;
+        else {
+            delete legs[i];
+            legs[i] = NULL;
+        }
+    }
+    delete enumeration;
+    return opened;
+}
+
 Motor::~Motor() {
     usbClose();
 }
@@ -236,10 +768,22 @@ int Motor::setVelocity (int velocity)
     return EXIT_SUCCESS;
 }
 
+int Motor::stepPeriodMs (int velocity)
+{
+    static const int period_ms[] = { 13, 12, 11, 10, 9, 8, 6, 5, 4, 3 };
+
+    if (velocity >10 || velocity < 1)
+        return 0;
+    return period_ms[velocity-1];
+}
+
 int Motor::setPosition (int position)
 {
-    //if (position > 3000 || position < -3000)
-    //    return EXIT_FAILURE;
+    // Never reached: the poll below would wait forever
+    if (position > MOTOR_MAX_POSITION || position < MOTOR_MIN_POSITION) {
+        DEVLOG_ERROR("{}: position {} out of {}-{}", usbId(), position, MOTOR_MIN_POSITION, MOTOR_MAX_POSITION);
+        return EXIT_FAILURE;
+    }
 
     unsigned char data[8] = {0};
     
@@ -290,7 +834,7 @@ int Relay::setState(int relay, bool on)
 
     int status = getState();
 
-    debug_print("status: %1X\n", status);
+    DEVLOG_DEBUG("status: {:X}", status);
 
 
     // mask on the bit in question if state is on
@@ -299,7 +843,7 @@ int Relay::setState(int relay, bool on)
     else
         status = status & (0xF & ~(0x1 << relay));
 
-    debug_print("status: %1X\n", status);
+    DEVLOG_DEBUG("status: {:X}", status);
 
     unsigned char data[8] = {0};
     data [0] = 0xF & status;
@@ -0,0 +1,540 @@
+#include "psd.hpp"
+#include "drift.hpp"
+#include "rtprofile.hpp"
+#include "timestamp.hpp"
+#include "trace.hpp"
+
+#include <errno.h>
+#include <glob.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include <fcntl.h>       // For file handling
+#include <termios.h>     // Terminal IO
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define LINE_SIZE   128
+#define READ_SIZE   4096
+#define MAX_EVENTS  32
+
+/*
+ * PSDCalibration
+ */
+
+PSDCalibration PSDCalibration::identity()
+{
+    PSDCalibration cal;
+    for (int i=0; i<2; i++) {
+        cal.alphax_neg[i] = 1.0;
+        cal.alphax_pos[i] = 1.0;
+        cal.alphay_neg[i] = 1.0;
+        cal.alphay_pos[i] = 1.0;
+        cal.betax[i]      = 0.0;
+        cal.betay[i]      = 0.0;
+    }
+    return cal;
+}
+
+PSDCalibration PSDCalibration::board1()
+{
+    PSDCalibration cal = {
+        {-9.909807, -9.794860},
+        {-9.906882, -9.771347},
+        {10.103729, 10.016967},
+        {10.142797,  9.933996},
+        { 0.007212,  0.021057},
+        { 0.100659,  0.098714}
+    };
+    return cal;
+}
+
+int PSDCalibration::load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return EXIT_FAILURE;
+
+    char name[32];
+    double v[2];
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%31s %lf %lf", name, &v[0], &v[1]) != 3)
+            continue;
+
+        double *dst = NULL;
+        if      (!strcmp(name, "alphax_neg")) dst = alphax_neg;
+        else if (!strcmp(name, "alphax_pos")) dst = alphax_pos;
+        else if (!strcmp(name, "alphay_neg")) dst = alphay_neg;
+        else if (!strcmp(name, "alphay_pos")) dst = alphay_pos;
+        else if (!strcmp(name, "betax"))      dst = betax;
+        else if (!strcmp(name, "betay"))      dst = betay;
+        else
+            fprintf(stderr, "WARNING: %s: unknown coefficient %s\n", path, name);
+
+        if (dst) {
+            dst[0] = v[0];
+            dst[1] = v[1];
+        }
+    }
+    fclose(f);
+    return EXIT_SUCCESS;
+}
+
+int PSDCalibration::save(const char *path) const
+{
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return EXIT_FAILURE;
+
+    fprintf(f, "alphax_neg %.6f %.6f\n", alphax_neg[0], alphax_neg[1]);
+    fprintf(f, "alphax_pos %.6f %.6f\n", alphax_pos[0], alphax_pos[1]);
+    fprintf(f, "alphay_neg %.6f %.6f\n", alphay_neg[0], alphay_neg[1]);
+    fprintf(f, "alphay_pos %.6f %.6f\n", alphay_pos[0], alphay_pos[1]);
+    fprintf(f, "betax %.6f %.6f\n", betax[0], betax[1]);
+    fprintf(f, "betay %.6f %.6f\n", betay[0], betay[1]);
+    fclose(f);
+    return EXIT_SUCCESS;
+}
+
+void PSDCalibration::apply(double x[2], double y[2]) const
+{
+    for (int i=0; i<2; i++) {
+        if (x[i]<0) x[i] = (x[i]-betax[i])*alphax_neg[i];
+        else        x[i] = (x[i]-betax[i])*alphax_pos[i];
+        if (y[i]<0) y[i] = (y[i]-betay[i])*alphay_neg[i];
+        else        y[i] = (y[i]-betay[i])*alphay_pos[i];
+    }
+}
+
+int parsePSDLine(const char *line, PSDSample *sample)
+{
+    double v[9];
+    int n = 0;
+    const char *p = line;
+
+    if (*p == '#')
+        return -1;
+
+    while (n < 9) {
+        char *end;
+        double d = strtod(p, &end);
+        if (end == p)
+            break;
+        v[n++] = d;
+        p = end;
+    }
+
+    // x0 y0 x1 y1 temperature, optionally with the four sigmas before the temperature
+    if (n < 5)
+        return -1;
+
+    sample->x[0] = v[0];
+    sample->y[0] = v[1];
+    sample->x[1] = v[2];
+    sample->y[1] = v[3];
+    for (int i=0; i<4; i++)
+        sample->sigma[i] = (n >= 9) ? v[4+i] : 0.0;
+    sample->temperature = v[n-1];
+    return n;
+}
+
+/*
+ * PSDBus
+ */
+
+PSDBus::PSDBus(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    ring_.resize(size);
+    mask_ = size - 1;
+    head_ = 0;
+}
+
+void PSDBus::push(const PSDSample &sample)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ring_[head_ & mask_] = sample;
+        head_++;
+    }
+    cond_.notify_all();
+}
+
+size_t PSDBus::read(uint64_t *cursor, PSDSample *out, size_t max, uint64_t *lost)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Reader was lapped, skip to the oldest sample still in the ring
+    uint64_t oldest = (head_ > ring_.size()) ? head_ - ring_.size() : 0;
+    if (*cursor < oldest) {
+        if (lost)
+            *lost += oldest - *cursor;
+        *cursor = oldest;
+    }
+
+    size_t n = 0;
+    while (n < max && *cursor < head_) {
+        out[n++] = ring_[*cursor & mask_];
+        (*cursor)++;
+    }
+    return n;
+}
+
+bool PSDBus::wait(uint64_t cursor, int timeout_ms)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                          [&] { return head_ > cursor; });
+}
+
+uint64_t PSDBus::head()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return head_;
+}
+
+/*
+ * PSDHub
+ */
+
+struct PSDHub::Board {
+    int index;
+    int fd;
+    std::string name;
+    PSDCalibration cal;
+
+    char line[LINE_SIZE];
+    int  len;
+    bool synced;        // first (partial) line is thrown away, as in M2PSD
+    bool overflow;      // current line did not fit, discard up to the next '\n'
+    uint32_t seq;
+    int drift[4];       // DriftModel channels of x0 y0 x1 y1
+    int trace;          // trace channel, -1 unless IOTRACE_FILE is recording
+
+    PSDBoardStats stats;
+    uint64_t rate_samples;
+};
+
+static int setInterfaceAttribs (int fd, int speed)
+{
+    struct termios tty;
+    memset (&tty, 0, sizeof tty);
+    if (tcgetattr (fd, &tty) != 0)
+    {
+        fprintf(stderr, "ERROR: %d from tcgetattr\n", errno);
+        return -1;
+    }
+
+    cfsetospeed (&tty, speed);
+    cfsetispeed (&tty, speed);
+
+    cfmakeraw (&tty);
+    tty.c_cflag |= (CLOCAL | CREAD);    // ignore modem controls, enable reading
+    tty.c_cflag &= ~(PARENB | CSTOPB | CRTSCTS);
+    tty.c_iflag &= ~(IXON | IXOFF | IXANY);
+    tty.c_cc[VMIN]  = 0;                // epoll does the waiting
+    tty.c_cc[VTIME] = 0;
+    tcflush(fd,TCIFLUSH);
+
+    if (tcsetattr (fd, TCSANOW, &tty) != 0)
+    {
+        fprintf(stderr, "ERROR: %d from tcsetattr\n", errno);
+        return -1;
+    }
+    return 0;
+}
+
+PSDHub::PSDHub(PSDBus *bus)
+{
+    bus_ = bus;
+    drift_ = NULL;
+    drift_learn_ = false;
+    epoll_fd_ = epoll_create1(0);
+    stop_fd_ = eventfd(0, EFD_NONBLOCK);
+    running_ = false;
+    rate_t_ns_ = 0;
+    loop_cpu_ns_ = 0;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, stop_fd_, &ev);
+}
+
+PSDHub::~PSDHub()
+{
+    stop();
+    for (size_t i=0; i<boards_.size(); i++) {
+        close(boards_[i]->fd);
+        delete boards_[i];
+    }
+    close(stop_fd_);
+    close(epoll_fd_);
+}
+
+int PSDHub::addBoard(const char *path, const PSDCalibration &cal)
+{
+    int fd = open (path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: %d opening %s: %s\n", errno, path, strerror (errno));
+        return -1;
+    }
+    if (setInterfaceAttribs(fd, B115200) < 0) {
+        close(fd);
+        return -1;
+    }
+    return addFD(fd, path, cal);
+}
+
+int PSDHub::addFD(int fd, const char *name, const PSDCalibration &cal)
+{
+    if (running_) {
+        fprintf(stderr, "ERROR: boards must be added before PSDHub::start\n");
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    Board *board = new Board;
+    board->index = boards_.size();
+    board->fd = fd;
+    board->name = name;
+    board->cal = cal;
+    board->len = 0;
+    board->synced = false;
+    board->overflow = false;
+    board->seq = 0;
+    board->rate_samples = 0;
+    board->trace = traceWriter() ? traceWriter()->channel(name) : -1;
+    memset(&board->stats, 0, sizeof board->stats);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.ptr = board;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        fprintf(stderr, "ERROR: Cannot watch %s: %s\n", name, strerror(errno));
+        delete board;
+        return -1;
+    }
+
+    boards_.push_back(board);
+    return boards_.size() - 1;
+}
+
+int PSDHub::discover(const char *pattern, const char *caldir)
+{
+    glob_t g;
+    if (glob(pattern, 0, NULL, &g) != 0)
+        return 0;
+
+    int opened = 0;
+    for (size_t i=0; i<g.gl_pathc; i++) {
+        const char *path = g.gl_pathv[i];
+        PSDCalibration cal = PSDCalibration::identity();
+
+        if (caldir) {
+            char tmp[256];
+            char calpath[512];
+            snprintf(tmp, sizeof(tmp), "%s", path);
+            snprintf(calpath, sizeof(calpath), "%s/%s.cal", caldir, basename(tmp));
+            if (cal.load(calpath) != EXIT_SUCCESS)
+                fprintf(stderr, "WARNING: no calibration %s, %s is uncalibrated\n", calpath, path);
+        }
+
+        if (addBoard(path, cal) >= 0)
+            opened++;
+    }
+    globfree(&g);
+    return opened;
+}
+
+void PSDHub::setDriftModel(DriftModel *model, bool learn)
+{
+    drift_ = model;
+    drift_learn_ = learn;
+}
+
+int PSDHub::start()
+{
+    if (running_)
+        return EXIT_SUCCESS;
+
+    if (drift_) {
+        const char *axis[4] = {"x0", "y0", "x1", "y1"};
+        for (size_t i=0; i<boards_.size(); i++) {
+            std::string tty = boards_[i]->name.substr(boards_[i]->name.rfind('/') + 1);
+            for (int k=0; k<4; k++)
+                boards_[i]->drift[k] = drift_->channel((tty + "." + axis[k]).c_str());
+        }
+    }
+    running_ = true;
+    rate_t_ns_ = timestampNs();
+    thread_ = std::thread(&PSDHub::run, this);
+    return EXIT_SUCCESS;
+}
+
+int PSDHub::stop()
+{
+    if (!running_)
+        return EXIT_SUCCESS;
+
+    uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof one) != sizeof one)
+        fprintf(stderr, "ERROR: Cannot wake PSD hub thread\n");
+    thread_.join();
+    running_ = false;
+    return EXIT_SUCCESS;
+}
+
+size_t PSDHub::boards() const
+{
+    return boards_.size();
+}
+
+const char *PSDHub::boardName(int board) const
+{
+    return boards_[board]->name.c_str();
+}
+
+PSDBoardStats PSDHub::stats(int board)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return boards_[board]->stats;
+}
+
+int64_t PSDHub::loopCpuNs() const
+{
+    return loop_cpu_ns_;
+}
+
+void PSDHub::run()
+{
+    struct epoll_event events[MAX_EVENTS];
+    rtEnterThread(RT_ACQUIRE, "psdhub");
+
+    while (true) {
+        int n = epoll_wait(epoll_fd_, events, MAX_EVENTS, 100);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "ERROR: epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+
+        bool quit = false;
+        for (int i=0; i<n; i++) {
+            if (events[i].data.ptr == NULL)
+                quit = true;
+            else
+                readBoard((Board *) events[i].data.ptr);
+        }
+
+        updateRates(timestampNs());
+        loop_cpu_ns_ = threadCpuNs();
+
+        if (quit)
+            break;
+    }
+}
+
+void PSDHub::readBoard(Board *board)
+{
+    char buf[READ_SIZE];
+    int n = read(board->fd, buf, sizeof(buf));
+    int64_t now = timestampNs();
+
+    if (n <= 0) {
+        if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            board->stats.read_errors++;
+        }
+        return;
+    }
+    if (board->trace >= 0)
+        traceWriter()->record(board->trace, TRACE_TTY_RX, buf, n);
+
+    uint64_t samples = 0;
+    uint64_t drops = 0;
+
+    for (int i=0; i<n; i++) {
+        char c = buf[i];
+        if (c != '\n') {
+            if (c == '\r')
+                continue;
+            if (board->len < LINE_SIZE-1)
+                board->line[board->len++] = c;
+            else
+                board->overflow = true;
+            continue;
+        }
+
+        // End of line
+        board->line[board->len] = '\0';
+        if (!board->synced) {
+            board->synced = true;
+        }
+        else if (board->overflow) {
+            drops++;
+        }
+        else if (board->len > 0) {
+            PSDSample sample;
+            if (parsePSDLine(board->line, &sample) < 0) {
+                drops++;
+            }
+            else {
+                sample.t_ns = now;
+                sample.board = board->index;
+                sample.seq = board->seq++;
+                board->cal.apply(sample.x, sample.y);
+                if (drift_)
+                    compensate(board, &sample);
+                bus_->push(sample);
+                samples++;
+            }
+        }
+        board->len = 0;
+        board->overflow = false;
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    board->stats.bytes += n;
+    board->stats.samples += samples;
+    board->stats.drops += drops;
+    if (samples)
+        board->stats.last_t_ns = now;
+}
+
+void PSDHub::compensate(Board *board, PSDSample *sample)
+{
+    double *v[4] = {&sample->x[0], &sample->y[0], &sample->x[1], &sample->y[1]};
+    for (int k=0; k<4; k++) {
+        if (drift_learn_)
+            drift_->update(board->drift[k], sample->temperature, *v[k]);
+        *v[k] = drift_->correct(board->drift[k], sample->temperature, *v[k]);
+    }
+}
+
+void PSDHub::updateRates(int64_t now)
+{
+    int64_t dt = now - rate_t_ns_;
+    if (dt < 1000000000LL)
+        return;
+
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    for (size_t i=0; i<boards_.size(); i++) {
+        Board *board = boards_[i];
+        board->stats.rate_hz = (board->stats.samples - board->rate_samples) * 1e9 / dt;
+        board->rate_samples = board->stats.samples;
+    }
+    rate_t_ns_ = now;
+}
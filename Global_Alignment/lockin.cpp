@@ -0,0 +1,123 @@
+#include "lockin.hpp"
+
+#include <math.h>
+#include <string.h>
+
+LockIn::LockIn(int64_t guard_ns)
+{
+    guard_ns_ = guard_ns;
+    reset();
+}
+
+void LockIn::reset()
+{
+    switched_ns_ = 0;
+    started_ = false;
+    memset(&current_, 0, sizeof(current_));
+    memset(previous_, 0, sizeof(previous_));
+    values_.clear();
+    closed_ = 0;
+    memset(&cycles_, 0, sizeof(cycles_));
+    memset(&on_, 0, sizeof(on_));
+    memset(&off_, 0, sizeof(off_));
+    samples_ = 0;
+    guarded_ = 0;
+}
+
+void LockIn::accumulate(Stats *stats, const double *v)
+{
+    stats->n++;
+    for (int c=0; c<LOCKIN_CHANNELS; c++) {
+        double delta = v[c] - stats->mean[c];
+        stats->mean[c] += delta / stats->n;
+        stats->m2[c] += delta * (v[c] - stats->mean[c]);
+    }
+}
+
+double LockIn::standardError(const Stats &stats, int c)
+{
+    return stats.n > 1 ? sqrt(stats.m2[c] / (stats.n - 1) / stats.n) : 0;
+}
+
+void LockIn::closeBlock()
+{
+    if (current_.n == 0)
+        return;
+
+    double mean[LOCKIN_CHANNELS];
+    for (int c=0; c<LOCKIN_CHANNELS; c++)
+        mean[c] = current_.sum[c] / current_.n;
+    accumulate(current_.on ? &on_ : &off_, mean);
+
+    // An odd middle sample is in neither half
+    if (!current_.on) {
+        uint64_t h = current_.n / 2;
+        for (uint64_t i=0; i<h; i++)
+            for (int c=0; c<LOCKIN_CHANNELS; c++) {
+                current_.half[0][c] += values_[i * LOCKIN_CHANNELS + c];
+                current_.half[1][c] += values_[(current_.n - h + i) * LOCKIN_CHANNELS + c];
+            }
+        current_.half_n[0] = current_.half_n[1] = h;
+    }
+
+    // second half of off, on, first half of off: one estimate
+    if (closed_ >= 2 && !previous_[0].on && previous_[1].on && !current_.on &&
+        previous_[0].half_n[1] > 0 && current_.half_n[0] > 0) {
+        double d[LOCKIN_CHANNELS];
+        for (int c=0; c<LOCKIN_CHANNELS; c++) {
+            double off = (previous_[0].half[1][c] / previous_[0].half_n[1] +
+                          current_.half[0][c] / current_.half_n[0]) / 2;
+            d[c] = previous_[1].sum[c] / previous_[1].n - off;
+        }
+        accumulate(&cycles_, d);
+    }
+    previous_[0] = previous_[1];
+    previous_[1] = current_;
+    closed_++;
+}
+
+void LockIn::setReference(bool on, int64_t t_ns)
+{
+    if (started_)
+        closeBlock();
+    memset(&current_, 0, sizeof(current_));
+    values_.clear();
+    current_.on = on;
+    switched_ns_ = t_ns;
+    started_ = true;
+}
+
+void LockIn::add(const PSDSample &sample)
+{
+    if (!started_)
+        return;
+    if (sample.t_ns < switched_ns_ + guard_ns_) {
+        guarded_++;
+        return;
+    }
+
+    double v[LOCKIN_CHANNELS] = { sample.x[0], sample.y[0], sample.x[1], sample.y[1] };
+    current_.n++;
+    samples_++;
+    for (int c=0; c<LOCKIN_CHANNELS; c++)
+        current_.sum[c] += v[c];
+    if (!current_.on)
+        values_.insert(values_.end(), v, v + LOCKIN_CHANNELS);
+}
+
+LockInResult LockIn::result() const
+{
+    LockInResult r;
+    r.cycles = cycles_.n;
+    r.samples = samples_;
+    r.guarded = guarded_;
+    for (int c=0; c<LOCKIN_CHANNELS; c++) {
+        r.on[c] = on_.mean[c];
+        r.on_noise[c] = standardError(on_, c);
+        r.off[c] = off_.mean[c];
+        r.off_noise[c] = standardError(off_, c);
+        r.value[c] = cycles_.mean[c];
+        r.noise[c] = standardError(cycles_, c);
+    }
+    return r;
+}
@@ -0,0 +1,95 @@
+#ifndef _LOCKIN_HPP_
+#define _LOCKIN_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "psd.hpp"
+
+/* Channel order of the results: x0, y0, x1, y1 */
+#define LOCKIN_CHANNELS 4
+
+struct LockInResult {
+    uint64_t cycles;                    // on blocks with an off block either side
+    uint64_t samples;                   // samples in the blocks
+    uint64_t guarded;                   // dropped inside the guard, or late for their block
+    double on[LOCKIN_CHANNELS];         // mean of the on blocks: the centroid
+    double on_noise[LOCKIN_CHANNELS];   // its standard error, from the scatter of the blocks
+    double off[LOCKIN_CHANNELS];        // mean of the off blocks: the dark reading
+    double off_noise[LOCKIN_CHANNELS];
+    double value[LOCKIN_CHANNELS];      // on minus off, see LockIn
+    double noise[LOCKIN_CHANNELS];      // standard error of value
+};
+
+/*
+ * One PSD board while the laser is switched on and off: the samples
+ * between two switches form a block.
+ *
+ * The centroid is the mean of the on blocks, its noise the scatter of the
+ * block means, so correlated samples within a block are not counted as
+ * independent. The mean of the off blocks is what the board reports dark.
+ *
+ * The boards report centroids, intensity-weighted ratios, so a dark
+ * detector reports whatever its electronics give, not an offset of the
+ * lit one, and ambient light pulls the on centroid rather than adding to
+ * it. value, every on block minus the mean of the adjacent halves of the
+ * off blocks either side of it, removes an offset and its drift only if
+ * the dark reading is that offset: check off against a known one before
+ * using it. No off sample is in two of its estimates, so their scatter
+ * gives its noise.
+ *
+ * Feed setReference() at every switch and add() every sample of the
+ * board, both in time order. Samples within guard_ns after a switch
+ * (relay, optics) are left out.
+ */
+class LockIn {
+    public:
+        LockIn(int64_t guard_ns = 0);
+
+        void reset();
+
+        /* The laser was switched on (or off) at t_ns */
+        void setReference(bool on, int64_t t_ns);
+        void add(const PSDSample &sample);
+
+        LockInResult result() const;
+
+    private:
+        struct Block {
+            bool on;
+            uint64_t n;
+            double sum[LOCKIN_CHANNELS];
+            uint64_t half_n[2];                 // first and second half, off blocks
+            double half[2][LOCKIN_CHANNELS];
+        };
+
+        void closeBlock();
+
+        int64_t guard_ns_;
+        int64_t switched_ns_;
+        bool started_;
+        Block current_;
+        std::vector<double> values_;    // samples of an off block, to split it
+        Block previous_[2];     // the last two closed blocks, [1] the latest
+        int closed_;
+
+        // Welford over the per-cycle estimates and the on and off block means
+        struct Stats {
+            uint64_t n;
+            double mean[LOCKIN_CHANNELS];
+            double m2[LOCKIN_CHANNELS];
+        };
+
+        static void accumulate(Stats *stats, const double *v);
+        static double standardError(const Stats &stats, int c);
+
+        Stats cycles_;
+        Stats on_;
+        Stats off_;
+
+        uint64_t samples_;
+        uint64_t guarded_;
+};
+
+#endif
@@ -0,0 +1,313 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <getopt.h>  // Argument parsing
+
+#include "npy.hpp"
+#include "samplelog.hpp"
+
+static int help()
+{
+    char usage [] = "\nlogconv: binary sample logs <-> data*.txt                     "
+        "\n                                                                   "
+        "\nUsage: logconv [arguments]                                         "
+        "\n   e.g. logconv --info run.slog --verify                           "
+        "\n        logconv --to-csv run.slog > data.txt                       "
+        "\n        logconv --from-csv data03172025.txt --out data.slog        "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --info <log>          Header, records per type, time span      "
+        "\n    --verify              Check the block checksums too            "
+        "\n    --to-csv <log>        Print the GUI layout (X0, Y0, ... ,      "
+        "\n                          Actuator_y): PSD and row records, with   "
+        "\n                          the last motor/twister positions         "
+        "\n    --raw                 Print every record as                    "
+        "\n                          t[s], type, source, seq, v0 ... v9       "
+        "\n    --from-csv <file>     Read a data*.txt (or --raw) file ...     "
+        "\n    --out <log>           ... into this log                        "
+        "\n    --to-npy <log>        Copy every record to the NumPy file      "
+        "\n                          given with --out (t_ns, type, source,    "
+        "\n                          seq, v[10])                              "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+static const char *typeName(int type)
+{
+    switch (type) {
+        case LOG_DLS:      return "dls";
+        case LOG_PSD:      return "psd";
+        case LOG_ACTUATOR: return "actuator";
+        case LOG_ROW:      return "row";
+        default:           return "unknown";
+    }
+}
+
+static int info(const char *path, bool verify)
+{
+    SampleLogReader log;
+    if (log.open(path, verify) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    const SampleLogHeader &h = log.header();
+    printf("%s: version %u, %u records/block, \"%.*s\"\n", path, h.version, h.block_records,
+           (int) sizeof(h.description), h.description);
+    printf("%llu records in %zu blocks\n", (unsigned long long) log.records(), log.blocks());
+
+    uint64_t count[5] = {0};
+    for (size_t b=0; b<log.blocks(); b++) {
+        uint32_t n;
+        const LogRecord *r = log.block(b, &n);
+        for (uint32_t i=0; i<n; i++)
+            count[r[i].type < 5 ? r[i].type : 0]++;
+    }
+    for (int t=1; t<5; t++)
+        if (count[t])
+            printf("  %-9s %llu\n", typeName(t), (unsigned long long) count[t]);
+    if (count[0])
+        printf("  %-9s %llu\n", typeName(0), (unsigned long long) count[0]);
+
+    if (log.records()) {
+        double span = (log.record(log.records()-1)->t_ns - log.record(0)->t_ns) * 1e-9;
+        printf("%.3f s\n", span);
+    }
+    if (log.trailing())
+        printf("%llu bytes past the last valid block (torn or corrupt)\n",
+               (unsigned long long) log.trailing());
+    return EXIT_SUCCESS;
+}
+
+static void printRow(const double v[10])
+{
+    printf("%.4e, %.4e,%.4e, %.4e, %.5e,%.5e,%.5e, %.5e, %.4e, %.4e\n",
+           v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], v[8], v[9]);
+}
+
+static int toCSV(const char *path, bool raw)
+{
+    SampleLogReader log;
+    if (log.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    if (raw)
+        printf("t, type, source, seq, v0, v1, v2, v3, v4, v5, v6, v7, v8, v9\n");
+    else
+        printf("X0, Y0, X1, Y1, σ_X0, σ_Y0, σ_X1, σ_Y1,Actuator_x, Actuator_y\n");
+
+    int64_t t0 = log.records() ? log.record(0)->t_ns : 0;
+    double actuator[2] = {NAN, NAN};
+
+    for (size_t b=0; b<log.blocks(); b++) {
+        uint32_t n;
+        const LogRecord *r = log.block(b, &n);
+        for (uint32_t i=0; i<n; i++) {
+            if (raw) {
+                printf("%.9f, %u, %u, %u", (r[i].t_ns - t0) * 1e-9, r[i].type, r[i].source, r[i].seq);
+                for (int k=0; k<SAMPLELOG_VALUES; k++)
+                    printf(", %.17g", r[i].v[k]);
+                printf("\n");
+                continue;
+            }
+
+            double row[10];
+            switch (r[i].type) {
+                case LOG_ROW:
+                    printRow(r[i].v);
+                    break;
+                case LOG_PSD:
+                    memcpy(row, r[i].v, 8 * sizeof(double));
+                    row[8] = actuator[0];
+                    row[9] = actuator[1];
+                    printRow(row);
+                    break;
+                case LOG_ACTUATOR:
+                    if (r[i].source < 2)
+                        actuator[r[i].source] = r[i].v[0];
+                    break;
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/* Numbers separated by commas and/or blanks. Returns how many were read */
+static int parseNumbers(const char *line, double *v, int max)
+{
+    int n = 0;
+    const char *p = line;
+    while (n < max) {
+        while (*p == ',' || *p == ' ' || *p == '\t')
+            p++;
+        if (*p == '\0' || *p == '\n' || *p == '\r')
+            break;
+        char *end;
+        v[n] = strtod(p, &end);
+        if (end == p)
+            return -1;
+        n++;
+        p = end;
+    }
+    return n;
+}
+
+static int fromCSV(const char *path, const char *out)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Cannot open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    const char *name = strrchr(path, '/');
+    SampleLogWriter log;
+    if (log.open(out, name ? name + 1 : path) != EXIT_SUCCESS) {
+        fclose(f);
+        return EXIT_FAILURE;
+    }
+
+    char line[1024];
+    bool raw = false;
+    uint32_t seq = 0;
+    uint64_t bad = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == 't') {           // header of a --raw file
+            raw = true;
+            continue;
+        }
+        if (line[0] == 'X' || line[0] == '#' || line[0] == '\n')
+            continue;
+
+        double v[14];
+        int n = parseNumbers(line, v, 14);
+        if (raw && n == 14) {
+            LogRecord r;
+            r.t_ns = llround(v[0] * 1e9);
+            r.type = (uint16_t) v[1];
+            r.source = (uint16_t) v[2];
+            r.seq = (uint32_t) v[3];
+            memcpy(r.v, v + 4, sizeof(r.v));
+            log.append(r);
+        }
+        else if (!raw && n == 10) {
+            // The text files carry no time: rows are numbered instead
+            log.append(seq, LOG_ROW, 0, seq, v, 10);
+        }
+        else
+            bad++;
+        seq++;
+    }
+    fclose(f);
+
+    if (bad)
+        fprintf(stderr, "WARNING: %llu lines skipped\n", (unsigned long long) bad);
+    if (log.rejected())
+        fprintf(stderr, "WARNING: %llu records out of time order\n", (unsigned long long) log.rejected());
+    fprintf(stderr, "%llu records\n", (unsigned long long) log.records());
+    return log.close();
+}
+
+static int toNpy(const char *path, const char *out)
+{
+    static const NpyField fields[] = {
+        {"t_ns", "<i8", 1}, {"type", "<u2", 1}, {"source", "<u2", 1}, {"seq", "<u4", 1},
+        {"v", "<f8", SAMPLELOG_VALUES}
+    };
+
+    SampleLogReader log;
+    if (log.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    NpyWriter npy;
+    if (npy.open(out, fields, sizeof(fields) / sizeof(fields[0])) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    // LogRecord has exactly this layout: whole blocks go straight from the mapping
+    for (size_t b=0; b<log.blocks(); b++) {
+        uint32_t n;
+        const LogRecord *r = log.block(b, &n);
+        npy.append(r, n);
+    }
+    fprintf(stderr, "%llu records\n", (unsigned long long) npy.rows());
+    return npy.close();
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc==1) return help();
+
+    const char *info_path = NULL;
+    const char *csv_path = NULL;
+    const char *from_path = NULL;
+    const char *out_path = NULL;
+    const char *npy_path = NULL;
+    bool verify = false;
+    bool raw = false;
+
+    static struct option long_options[] = {
+        {"info"     , required_argument , 0    , 'i'} ,
+        {"verify"   , no_argument       , 0    , 'v'} ,
+        {"to-csv"   , required_argument , 0    , 'c'} ,
+        {"raw"      , no_argument       , 0    , 'r'} ,
+        {"from-csv" , required_argument , 0    , 'f'} ,
+        {"out"      , required_argument , 0    , 'o'} ,
+        {"to-npy"   , required_argument , 0    , 'n'} ,
+        {"help"     , no_argument       , 0    , 'h'} ,
+        {NULL       , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "i:vc:rf:o:n:h", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'i':
+                info_path = optarg;
+                break;
+            case 'v':
+                verify = true;
+                break;
+            case 'c':
+                csv_path = optarg;
+                break;
+            case 'r':
+                raw = true;
+                break;
+            case 'f':
+                from_path = optarg;
+                break;
+            case 'o':
+                out_path = optarg;
+                break;
+            case 'n':
+                npy_path = optarg;
+                break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+
+    if (info_path)
+        return info(info_path, verify);
+    if (csv_path)
+        return toCSV(csv_path, raw);
+    if (from_path) {
+        if (!out_path) {
+            fprintf(stderr, "ERROR: --from-csv needs --out <log>\n");
+            return EXIT_FAILURE;
+        }
+        return fromCSV(from_path, out_path);
+    }
+    if (npy_path) {
+        if (!out_path) {
+            fprintf(stderr, "ERROR: --to-npy needs --out <file>\n");
+            return EXIT_FAILURE;
+        }
+        return toNpy(npy_path, out_path);
+    }
+    return help();
+}
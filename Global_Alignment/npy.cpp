@@ -0,0 +1,165 @@
+#include "npy.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE (256 * 1024)
+
+NpyWriter::NpyWriter()
+{
+    fd_ = -1;
+    row_size_ = 0;
+    header_size_ = 0;
+    used_ = 0;
+    rows_ = 0;
+}
+
+NpyWriter::~NpyWriter()
+{
+    close();
+}
+
+std::string NpyWriter::header(uint64_t rows) const
+{
+    // The row count is padded to 20 digits so the header never changes size
+    char dict[4096];
+    int len = snprintf(dict, sizeof(dict),
+                       "{'descr': %s, 'fortran_order': False, 'shape': (%20llu,), }",
+                       descr_.c_str(), (unsigned long long) rows);
+
+    // magic (6) + version (2) + length (2) + dict + '\n', padded to 64 bytes
+    size_t total = 10 + len + 1;
+    size_t padded = (total + 63) / 64 * 64;
+
+    std::string h("\x93NUMPY\x01\x00", 8);
+    uint16_t dict_len = padded - 10;
+    h.append((const char *) &dict_len, 2);
+    h.append(dict, len);
+    h.append(padded - total, ' ');
+    h.append(1, '\n');
+    return h;
+}
+
+int NpyWriter::open(const char *path, const NpyField *fields, int n)
+{
+    if (fd_ >= 0)
+        close();
+
+    descr_ = "[";
+    row_size_ = 0;
+    for (int i=0; i<n; i++) {
+        int size = atoi(fields[i].type + 2);
+        if (size <= 0) {
+            fprintf(stderr, "ERROR: Bad numpy type %s for %s\n", fields[i].type, fields[i].name);
+            return EXIT_FAILURE;
+        }
+        char field[128];
+        if (fields[i].count > 1)
+            snprintf(field, sizeof(field), "('%s', '%s', (%d,)), ", fields[i].name, fields[i].type, fields[i].count);
+        else
+            snprintf(field, sizeof(field), "('%s', '%s'), ", fields[i].name, fields[i].type);
+        descr_ += field;
+        row_size_ += size * (fields[i].count > 1 ? fields[i].count : 1);
+    }
+    descr_ += "]";
+
+    fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        fprintf(stderr, "ERROR: Cannot create %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    std::string h = header(0);
+    header_size_ = h.size();
+    if (write(fd_, h.data(), h.size()) != (ssize_t) h.size()) {
+        fprintf(stderr, "ERROR: Cannot write %s\n", path);
+        ::close(fd_);
+        fd_ = -1;
+        return EXIT_FAILURE;
+    }
+
+    buffer_.resize(BUFFER_SIZE > row_size_ ? BUFFER_SIZE / row_size_ * row_size_ : row_size_);
+    used_ = 0;
+    rows_ = 0;
+    return EXIT_SUCCESS;
+}
+
+int NpyWriter::close()
+{
+    if (fd_ < 0)
+        return EXIT_SUCCESS;
+
+    int status = flush();
+    ::close(fd_);
+    fd_ = -1;
+    return status;
+}
+
+int NpyWriter::append(const void *row)
+{
+    return append(row, 1);
+}
+
+int NpyWriter::append(const void *rows, size_t n)
+{
+    if (fd_ < 0)
+        return EXIT_FAILURE;
+
+    const char *p = (const char *) rows;
+    size_t bytes = n * row_size_;
+    while (bytes > 0) {
+        size_t chunk = buffer_.size() - used_;
+        if (chunk > bytes)
+            chunk = bytes;
+        memcpy(&buffer_[used_], p, chunk);
+        used_ += chunk;
+        p += chunk;
+        bytes -= chunk;
+
+        if (used_ == buffer_.size()) {
+            if (write(fd_, buffer_.data(), used_) != (ssize_t) used_) {
+                fprintf(stderr, "ERROR: npy write failed: %s\n", strerror(errno));
+                used_ = 0;
+                return EXIT_FAILURE;
+            }
+            used_ = 0;
+        }
+    }
+    rows_ += n;
+    return EXIT_SUCCESS;
+}
+
+int NpyWriter::flush()
+{
+    if (fd_ < 0)
+        return EXIT_FAILURE;
+
+    int status = EXIT_SUCCESS;
+    if (used_ && write(fd_, buffer_.data(), used_) != (ssize_t) used_)
+        status = EXIT_FAILURE;
+    used_ = 0;
+
+    std::string h = header(rows_);
+    if (pwrite(fd_, h.data(), h.size(), 0) != (ssize_t) h.size())
+        status = EXIT_FAILURE;
+    return status;
+}
+
+bool NpyWriter::isOpen() const
+{
+    return fd_ >= 0;
+}
+
+uint64_t NpyWriter::rows() const
+{
+    return rows_;
+}
+
+size_t NpyWriter::rowSize() const
+{
+    return row_size_;
+}
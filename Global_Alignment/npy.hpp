@@ -0,0 +1,59 @@
+#ifndef _NPY_HPP_
+#define _NPY_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * Streams rows of a structured array into a NumPy .npy file (format 1.0),
+ * so the analysis scripts can
+ *
+ *    a = np.load("run.npy", mmap_mode="r");   a["x0"], a["t_ns"], ...
+ *
+ * without parsing text. The header is written with a fixed-width row
+ * count and patched in place by flush() and close(); a file that was never
+ * closed loads with the rows of the last flush.
+ *
+ * Rows are packed C structs whose members match the fields in order with
+ * no padding (order the members by size).
+ */
+struct NpyField {
+    const char *name;
+    const char *type;       // numpy type string: "<f8", "<i8", "<u4", "<u2", ...
+    int count;              // >1 for a sub-array, e.g. ("v", "<f8", 10)
+};
+
+class NpyWriter {
+    public:
+        NpyWriter();
+        ~NpyWriter();
+
+        int open(const char *path, const NpyField *fields, int n);
+        int close();
+
+        int append(const void *row);
+        int append(const void *rows, size_t n);
+
+        /* Writes the buffered rows and updates the row count in the header */
+        int flush();
+
+        bool isOpen() const;
+        uint64_t rows() const;
+        size_t rowSize() const;
+
+    private:
+        std::string header(uint64_t rows) const;
+
+        int fd_;
+        std::string descr_;
+        size_t row_size_;
+        size_t header_size_;
+        std::vector<char> buffer_;      // allocated once in open()
+        size_t used_;
+        uint64_t rows_;
+};
+
+#endif
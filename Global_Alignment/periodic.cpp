@@ -0,0 +1,224 @@
+#include "periodic.hpp"
+#include "timestamp.hpp"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+PeriodicScheduler::PeriodicScheduler(int threads)
+{
+    stop_fd_ = eventfd(0, EFD_NONBLOCK);
+    running_ = false;
+    stopping_ = false;
+
+    for (int i=0; i<(threads < 1 ? 1 : threads); i++) {
+        Worker *worker = new Worker;
+        worker->index = i;
+        worker->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        worker->epoll_fd = epoll_create1(0);
+        worker->role = RT_CONTROL;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = worker->timer_fd;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->timer_fd, &ev);
+        // Never read while stopping: it wakes every worker
+        ev.data.fd = stop_fd_;
+        epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, stop_fd_, &ev);
+        workers_.push_back(worker);
+    }
+}
+
+PeriodicScheduler::~PeriodicScheduler()
+{
+    stop();
+    for (size_t i=0; i<workers_.size(); i++) {
+        close(workers_[i]->timer_fd);
+        close(workers_[i]->epoll_fd);
+        delete workers_[i];
+    }
+    for (size_t i=0; i<entries_.size(); i++)
+        delete entries_[i];
+    close(stop_fd_);
+}
+
+int PeriodicScheduler::add(const char *name, int64_t period_ns, Task task, OverrunPolicy policy,
+                           int thread, int64_t offset_ns)
+{
+    if (running_) {
+        fprintf(stderr, "ERROR: tasks must be added before PeriodicScheduler::start\n");
+        return -1;
+    }
+    if (thread < 0 || thread >= (int) workers_.size() || period_ns <= 0) {
+        fprintf(stderr, "ERROR: %s: no thread %d or period %lld ns\n", name, thread,
+                (long long) period_ns);
+        return -1;
+    }
+
+    Entry *e = new Entry;
+    e->stats.name = name;
+    e->stats.period_ns = period_ns;
+    e->stats.runs = 0;
+    e->stats.misses = 0;
+    e->stats.skipped = 0;
+    e->task = task;
+    e->policy = policy;
+    e->thread = thread;
+    e->offset_ns = offset_ns;
+    e->release_ns = 0;
+
+    entries_.push_back(e);
+    workers_[thread]->entries.push_back(entries_.size() - 1);
+    return entries_.size() - 1;
+}
+
+void PeriodicScheduler::setRole(int thread, RTRole role)
+{
+    if (thread >= 0 && thread < (int) workers_.size())
+        workers_[thread]->role = role;
+}
+
+int PeriodicScheduler::start()
+{
+    if (running_)
+        return EXIT_SUCCESS;
+
+    uint64_t count;
+    while (read(stop_fd_, &count, sizeof count) == sizeof count);
+    stopping_ = false;
+
+    int64_t t0 = timestampNs();
+    for (size_t i=0; i<entries_.size(); i++)
+        entries_[i]->release_ns = t0 + entries_[i]->offset_ns;
+
+    running_ = true;
+    for (size_t i=0; i<workers_.size(); i++)
+        if (!workers_[i]->entries.empty())
+            workers_[i]->thread = std::thread(&PeriodicScheduler::run, this, workers_[i]);
+    return EXIT_SUCCESS;
+}
+
+int PeriodicScheduler::stop()
+{
+    if (!running_)
+        return EXIT_SUCCESS;
+
+    stopping_ = true;
+    uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof one) != sizeof one)
+        fprintf(stderr, "ERROR: Cannot wake the scheduler threads\n");
+    for (size_t i=0; i<workers_.size(); i++)
+        if (workers_[i]->thread.joinable())
+            workers_[i]->thread.join();
+    running_ = false;
+    return EXIT_SUCCESS;
+}
+
+size_t PeriodicScheduler::tasks() const
+{
+    return entries_.size();
+}
+
+PeriodicTaskStats PeriodicScheduler::stats(int task)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return entries_[task]->stats;
+}
+
+void PeriodicScheduler::run(Worker *worker)
+{
+    char name[16];
+    snprintf(name, sizeof name, "periodic%d", worker->index);
+    rtEnterThread(worker->role, name);
+
+    while (!stopping_) {
+        // Arm for the earliest release
+        int64_t next = INT64_MAX;
+        for (size_t i=0; i<worker->entries.size(); i++)
+            if (entries_[worker->entries[i]]->release_ns < next)
+                next = entries_[worker->entries[i]]->release_ns;
+        struct itimerspec its;
+        memset(&its, 0, sizeof its);
+        its.it_value.tv_sec = next / 1000000000;
+        its.it_value.tv_nsec = next % 1000000000;
+        if (timerfd_settime(worker->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+            fprintf(stderr, "ERROR: timerfd_settime: %s\n", strerror(errno));
+            break;
+        }
+
+        struct epoll_event events[2];
+        int n = epoll_wait(worker->epoll_fd, events, 2, -1);
+        if (n < 0 && errno != EINTR) {
+            fprintf(stderr, "ERROR: epoll_wait: %s\n", strerror(errno));
+            break;
+        }
+        bool quit = false;
+        for (int i=0; i<n; i++)
+            if (events[i].data.fd == stop_fd_)
+                quit = true;
+        if (quit)
+            break;
+
+        uint64_t expirations;
+        if (read(worker->timer_fd, &expirations, sizeof expirations) < 0 && errno != EAGAIN)
+            fprintf(stderr, "ERROR: timerfd read: %s\n", strerror(errno));
+        runDue(worker, timestampNs());
+    }
+}
+
+/* Every due task once per pass, so one catching up cannot starve the others */
+void PeriodicScheduler::runDue(Worker *worker, int64_t now)
+{
+    bool ran = true;
+    while (ran && !stopping_) {
+        ran = false;
+        for (size_t i=0; i<worker->entries.size(); i++) {
+            Entry *e = entries_[worker->entries[i]];
+            if (e->release_ns > now)
+                continue;
+            ran = true;
+
+            int64_t period = e->stats.period_ns;
+            int64_t start = timestampNs();
+            e->task(e->release_ns);
+            int64_t end = timestampNs();
+
+            int64_t next = e->release_ns + period;
+            uint64_t skipped = 0;
+            if (next <= end && e->policy == OVERRUN_SKIP) {
+                skipped = (end - next) / period + 1;
+                next += skipped * period;
+            }
+
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            e->stats.runs++;
+            e->stats.lateness.record(start - e->release_ns);
+            e->stats.exec.record(end - start);
+            if (end > e->release_ns + period)
+                e->stats.misses++;
+            e->stats.skipped += skipped;
+            e->release_ns = next;
+        }
+        now = timestampNs();
+    }
+}
+
+void PeriodicScheduler::printStats(FILE *f, const char *prefix)
+{
+    for (size_t i=0; i<entries_.size(); i++) {
+        PeriodicTaskStats s = stats(i);
+        fprintf(f, "%s%s: %.3f ms runs %llu misses %llu skipped %llu"
+                "  late us p50 %.1f p99 %.1f max %.1f  run us p50 %.1f p99 %.1f max %.1f\n",
+                prefix, s.name.c_str(), s.period_ns * 1e-6, (unsigned long long) s.runs,
+                (unsigned long long) s.misses, (unsigned long long) s.skipped,
+                s.lateness.percentile(50) * 1e-3, s.lateness.percentile(99) * 1e-3,
+                s.lateness.max() * 1e-3, s.exec.percentile(50) * 1e-3, s.exec.percentile(99) * 1e-3,
+                s.exec.max() * 1e-3);
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef _PERIODIC_HPP_
+#define _PERIODIC_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "histogram.hpp"
+#include "rtprofile.hpp"
+
+/*
+ * What to do when a task is still running, or was never woken, past its
+ * next release:
+ *    SKIP       drop the missed releases and keep the phase (polls,
+ *               output: a late sample is only stale)
+ *    CATCH_UP   run the missed releases back to back (integrators,
+ *               anything counting ticks)
+ */
+enum OverrunPolicy {
+    OVERRUN_SKIP = 0,
+    OVERRUN_CATCH_UP = 1
+};
+
+struct PeriodicTaskStats {
+    std::string name;
+    int64_t period_ns;
+    uint64_t runs;
+    uint64_t misses;        // runs that ended after the next release
+    uint64_t skipped;       // releases dropped by OVERRUN_SKIP
+    LogHistogram lateness;  // start of the run after its release [ns]
+    LogHistogram exec;      // duration of the run [ns]
+};
+
+/*
+ * Runs periodic tasks at absolute deadlines, release = start + k * period,
+ * so the rate does not drift with the time the task takes.
+ *
+ * Each thread sleeps on one timerfd armed for the earliest release of its
+ * tasks; tasks due together run in the order they were added. A task
+ * gets its release time, e.g. to stamp what it reads. Threads enter the
+ * RT profile (rtprofile.hpp) as control threads unless told otherwise.
+ */
+class PeriodicScheduler {
+    public:
+        typedef std::function<void(int64_t release_ns)> Task;
+
+        PeriodicScheduler(int threads = 1);
+        ~PeriodicScheduler();
+
+        /*
+         * First release at start() + offset_ns. Returns the task index, or
+         * -1 if running or the thread does not exist.
+         */
+        int add(const char *name, int64_t period_ns, Task task,
+                OverrunPolicy policy = OVERRUN_SKIP, int thread = 0, int64_t offset_ns = 0);
+
+        void setRole(int thread, RTRole role);
+
+        int start();
+        int stop();
+
+        size_t tasks() const;
+        PeriodicTaskStats stats(int task);
+
+        /* One line per task: runs, misses, skipped, lateness and run time */
+        void printStats(FILE *f, const char *prefix = "");
+
+    private:
+        struct Entry {
+            PeriodicTaskStats stats;
+            Task task;
+            OverrunPolicy policy;
+            int thread;
+            int64_t offset_ns;
+            int64_t release_ns;
+        };
+
+        struct Worker {
+            int index;
+            int timer_fd;
+            int epoll_fd;
+            RTRole role;
+            std::vector<int> entries;
+            std::thread thread;
+        };
+
+        void run(Worker *worker);
+        void runDue(Worker *worker, int64_t now);
+
+        std::vector<Entry *> entries_;
+        std::vector<Worker *> workers_;
+        std::mutex stats_mutex_;
+        int stop_fd_;
+        bool running_;
+        std::atomic<bool> stopping_;
+};
+
+#endif
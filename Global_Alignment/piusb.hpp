@@ -1,14 +1,94 @@
 #ifndef PIUSB_H
 #define PIUSB_H
 #include <libusb-1.0/libusb.h>
+#include "histogram.hpp"
+#include "trace.hpp"
+
+#include <stdio.h>
+
+#include <string>
+
+/*
+ * Where the Picard transfers go. The default is the device, through libusb.
+ *
+ *    PIUSB_SIM=1              simulated devices instead (see usbsim.hpp)
+ *    IOTRACE_FILE=<file>      records every transfer as well (see iotrace)
+ *    PIUSB_REPLAY=<file>      answers from a recorded trace instead, with
+ *                             PIUSB_REPLAY_PACED=1 at the recorded pace
+ *
+ * Replay hands out the reads in the order they were recorded; a program
+ * that sends the same commands gets the same answers.
+ */
+class UsbTransport {
+    public:
+        virtual ~UsbTransport() {}
+
+        /* select: NULL, "index:<n>", "path:<bus-port.port>" or "serial:<string>" */
+        virtual int open(int vid, int pid, const char *select) = 0;
+        virtual int close() = 0;
+        /* EXIT_SUCCESS only for a whole transfer; *count is what got through */
+        virtual int write(unsigned char *data, int length, int *count) = 0;
+        virtual int read (unsigned char *data, int length, int *count) = 0;
+        /* Serial number of the open device, its bus path if it has none */
+        virtual std::string serial() const = 0;
+};
+
+/*
+ * While one of these is alive every open reuses a single listing of the
+ * bus instead of enumerating it again (see openMotors)
+ */
+class UsbEnumeration {
+    public:
+        UsbEnumeration();
+        ~UsbEnumeration();
+
+    private:
+        bool context_;      // usbContext() succeeded: release it
+};
+
+/* Replay totals of every device so far (zero when not replaying) */
+ReplayStats usbReplayStats();
+
+/* Transfers in one direction of one device */
+struct UsbDirectionStats {
+    uint64_t transfers;
+    uint64_t bytes;             // bytes that got through
+    uint64_t failures;          // transfers that did not complete
+    uint64_t short_transfers;   // failures that moved some but not all bytes
+    LogHistogram latency;       // ns per transfer, failures included
+};
+
+struct UsbStats {
+    int vid;
+    int pid;
+    UsbDirectionStats write;
+    UsbDirectionStats read;
+};
+
+/*
+ * Counters, percentiles and (with histogram) the latency buckets. Every
+ * Picard prints its own to stderr on usbClose() with PIUSB_STATS=1.
+ */
+void printUsbStats(FILE *f, const UsbStats &stats, bool histogram = false);
+
 /*
  * Methods common to the Picard USB Communications
  * devices
  */
 class Picard {
     public:
-        /* Opens a USB device with the given vid/pid */
-        int usbOpen(int vid, int pid);
+        Picard();
+        virtual ~Picard();
+
+        /*
+         * Opens a USB device with the given vid/pid. Of several identical
+         * devices select picks one (see UsbTransport::open), NULL the first
+         * in bus path order.
+         */
+        int usbOpen(int vid, int pid, const char *select = NULL);
+        bool isOpen() const;
+        /* "vid:pid/serial" of the open device, stable across sessions */
+        std::string usbId() const;
         /* Detach and close the USB device handle */
         int usbClose();
 
@@ -17,15 +97,25 @@ class Picard {
         /* Reads a USB Bulk Data Transfer */
         int usbRead (unsigned char *data, int length);
 
+        /* Transfer counters and latencies since usbOpen() or the last reset */
+        UsbStats usbStats() const;
+        void resetUsbStats();
+
     private:
-        libusb_device_handle *dev_handle;
-        libusb_context *ctx;
+        UsbTransport *transport_;
+        bool open_;
+        UsbStats stats_;
 };
 
+/* Travel of the USB-MO in steps; Motor::setPosition() refuses anything beyond it */
+#define MOTOR_MIN_POSITION  0
+#define MOTOR_MAX_POSITION  2100
+
 /* Class for USB-MO Linear Motor */
 class Motor : public Picard {
     public:
-        Motor();
+        /* select: which of several USB-MOs (see Picard::usbOpen) */
+        Motor(const char *select = NULL);
         ~Motor();
 
         /* Sets motor stepping velocity in units from 1-10
@@ -46,10 +136,14 @@ class Motor : public Picard {
          */
         int setVelocity(int velocity);
 
-        /* Sends the stepper motor to the given position (0-1900) */
+        /* Time per step at the given velocity (table above), 0 if out of range */
+        static int stepPeriodMs(int velocity);
+
+        /* Sends the stepper motor to the given position (MOTOR_MIN_POSITION-MOTOR_MAX_POSITION).
+         * EXIT_FAILURE, without moving, if it is out of range */
         int setPosition(int position);
 
-        /* Returns the stepper motor position (0-1900) */
+        /* Returns the stepper motor position */
         int getPosition();
 
         /* Retracts the motor until it hits the hall-sensed home position and
@@ -64,6 +158,14 @@ class Motor : public Picard {
         static const int product_id = 0x0020;
 };
 
+/*
+ * Opens n USB-MO legs at once: the bus is listed once and every leg is
+ * opened and claimed on its own thread. select[i] picks leg i (select or
+ * select[i] NULL: "index:i"). Returns the number opened; legs[i] is NULL
+ * for those that failed.
+ */
+int openMotors(int n, const char *const *select, Motor **legs);
+
 /* Class for USB-Twister II Rotary Motor */
 class Twister : public Picard {
     public:
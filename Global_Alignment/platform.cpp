@@ -0,0 +1,401 @@
+#include "platform.hpp"
+#include "devlog.hpp"
+#include "rtprofile.hpp"
+#include "timestamp.hpp"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <thread>
+
+/*
+ * MoveLimiter
+ */
+
+/* Time the calling thread spent in acquire(), for the axis timings */
+static thread_local int64_t waited_ns = 0;
+
+MoveLimiter::MoveLimiter(int max)
+{
+    max_ = max;
+    moving_ = 0;
+}
+
+void MoveLimiter::setMax(int max)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_ = max;
+    cond_.notify_all();
+}
+
+void MoveLimiter::acquire()
+{
+    int64_t t = timestampNs();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (max_ > 0 && moving_ >= max_)
+        cond_.wait(lock);
+    moving_++;
+    waited_ns += timestampNs() - t;
+}
+
+void MoveLimiter::release()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    moving_--;
+    cond_.notify_one();
+}
+
+/* setPosition as one limited move, recorded in the state cache */
+template <class Device>
+static void move(Device *device, int position, int velocity, MoveLimiter *limit, StateCache *state)
+{
+    if (state)
+        state->commanded(device->usbId(), position, velocity);
+    if (limit)
+        limit->acquire();
+    device->setPosition(position);
+    if (limit)
+        limit->release();
+    if (state)
+        state->confirmed(device->usbId(), position);
+}
+
+int calibrateMirror(Motor *mirror, MoveLimiter *limit, StateCache *state)
+{
+    if (!mirror->isOpen())
+        return EXIT_FAILURE;
+    if (state && state->verify(mirror->usbId(), mirror->getPosition())) {
+        DEVLOG_INFO("{} calibrated in an earlier run", mirror->usbId());
+        return EXIT_SUCCESS;
+    }
+    mirror->setVelocity(MIRROR_CALIBRATE_VELOCITY);
+    move(mirror, MIRROR_CALIBRATE_STROKE, MIRROR_CALIBRATE_VELOCITY, limit, state);
+    move(mirror, 0, MIRROR_CALIBRATE_VELOCITY, limit, state);
+    move(mirror, MIRROR_PARK_POSITION, MIRROR_CALIBRATE_VELOCITY, limit, state);
+    if (state)
+        state->confirmed(mirror->usbId(), MIRROR_PARK_POSITION, true);
+    return EXIT_SUCCESS;
+}
+
+int calibrateShutter(Twister *shutter, MoveLimiter *limit, StateCache *state)
+{
+    if (!shutter->isOpen())
+        return EXIT_FAILURE;
+    if (state && state->verify(shutter->usbId(), shutter->getPosition())) {
+        DEVLOG_INFO("{} calibrated in an earlier run", shutter->usbId());
+        return EXIT_SUCCESS;
+    }
+    shutter->setVelocity(SHUTTER_CALIBRATE_VELOCITY);
+    move(shutter, SHUTTER_CALIBRATE_POSITION, SHUTTER_CALIBRATE_VELOCITY, limit, state);
+    shutter->setZero();
+    move(shutter, SHUTTER_PARK_POSITION, SHUTTER_CALIBRATE_VELOCITY, limit, state);
+    if (state)
+        state->confirmed(shutter->usbId(), SHUTTER_PARK_POSITION, true);
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Synchronized moves
+ */
+
+#define FASTEST_VELOCITY    10
+#define LEG_SEGMENTS        8
+#define LEG_SEGMENT_HOLD_NS 20000000LL
+
+int64_t planLegMoves(int n, const int *from, const int *to, LegMove *moves)
+{
+    int64_t longest = 0;
+    for (int i=0; i<n; i++)
+        if (abs(to[i] - from[i]) > longest)
+            longest = abs(to[i] - from[i]);
+    int64_t total = longest * Motor::stepPeriodMs(FASTEST_VELOCITY) * 1000000;
+
+    for (int i=0; i<n; i++) {
+        LegMove &m = moves[i];
+        int64_t steps = abs(to[i] - from[i]);
+        m.from = from[i];
+        m.to = to[i];
+        m.velocity = 0;
+        m.segments = 0;
+        m.delay_ns = 0;
+        m.predicted_ns = 0;
+        m.actual_ns = 0;
+        if (steps == 0)
+            continue;
+
+        // Slowest velocity (longest step) that does not arrive late
+        for (int v=1; v<=FASTEST_VELOCITY; v++)
+            if (steps * Motor::stepPeriodMs(v) * 1000000 <= total) {
+                m.velocity = v;
+                break;
+            }
+        int64_t run = steps * Motor::stepPeriodMs(m.velocity) * 1000000;
+        m.delay_ns = total - run;
+        // Each segment costs a command and a stop: only where it holds back enough
+        int64_t segments = m.delay_ns / LEG_SEGMENT_HOLD_NS;
+        if (segments > LEG_SEGMENTS) segments = LEG_SEGMENTS;
+        if (segments > steps) segments = steps;
+        m.segments = segments > 1 ? segments : 1;
+        m.predicted_ns = total;
+    }
+    return total;
+}
+
+void printLegMoves(FILE *f, const std::vector<LegMove> &moves)
+{
+    int64_t first = INT64_MAX, last = 0, worst = 0;
+    fprintf(f, "%4s %6s %6s %8s %8s %10s %12s %10s %10s\n", "leg", "from", "to", "velocity",
+            "segments", "delay ms", "predicted ms", "actual ms", "error ms");
+    for (size_t i=0; i<moves.size(); i++) {
+        const LegMove &m = moves[i];
+        if (m.velocity == 0) {
+            fprintf(f, "%4zu %6d %6d %8s\n", i, m.from, m.to, "-");
+            continue;
+        }
+        int64_t error = m.actual_ns - m.predicted_ns;
+        fprintf(f, "%4zu %6d %6d %8d %8d %10.1f %12.1f %10.1f %+10.1f\n", i, m.from, m.to,
+                m.velocity, m.segments, m.delay_ns * 1e-6, m.predicted_ns * 1e-6, m.actual_ns * 1e-6,
+                error * 1e-6);
+        if (m.actual_ns < first) first = m.actual_ns;
+        if (m.actual_ns > last) last = m.actual_ns;
+        if (llabs(error) > worst) worst = llabs(error);
+    }
+    if (last > 0)
+        fprintf(f, "arrivals within %.1f ms, worst prediction error %.1f ms\n",
+                (last - first) * 1e-6, worst * 1e-6);
+}
+
+/*
+ * Platform
+ */
+
+Platform::Platform(int max_moves) : limiter_(max_moves)
+{
+    mirror_ = NULL;
+    shutter_ = NULL;
+    state_ = NULL;
+    total_ns_ = 0;
+}
+
+Platform::~Platform()
+{
+    for (size_t i=0; i<legs_.size(); i++)
+        delete legs_[i];
+    delete mirror_;
+    delete shutter_;
+}
+
+int Platform::addLegs(int n, const char *const *select)
+{
+    std::vector<Motor *> legs(n);
+    int opened = openMotors(n, select, legs.data());
+    // A leg that did not open keeps its slot, so leg i is still target i
+    for (int i=0; i<n; i++) {
+        if (!legs[i])
+            DEVLOG_ERROR("Leg {} did not open", i);
+        legs_.push_back(legs[i]);
+    }
+    return opened;
+}
+
+int Platform::addMirror(const char *select)
+{
+    delete mirror_;
+    mirror_ = new Motor(select);
+    return mirror_->isOpen() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int Platform::addShutter()
+{
+    delete shutter_;
+    shutter_ = new Twister;
+    return shutter_->isOpen() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int Platform::legs() const
+{
+    return legs_.size();
+}
+
+Motor *Platform::leg(int i)
+{
+    return legs_[i];
+}
+
+Motor *Platform::mirror()
+{
+    return mirror_;
+}
+
+Twister *Platform::shutter()
+{
+    return shutter_;
+}
+
+void Platform::setMaxMoves(int n)
+{
+    limiter_.setMax(n);
+}
+
+MoveLimiter *Platform::limiter()
+{
+    return &limiter_;
+}
+
+void Platform::setStateCache(StateCache *state)
+{
+    state_ = state;
+}
+
+void Platform::runAxis(size_t axis)
+{
+    rtEnterThread(RT_CONTROL, "home");
+    AxisTiming &t = timings_[axis];
+    t.start_ns = timestampNs();
+    waited_ns = 0;
+
+    if (axis < legs_.size()) {
+        // Homing resets the leg's counter: calibrated wherever it was
+        Motor *leg = legs_[axis];
+        if (!leg) {
+            t.end_ns = timestampNs();
+            DEVLOG_ERROR("{} is not open", t.name);
+            return;
+        }
+        if (state_)
+            state_->commanded(leg->usbId(), 0, 0);
+        limiter_.acquire();
+        t.status = leg->goHome();
+        limiter_.release();
+        if (state_ && t.status == EXIT_SUCCESS)
+            state_->confirmed(leg->usbId(), 0, true);
+    }
+    else if (t.name == "mirror")
+        t.status = calibrateMirror(mirror_, &limiter_, state_);
+    else
+        t.status = calibrateShutter(shutter_, &limiter_, state_);
+
+    t.end_ns = timestampNs();
+    t.wait_ns = waited_ns;
+    DEVLOG_INFO("{} ready in {:.3f} s", t.name, (t.end_ns - t.start_ns) * 1e-9);
+}
+
+void Platform::runLeg(size_t i, LegMove *move, int64_t start)
+{
+    rtEnterThread(RT_CONTROL, "leg");
+    int k = move->segments;
+    int64_t step_ns = Motor::stepPeriodMs(move->velocity) * 1000000LL;
+    int position = move->from;
+    for (int s=0; s<k; s++) {
+        // Segment s has 1/k of the time and ends with it
+        int next = move->from + (move->to - move->from) * (s + 1) / k;
+        int64_t at = start + (s + 1) * move->predicted_ns / k - abs(next - position) * step_ns;
+        struct timespec ts = { (time_t) (at / 1000000000), (long) (at % 1000000000) };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+
+        if (legs_[i]->setPosition(next) != EXIT_SUCCESS)
+            break;
+        position = next;
+    }
+    move->actual_ns = timestampNs() - start;
+    if (state_)
+        state_->confirmed(legs_[i]->usbId(), move->to);
+}
+
+int Platform::moveLegs(const int *targets, std::vector<LegMove> *moves)
+{
+    size_t n = legs_.size();
+    for (size_t i=0; i<n; i++)
+        if (!legs_[i]) {
+            DEVLOG_ERROR("Leg {} is not open, not moving the legs", i);
+            return EXIT_FAILURE;
+        }
+    std::vector<int> from(n);
+    for (size_t i=0; i<n; i++)
+        from[i] = legs_[i]->getPosition();
+
+    moves->resize(n);
+    planLegMoves(n, from.data(), targets, moves->data());
+
+    // Velocities go out first so the start only costs the position writes
+    for (size_t i=0; i<n; i++)
+        if ((*moves)[i].velocity) {
+            legs_[i]->setVelocity((*moves)[i].velocity);
+            if (state_)
+                state_->commanded(legs_[i]->usbId(), targets[i], (*moves)[i].velocity);
+        }
+
+    int64_t start = timestampNs();
+    std::vector<std::thread> threads;
+    for (size_t i=0; i<n; i++)
+        if ((*moves)[i].velocity)
+            threads.push_back(std::thread(&Platform::runLeg, this, i, &(*moves)[i], start));
+    for (size_t i=0; i<threads.size(); i++)
+        threads[i].join();
+
+    for (size_t i=0; i<n; i++)
+        if (legs_[i]->getPosition() != targets[i])
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+int Platform::bringUp()
+{
+    timings_.clear();
+    for (size_t i=0; i<legs_.size(); i++) {
+        AxisTiming t = { "leg" + std::to_string(i), 0, 0, 0, EXIT_FAILURE };
+        timings_.push_back(t);
+    }
+    if (mirror_) {
+        AxisTiming t = { "mirror", 0, 0, 0, EXIT_FAILURE };
+        timings_.push_back(t);
+    }
+    if (shutter_) {
+        AxisTiming t = { "shutter", 0, 0, 0, EXIT_FAILURE };
+        timings_.push_back(t);
+    }
+
+    int64_t start = timestampNs();
+    std::vector<std::thread> threads;
+    for (size_t i=0; i<timings_.size(); i++)
+        threads.push_back(std::thread(&Platform::runAxis, this, i));
+    for (size_t i=0; i<threads.size(); i++)
+        threads[i].join();
+    total_ns_ = timestampNs() - start;
+
+    for (size_t i=0; i<timings_.size(); i++)
+        if (timings_[i].status != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+const std::vector<AxisTiming> &Platform::timings() const
+{
+    return timings_;
+}
+
+int64_t Platform::totalNs() const
+{
+    return total_ns_;
+}
+
+void Platform::printTimings(FILE *f) const
+{
+    int64_t start = timings_.empty() ? 0 : timings_[0].start_ns;
+    for (size_t i=0; i<timings_.size(); i++)
+        if (timings_[i].start_ns < start)
+            start = timings_[i].start_ns;
+
+    // Moving time of every axis added up is what bringing them up one by one costs
+    double sum = 0;
+    for (size_t i=0; i<timings_.size(); i++) {
+        const AxisTiming &t = timings_[i];
+        double seconds = (t.end_ns - t.start_ns - t.wait_ns) * 1e-9;
+        sum += seconds;
+        fprintf(f, "%-8s %8.3f s moving %8.3f s waiting   (done at %.3f s)%s\n", t.name.c_str(),
+                seconds, t.wait_ns * 1e-9, (t.end_ns - start) * 1e-9,
+                t.status == EXIT_SUCCESS ? "" : "   FAILED");
+    }
+    fprintf(f, "%-8s %8.3f s   (%.3f s one after the other)\n", "total", total_ns_ * 1e-9, sum);
+}
@@ -0,0 +1,152 @@
+#ifndef _PLATFORM_HPP_
+#define _PLATFORM_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "piusb.hpp"
+#include "statecache.hpp"
+
+/* Calibration strokes used by align */
+#define MIRROR_CALIBRATE_STROKE     MOTOR_MAX_POSITION
+#define MIRROR_CALIBRATE_VELOCITY   10
+#define SHUTTER_CALIBRATE_POSITION  -350
+#define SHUTTER_CALIBRATE_VELOCITY  1
+
+/* Where calibration leaves them: off POWER_ON_POSITION, so a restart can tell */
+#define MIRROR_PARK_POSITION        1
+#define SHUTTER_PARK_POSITION       1
+
+/*
+ * Caps the number of actuators moving at once (power budget). Every move
+ * is bracketed by acquire()/release(); max <= 0 means no limit.
+ */
+class MoveLimiter {
+    public:
+        MoveLimiter(int max = 0);
+
+        void setMax(int max);
+        void acquire();
+        void release();
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        int max_;
+        int moving_;
+};
+
+/*
+ * Runs the mirror out to the end of its stroke and back to 0. With a
+ * state cache the moves are recorded, and a mirror that verifies (see
+ * StateCache::verify) is left where it is.
+ */
+int calibrateMirror(Motor *mirror, MoveLimiter *limit = NULL, StateCache *state = NULL);
+
+/* Drives the shutter against its stop and makes that position zero; state as above */
+int calibrateShutter(Twister *shutter, MoveLimiter *limit = NULL, StateCache *state = NULL);
+
+/* One leg of a synchronized pose change */
+struct LegMove {
+    int from;
+    int to;
+    int velocity;           // Motor::setVelocity code, 0: the leg stays
+    int segments;           // the move is split into this many equal steps
+    int64_t delay_ns;       // held back in all, spread over the segments
+    int64_t predicted_ns;   // arrival, from the start of the move
+    int64_t actual_ns;      // measured by Platform::moveLegs
+};
+
+/*
+ * Plans a pose change of n legs for the least wall time with every leg
+ * arriving together: the longest run sets the time at velocity 10, every
+ * other leg gets the slowest code that still makes it.
+ *
+ * The codes only span 3-13 ms per step, so a shorter leg cannot simply
+ * run slower from a common start. Its move is split into up to 8 equal
+ * segments (one per 20 ms left over), each held back by its share of it
+ * and ending on time: at the end of each segment the leg is where a
+ * proportional move would be, and in between lags it by at most one
+ * segment's hold. Returns the predicted time of the move in ns.
+ */
+int64_t planLegMoves(int n, const int *from, const int *to, LegMove *moves);
+
+/* Per leg plan against the measured arrival, and the arrival spread */
+void printLegMoves(FILE *f, const std::vector<LegMove> &moves);
+
+struct AxisTiming {
+    std::string name;       // "leg0".., "mirror", "shutter"
+    int64_t start_ns;       // timestampNs() at the start of bringUp
+    int64_t end_ns;
+    int64_t wait_ns;        // time held back by the move limit
+    int status;
+};
+
+/*
+ * The actuators of the rig: the USB-MO legs, the alignment mirror (also a
+ * USB-MO) and the shutter Twister. Devices belong to the platform.
+ */
+class Platform {
+    public:
+        Platform(int max_moves = 0);
+        ~Platform();
+
+        /*
+         * Opens n legs concurrently (see openMotors). Returns the number
+         * opened; a leg that failed stays as a NULL leg(i), and moveLegs()
+         * refuses to move until every leg is there
+         */
+        int addLegs(int n, const char *const *select = NULL);
+        int addMirror(const char *select = NULL);
+        int addShutter();
+
+        int legs() const;
+        Motor *leg(int i);
+        Motor *mirror();
+        Twister *shutter();
+
+        /* Moves allowed at once from now on (0: all) */
+        void setMaxMoves(int n);
+        MoveLimiter *limiter();
+
+        /* Records every move in state, and skips calibrations it verifies */
+        void setStateCache(StateCache *state);
+
+        /*
+         * Moves leg i to targets[i] with planLegMoves, one thread per leg,
+         * and measures the arrivals into moves. Not subject to the move
+         * limit: the point is that all legs move at once.
+         */
+        int moveLegs(const int *targets, std::vector<LegMove> *moves);
+
+        /*
+         * Homes every leg and calibrates the mirror and shutter, one thread
+         * per axis, never more than max moves at once. EXIT_FAILURE if an
+         * axis failed.
+         */
+        int bringUp();
+
+        const std::vector<AxisTiming> &timings() const;
+        int64_t totalNs() const;
+        void printTimings(FILE *f) const;
+
+    private:
+        void runAxis(size_t axis);
+        void runLeg(size_t i, LegMove *move, int64_t start);
+
+        std::vector<Motor *> legs_;
+        Motor *mirror_;
+        Twister *shutter_;
+        MoveLimiter limiter_;
+        StateCache *state_;
+
+        std::vector<AxisTiming> timings_;
+        int64_t total_ns_;
+};
+
+#endif
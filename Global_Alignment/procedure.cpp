@@ -0,0 +1,208 @@
+#include "procedure.hpp"
+#include "devlog.hpp"
+#include "timestamp.hpp"
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <thread>
+
+Procedure::Procedure()
+{
+    running_ = 0;
+    start_ns_ = 0;
+    wall_ns_ = 0;
+}
+
+int Procedure::add(const std::string &name, const std::vector<std::string> &resources,
+                   const std::vector<std::string> &after, std::function<int()> run)
+{
+    Step s;
+    s.name = name;
+    s.resources = resources;
+    s.run = run;
+    for (size_t i=0; i<after.size(); i++) {
+        size_t j = 0;
+        while (j < steps_.size() && steps_[j].name != after[i])
+            j++;
+        if (j == steps_.size()) {
+            DEVLOG_ERROR("Step {} comes after {}, which is not an earlier step", name, after[i]);
+            return -1;
+        }
+        s.after.push_back(j);
+    }
+    steps_.push_back(s);
+    return steps_.size() - 1;
+}
+
+bool Procedure::resourcesFree(const Step &s) const
+{
+    for (size_t i=0; i<s.resources.size(); i++)
+        if (std::find(busy_.begin(), busy_.end(), s.resources[i]) != busy_.end())
+            return false;
+    return true;
+}
+
+void Procedure::runStep(int i)
+{
+    int status = steps_[i].run();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    Step &s = steps_[i];
+    s.status = status;
+    s.end_ns = timestampNs();
+    s.state = 2;
+    for (size_t r=0; r<s.resources.size(); r++)
+        busy_.erase(std::find(busy_.begin(), busy_.end(), s.resources[r]));
+    running_--;
+    if (status != EXIT_SUCCESS)
+        DEVLOG_ERROR("Step {} failed", s.name);
+    cond_.notify_all();
+}
+
+int Procedure::run(bool concurrent)
+{
+    for (size_t i=0; i<steps_.size(); i++) {
+        Step &s = steps_[i];
+        s.state = 0;
+        s.status = EXIT_FAILURE;
+        s.ready_ns = s.start_ns = s.end_ns = 0;
+    }
+    busy_.clear();
+    running_ = 0;
+
+    std::vector<std::thread> threads;
+    start_ns_ = timestampNs();
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        size_t done = 0;
+        bool progress = false;
+        for (size_t i=0; i<steps_.size(); i++) {
+            Step &s = steps_[i];
+            if (s.state == 2) {
+                done++;
+                continue;
+            }
+            if (s.state == 1) {
+                if (!concurrent)
+                    break;
+                continue;
+            }
+
+            bool ready = true, failed = false;
+            for (size_t a=0; a<s.after.size(); a++) {
+                const Step &before = steps_[s.after[a]];
+                if (before.state != 2)
+                    ready = false;
+                else if (before.status != EXIT_SUCCESS)
+                    failed = true;
+            }
+            if (!ready) {
+                if (!concurrent)
+                    break;
+                continue;
+            }
+
+            int64_t now = timestampNs();
+            if (s.ready_ns == 0)
+                s.ready_ns = now;
+            if (failed) {
+                s.state = 2;
+                s.status = STEP_SKIPPED;
+                s.start_ns = s.end_ns = now;
+                done++;
+                progress = true;
+                continue;
+            }
+            if (!resourcesFree(s) || (!concurrent && running_ > 0)) {
+                if (!concurrent)
+                    break;
+                continue;
+            }
+
+            s.state = 1;
+            s.start_ns = now;
+            busy_.insert(busy_.end(), s.resources.begin(), s.resources.end());
+            running_++;
+            threads.push_back(std::thread(&Procedure::runStep, this, i));
+            progress = true;
+            if (!concurrent)
+                break;
+        }
+        if (done == steps_.size())
+            break;
+        if (!progress)
+            cond_.wait(lock);
+    }
+    lock.unlock();
+
+    for (size_t i=0; i<threads.size(); i++)
+        threads[i].join();
+    wall_ns_ = timestampNs() - start_ns_;
+
+    for (size_t i=0; i<steps_.size(); i++)
+        if (steps_[i].status != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+std::vector<int> Procedure::criticalPath() const
+{
+    std::vector<int64_t> length(steps_.size());
+    std::vector<int> previous(steps_.size(), -1);
+    int last = -1;
+    for (size_t i=0; i<steps_.size(); i++) {
+        const Step &s = steps_[i];
+        int64_t before = 0;
+        for (size_t a=0; a<s.after.size(); a++)
+            if (length[s.after[a]] > before) {
+                before = length[s.after[a]];
+                previous[i] = s.after[a];
+            }
+        length[i] = before + (s.end_ns - s.start_ns);
+        if (last < 0 || length[i] > length[last])
+            last = i;
+    }
+
+    std::vector<int> path;
+    for (int i = last; i >= 0; i = previous[i])
+        path.insert(path.begin(), i);
+    return path;
+}
+
+int64_t Procedure::criticalPathNs() const
+{
+    std::vector<int> path = criticalPath();
+    int64_t ns = 0;
+    for (size_t i=0; i<path.size(); i++)
+        ns += steps_[path[i]].end_ns - steps_[path[i]].start_ns;
+    return ns;
+}
+
+int64_t Procedure::wallNs() const
+{
+    return wall_ns_;
+}
+
+void Procedure::printReport(FILE *f) const
+{
+    std::vector<int> path = criticalPath();
+
+    int64_t sum = 0;
+    fprintf(f, "  %-24s %10s %10s %10s\n", "step", "ready ms", "wait ms", "run ms");
+    for (size_t i=0; i<steps_.size(); i++) {
+        const Step &s = steps_[i];
+        bool critical = std::find(path.begin(), path.end(), (int) i) != path.end();
+        sum += s.end_ns - s.start_ns;
+        fprintf(f, "%c %-24s %10.1f %10.1f %10.1f %s\n", critical ? '*' : ' ', s.name.c_str(),
+                (s.ready_ns - start_ns_) * 1e-6, (s.start_ns - s.ready_ns) * 1e-6,
+                (s.end_ns - s.start_ns) * 1e-6,
+                s.status == EXIT_SUCCESS ? "" : s.status == STEP_SKIPPED ? "skipped" : "FAILED");
+    }
+
+    fprintf(f, "critical path:");
+    for (size_t i=0; i<path.size(); i++)
+        fprintf(f, "%s %s", i ? " >" : "", steps_[path[i]].name.c_str());
+    fprintf(f, "\n%.1f ms critical path, %.1f ms wall, %.1f ms one step after the other\n",
+            criticalPathNs() * 1e-6, wall_ns_ * 1e-6, sum * 1e-6);
+}
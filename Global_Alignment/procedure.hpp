@@ -0,0 +1,80 @@
+#ifndef _PROCEDURE_HPP_
+#define _PROCEDURE_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define STEP_SKIPPED    -1      // a step it comes after failed
+
+/*
+ * A procedure of device operations as a DAG. A step names the resources
+ * (devices) it uses and the earlier steps it must come after; run()
+ * starts every step on its own thread as soon as those steps are done
+ * and none of its resources is in use, so independent devices work at
+ * the same time. Steps after a failed one are skipped.
+ *
+ * Steps can only come after steps added before them, so there are no
+ * cycles.
+ */
+class Procedure {
+    public:
+        Procedure();
+
+        /* Index of the step, -1 if after names an unknown step */
+        int add(const std::string &name, const std::vector<std::string> &resources,
+                const std::vector<std::string> &after, std::function<int()> run);
+
+        /*
+         * Runs the steps; concurrent false runs one at a time in the
+         * order they were added, for comparison. EXIT_FAILURE if a step
+         * failed or was skipped.
+         */
+        int run(bool concurrent = true);
+
+        /*
+         * Per step: when it could have started, the wait for resources,
+         * run time and status; then the critical path (longest chain of
+         * run times through the after edges) against the wall time and
+         * the steps one after the other.
+         */
+        void printReport(FILE *f) const;
+
+        int64_t wallNs() const;
+        int64_t criticalPathNs() const;
+
+    private:
+        struct Step {
+            std::string name;
+            std::vector<std::string> resources;
+            std::vector<int> after;
+            std::function<int()> run;
+
+            int state;          // 0 waiting, 1 running, 2 done
+            int status;
+            int64_t ready_ns;   // the steps it comes after were done
+            int64_t start_ns;
+            int64_t end_ns;
+        };
+
+        void runStep(int i);
+        bool resourcesFree(const Step &s) const;
+        std::vector<int> criticalPath() const;
+
+        std::vector<Step> steps_;
+        std::vector<std::string> busy_;
+
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        int running_;
+
+        int64_t start_ns_;
+        int64_t wall_ns_;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef _LIBPSD_HPP_
+#define _LIBPSD_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class DriftModel;
+
+/*
+ * Centroid calibration of one two-channel PSD board.
+ *
+ *    x = (x_raw - betax) * alphax_{neg,pos}
+ *    y = (y_raw - betay) * alphay_{neg,pos}
+ *
+ * Files hold one "name value0 value1" line per coefficient, e.g.
+ *    alphax_neg -9.909807 -9.794860
+ */
+struct PSDCalibration {
+    double alphax_neg[2];
+    double alphax_pos[2];
+    double alphay_neg[2];
+    double alphay_pos[2];
+    double betax[2];
+    double betay[2];
+
+    /* Unit gains, zero offsets */
+    static PSDCalibration identity();
+    /* BOARD #1, TARGET #122 (the constants M2PSD.c was built with) */
+    static PSDCalibration board1();
+
+    int load(const char *path);
+    int save(const char *path) const;
+
+    void apply(double x[2], double y[2]) const;
+};
+
+/* One timestamped reading of a PSD board */
+struct PSDSample {
+    int64_t  t_ns;          // timestampNs() when the line came off the tty
+    uint32_t board;         // index of the board in its PSDHub
+    uint32_t seq;           // per-board line counter
+    double   x[2];          // calibrated centroids
+    double   y[2];
+    double   sigma[4];      // sigma_x0, sigma_y0, sigma_x1, sigma_y1 (0 if not sent)
+    double   temperature;   // always the last column of the line
+};
+
+/*
+ * Parses "x0 y0 x1 y1 [sx0 sy0 sx1 sy1] temperature".
+ * Returns the number of columns read, or -1 if the line is not a sample.
+ */
+int parsePSDLine(const char *line, PSDSample *sample);
+
+/*
+ * Shared sample bus.
+ *
+ * A fixed-size broadcast ring: the hub is the only writer, every reader
+ * keeps its own cursor. A reader that falls more than the capacity behind
+ * skips the overwritten samples and is told how many it lost.
+ */
+class PSDBus {
+    public:
+        /* Capacity is rounded up to a power of two */
+        PSDBus(size_t capacity = 65536);
+
+        void push(const PSDSample &sample);
+
+        /* Copies up to max samples past *cursor into out and advances it */
+        size_t read(uint64_t *cursor, PSDSample *out, size_t max, uint64_t *lost = NULL);
+
+        /* Waits until a sample past cursor exists. false on timeout */
+        bool wait(uint64_t cursor, int timeout_ms);
+
+        /* Sequence number of the next sample to be pushed */
+        uint64_t head();
+
+    private:
+        std::vector<PSDSample> ring_;
+        size_t mask_;
+        uint64_t head_;
+        std::mutex mutex_;
+        std::condition_variable cond_;
+};
+
+struct PSDBoardStats {
+    uint64_t samples;       // lines parsed and pushed to the bus
+    uint64_t bytes;         // raw bytes read from the tty
+    uint64_t drops;         // lines discarded (garbled or longer than a line buffer)
+    uint64_t read_errors;   // failed read() calls
+    double   rate_hz;       // sample rate over the last second
+    int64_t  last_t_ns;     // timestamp of the newest sample
+};
+
+/*
+ * Streams any number of PSD boards from a single epoll thread into a PSDBus.
+ */
+class PSDHub {
+    public:
+        PSDHub(PSDBus *bus);
+        ~PSDHub();
+
+        /* Opens and configures a tty (115200 8n1, raw). Returns the board index or -1 */
+        int addBoard(const char *path, const PSDCalibration &cal);
+
+        /* Adopts an already configured fd (pty, pipe). Returns the board index or -1 */
+        int addFD(int fd, const char *name, const PSDCalibration &cal);
+
+        /*
+         * Opens every device matching pattern. The calibration for /dev/ttyACMn
+         * is read from <caldir>/ttyACMn.cal; boards without one are left raw.
+         * Returns the number of boards opened.
+         */
+        int discover(const char *pattern = "/dev/ttyACM*", const char *caldir = NULL);
+
+        /*
+         * Temperature-drift compensation of the calibrated centroids, channels
+         * "<tty>.x0", "<tty>.y0", ... Learn only while the beam is parked.
+         * The model belongs to the hub thread until stop().
+         */
+        void setDriftModel(DriftModel *model, bool learn);
+
+        int start();
+        int stop();
+
+        size_t boards() const;
+        const char *boardName(int board) const;
+        PSDBoardStats stats(int board);
+
+        /* CPU time spent in the hub thread so far */
+        int64_t loopCpuNs() const;
+
+    private:
+        struct Board;
+
+        void run();
+        void readBoard(Board *board);
+        void compensate(Board *board, PSDSample *sample);
+        void updateRates(int64_t now);
+
+        PSDBus *bus_;
+        DriftModel *drift_;
+        bool drift_learn_;
+        std::vector<Board *> boards_;
+        std::mutex stats_mutex_;
+        std::thread thread_;
+        int epoll_fd_;
+        int stop_fd_;
+        bool running_;
+        int64_t rate_t_ns_;
+        volatile int64_t loop_cpu_ns_;
+};
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ * Scaling benchmark for PSDHub.
+ *
+ * Each emulated board is a pseudo terminal fed by its own thread at a fixed
+ * line rate. The send time rides in the sigma_x0 column so the reader can
+ * measure tty -> bus latency.
+ *
+ *   psdbench [max boards] [rate per board, Hz] [seconds per step]
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "psd.hpp"
+#include "timestamp.hpp"
+
+static std::atomic<bool> running;
+
+static void emulateBoard(int fd, int rate_hz, int64_t t0)
+{
+    int64_t period = 1000000000LL / rate_hz;
+    int64_t next = timestampNs();
+    char line[128];
+    unsigned int seed = fd;
+
+    while (running) {
+        double noise = (rand_r(&seed) % 1000) * 1e-6;
+        double sent = (timestampNs() - t0) * 1e-9;
+        int len = snprintf(line, sizeof(line),
+                "%.6f %.6f %.6f %.6f %.9f 0.000500 0.000500 0.000500 %.2f\n",
+                0.01 + noise, -0.02 + noise, 0.03 - noise, -0.04 - noise, sent, 24.5);
+        if (write(fd, line, len) != len && errno != EAGAIN)
+            break;
+
+        next += period;
+        struct timespec ts;
+        ts.tv_sec  = next / 1000000000LL;
+        ts.tv_nsec = next % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+static int openPty(char *slave, size_t size)
+{
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        fprintf(stderr, "ERROR: Cannot create pty: %s\n", strerror(errno));
+        return -1;
+    }
+    snprintf(slave, size, "%s", ptsname(master));
+    return master;
+}
+
+static void runStep(int nboards, int rate_hz, double seconds)
+{
+    PSDBus bus(1 << 18);
+    PSDHub hub(&bus);
+
+    std::vector<int> masters;
+    for (int i=0; i<nboards; i++) {
+        char slave[64];
+        int master = openPty(slave, sizeof(slave));
+        if (master < 0)
+            return;
+        masters.push_back(master);
+        hub.addBoard(slave, PSDCalibration::identity());
+    }
+
+    int64_t t0 = timestampNs();
+    running = true;
+    hub.start();
+
+    std::vector<std::thread> writers;
+    for (int i=0; i<nboards; i++)
+        writers.push_back(std::thread(emulateBoard, masters[i], rate_hz, t0));
+
+    // Consume the bus like a real client and collect latencies
+    std::vector<double> latency;
+    latency.reserve((size_t) (nboards * rate_hz * seconds * 1.1));
+    uint64_t cursor = bus.head();
+    uint64_t lost = 0;
+    PSDSample samples[512];
+    int64_t end = t0 + (int64_t) (seconds * 1e9);
+
+    while (timestampNs() < end) {
+        if (!bus.wait(cursor, 50))
+            continue;
+        size_t n = bus.read(&cursor, samples, 512, &lost);
+        for (size_t i=0; i<n; i++)
+            latency.push_back((samples[i].t_ns - t0) * 1e-9 - samples[i].sigma[0]);
+    }
+
+    running = false;
+    for (size_t i=0; i<writers.size(); i++)
+        writers[i].join();
+    int64_t elapsed = timestampNs() - t0;
+    hub.stop();
+
+    uint64_t received = 0, drops = 0;
+    for (int i=0; i<nboards; i++) {
+        PSDBoardStats s = hub.stats(i);
+        received += s.samples;
+        drops += s.drops;
+    }
+
+    double p50 = 0, p99 = 0;
+    if (!latency.empty()) {
+        std::sort(latency.begin(), latency.end());
+        p50 = latency[latency.size() / 2];
+        p99 = latency[(size_t) (latency.size() * 0.99)];
+    }
+
+    printf("%6d %10d %12.0f %8llu %8llu %9.2f %10.1f %10.1f\n",
+           nboards, nboards * rate_hz, received / (elapsed * 1e-9),
+           (unsigned long long) drops, (unsigned long long) lost,
+           100.0 * hub.loopCpuNs() / elapsed, p50 * 1e6, p99 * 1e6);
+
+    for (size_t i=0; i<masters.size(); i++)
+        close(masters[i]);
+}
+
+int main(int argc, char* argv[])
+{
+    int max_boards = (argc > 1) ? atoi(argv[1]) : 32;
+    int rate_hz    = (argc > 2) ? atoi(argv[2]) : 200;
+    double seconds = (argc > 3) ? atof(argv[3]) : 2.0;
+
+    if (max_boards < 1 || rate_hz < 1 || seconds <= 0) {
+        printf("usage: psdbench [max boards] [rate per board, Hz] [seconds per step]\n");
+        return 0;
+    }
+
+    printf("# boards  offered/s   received/s    drops   lagged  hub CPU%%   p50 [us]   p99 [us]\n");
+    for (int n=1; n<=max_boards; n*=2)
+        runStep(n, rate_hz, seconds);
+    return 0;
+}
@@ -0,0 +1,266 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <getopt.h>  // Argument parsing
+
+#include "drift.hpp"
+#include "npy.hpp"
+#include "psd.hpp"
+#include "pyramid.hpp"
+#include "samplelog.hpp"
+#include "timestamp.hpp"
+
+int kbhit(void);
+
+/* One row of --npy */
+struct NpyRow {
+    int64_t  t_ns;
+    uint32_t board;
+    uint32_t seq;
+    double   v[9];
+};
+
+static const NpyField npy_fields[] = {
+    {"t_ns", "<i8", 1}, {"board", "<u4", 1}, {"seq", "<u4", 1},
+    {"x0", "<f8", 1}, {"y0", "<f8", 1}, {"x1", "<f8", 1}, {"y1", "<f8", 1},
+    {"sx0", "<f8", 1}, {"sy0", "<f8", 1}, {"sx1", "<f8", 1}, {"sy1", "<f8", 1},
+    {"temperature", "<f8", 1}
+};
+
+static int help()
+{
+    char usage [] = "\nPSD hub: streams every PSD board from one thread             "
+        "\n                                                                   "
+        "\nUsage: psdhub [arguments]                                          "
+        "\n   e.g. psdhub --discover --caldir /etc/psd                        "
+        "\n        psdhub --port /dev/ttyACM0 --board1 --port /dev/ttyACM1    "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --port <tty>          Add a board                              "
+        "\n    --cal <file>          Calibration of the last --port           "
+        "\n    --board1              Use the BOARD #1 constants for the last  "
+        "\n                          --port (what M2PSD applies)              "
+        "\n    --discover[=pattern]  Add every /dev/ttyACM* (or pattern)      "
+        "\n    --caldir <dir>        Calibrations <dir>/ttyACMn.cal for       "
+        "\n                          --discover (give it first)               "
+        "\n    --stats               Print per-board counters every second    "
+        "\n    --quiet               Do not print samples                     "
+        "\n    --drift <file>        Temperature-drift correction, the model  "
+        "\n                          is kept in <file> between runs           "
+        "\n    --learn               Also fit the drift model (beam parked!)  "
+        "\n    --record <file>       Also append every sample to a binary     "
+        "\n                          sample log (see logconv), and keep its   "
+        "\n                          plotting pyramid <file>.pyr (see zoom)   "
+        "\n    --npy <file>          Also write the samples to a NumPy .npy   "
+        "\n                          (np.load(file, mmap_mode='r'))           "
+        "\n                                                                   "
+        "\n Output: board t[s] x0 y0 x1 y1 temperature. Any key to quit.     "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+static void printStats(PSDHub &hub)
+{
+    for (size_t i=0; i<hub.boards(); i++) {
+        PSDBoardStats s = hub.stats(i);
+        fprintf(stderr, "# %-14s %8.1f Hz  samples %-10llu drops %-6llu read errors %llu\n",
+                hub.boardName(i), s.rate_hz,
+                (unsigned long long) s.samples,
+                (unsigned long long) s.drops,
+                (unsigned long long) s.read_errors);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc==1) return help();
+
+    PSDBus bus;
+    PSDHub hub(&bus);
+
+    const char *caldir = NULL;
+    const char *last_port = NULL;
+    bool stats = false;
+    bool quiet = false;
+    DriftModel drift;
+    const char *drift_path = NULL;
+    bool learn = false;
+    SampleLogWriter record;
+    const char *record_path = NULL;
+    PyramidBuilder pyramid;
+    std::vector<int> channels;      // pyramid channel of board b, column k at b*9+k
+    NpyWriter npy;
+
+    static struct option long_options[] = {
+        {"port"     , required_argument , 0    , 'p'} ,
+        {"cal"      , required_argument , 0    , 'c'} ,
+        {"board1"   , no_argument       , 0    , '1'} ,
+        {"discover" , optional_argument , 0    , 'd'} ,
+        {"caldir"   , required_argument , 0    , 'C'} ,
+        {"stats"    , no_argument       , 0    , 's'} ,
+        {"quiet"    , no_argument       , 0    , 'q'} ,
+        {"drift"    , required_argument , 0    , 'D'} ,
+        {"learn"    , no_argument       , 0    , 'L'} ,
+        {"record"   , required_argument , 0    , 'r'} ,
+        {"npy"      , required_argument , 0    , 'N'} ,
+        {"help"     , no_argument       , 0    , 'h'} ,
+        {NULL       , 0                 , NULL ,  0 }
+    };
+
+    // Boards are opened when the next option shows whether they carry a calibration
+    PSDCalibration cal = PSDCalibration::identity();
+
+    int c;
+    int option_index = 0;
+    while (true) {
+        c = getopt_long(argc, argv, "p:c:1d::C:sqD:Lr:N:h", long_options, &option_index);
+        if (c != 'c' && c != '1' && last_port) {
+            hub.addBoard(last_port, cal);
+            last_port = NULL;
+        }
+        if (c == (-1))
+            break;
+
+        switch (c) {
+            case 'p':
+                last_port = optarg;
+                cal = PSDCalibration::identity();
+                break;
+            case 'c':
+                if (cal.load(optarg) != EXIT_SUCCESS)
+                    fprintf(stderr, "ERROR: Cannot read calibration %s\n", optarg);
+                break;
+            case '1':
+                cal = PSDCalibration::board1();
+                break;
+            case 'd':
+                hub.discover(optarg ? optarg : "/dev/ttyACM*", caldir);
+                break;
+            case 'C':
+                caldir = optarg;
+                break;
+            case 's':
+                stats = true;
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            case 'D':
+                drift_path = optarg;
+                drift.load(drift_path);
+                break;
+            case 'L':
+                learn = true;
+                break;
+            case 'r':
+                if (record.open(optarg, "psdhub") != EXIT_SUCCESS)
+                    return EXIT_FAILURE;
+                record_path = optarg;
+                break;
+            case 'N':
+                if (npy.open(optarg, npy_fields, sizeof(npy_fields) / sizeof(npy_fields[0])) != EXIT_SUCCESS)
+                    return EXIT_FAILURE;
+                break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+
+    if (hub.boards() == 0) {
+        fprintf(stderr, "ERROR: No PSD boards\n");
+        return EXIT_FAILURE;
+    }
+
+    if (drift_path)
+        hub.setDriftModel(&drift, learn);
+    if (record_path)
+        for (size_t b=0; b<hub.boards(); b++)
+            for (int k=0; k<9; k++) {
+                char name[PYRAMID_NAME_SIZE];
+                snprintf(name, sizeof(name), "psd%zu.%s", b, logValueName(LOG_PSD, k));
+                channels.push_back(pyramid.channel(name));
+            }
+    hub.start();
+
+    uint64_t cursor = bus.head();
+    uint64_t lost = 0;
+    int64_t t0 = timestampNs();
+    int64_t last_stats = t0;
+    PSDSample samples[256];
+
+    int64_t last_key = t0;
+    int64_t last_flush = t0;
+
+    while (true) {
+        // kbhit() reconfigures the terminal, do not call it for every batch
+        if (timestampNs() - last_key > 100000000LL) {
+            if (kbhit())
+                break;
+            last_key = timestampNs();
+        }
+
+        if (stats && timestampNs() - last_stats > 1000000000LL) {
+            printStats(hub);
+            if (lost)
+                fprintf(stderr, "# printer fell behind, %llu samples skipped\n",
+                        (unsigned long long) lost);
+            last_stats = timestampNs();
+        }
+        if (npy.isOpen() && timestampNs() - last_flush > 1000000000LL) {
+            npy.flush();
+            last_flush = timestampNs();
+        }
+        if (!bus.wait(cursor, 100))
+            continue;
+
+        size_t n = bus.read(&cursor, samples, 256, &lost);
+        for (size_t i=0; i<n && record.isOpen(); i++) {
+            const PSDSample &s = samples[i];
+            double v[9] = { s.x[0], s.y[0], s.x[1], s.y[1],
+                            s.sigma[0], s.sigma[1], s.sigma[2], s.sigma[3], s.temperature };
+            record.append(s.t_ns, LOG_PSD, s.board, s.seq, v, 9);
+            for (int k=0; k<9; k++)
+                pyramid.append(channels[s.board * 9 + k], s.t_ns, v[k]);
+        }
+        for (size_t i=0; i<n && npy.isOpen(); i++) {
+            const PSDSample &s = samples[i];
+            NpyRow row = { s.t_ns, s.board, s.seq, { s.x[0], s.y[0], s.x[1], s.y[1],
+                           s.sigma[0], s.sigma[1], s.sigma[2], s.sigma[3], s.temperature } };
+            npy.append(&row);
+        }
+        for (size_t i=0; i<n && !quiet; i++) {
+            const PSDSample &s = samples[i];
+            printf("%u %10.6f % 9.5f % 9.5f % 9.5f % 9.5f % 5.2f\n", s.board,
+                   (s.t_ns - t0) * 1e-9, s.x[0], s.y[0], s.x[1], s.y[1], s.temperature);
+        }
+    }
+
+    hub.stop();
+    if (record.isOpen()) {
+        fprintf(stderr, "# recorded %llu samples\n", (unsigned long long) record.records());
+        record.close();
+
+        char pyr[512];
+        snprintf(pyr, sizeof(pyr), "%s.pyr", record_path);
+        pyramid.save(pyr);
+    }
+    if (npy.isOpen()) {
+        fprintf(stderr, "# %llu rows in the npy file\n", (unsigned long long) npy.rows());
+        npy.close();
+    }
+    if (stats)
+        printStats(hub);
+    if (drift_path) {
+        for (int i=0; i<drift.channels(); i++)
+            fprintf(stderr, "# drift %-14s % .4e /C  (%llu samples)\n", drift.name(i),
+                    drift.slope(i), (unsigned long long) drift.samples(i));
+        drift.save(drift_path);
+    }
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <getopt.h>  // Argument parsing
+
+#include <vector>
+
+#include "lockin.hpp"
+#include "piusb.hpp"
+#include "psd.hpp"
+#include "timestamp.hpp"
+
+static int help()
+{
+    char usage [] = "\npsdlock: PSD centroids with the laser switched on and off         "
+        "\n                                                                   "
+        "\nSwitches the laser every --half ms and prints, per board and       "
+        "\nchannel (lockin.hpp), the centroid with the laser on and its noise "
+        "\nfrom the scatter of the on blocks, the dark reading with it off,   "
+        "\nand on minus off. The boards report centroids, not intensities:    "
+        "\non minus off removes an offset only if the dark reading is that    "
+        "\noffset, and ambient light does not cancel.                         "
+        "\nStops at --noise, or after --cycles.                               "
+        "\n                                                                   "
+        "\nUsage: psdlock [arguments]                                         "
+        "\n   e.g. psdlock --port /dev/ttyACM0 --cal acm0.cal --noise 1e-4    "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --port <tty>          PSD board (repeat for more), default     "
+        "\n                          every /dev/ttyACM*                       "
+        "\n    --cal <file>          Calibration of the boards after it       "
+        "\n    --half <ms>           Time the laser stays on or off (100)     "
+        "\n    --guard <ms>          Samples left out after a switch (20)     "
+        "\n    --cycles <n>          At most n on/off cycles (200)            "
+        "\n    --noise <v>           Stop when every channel's laser-on noise "
+        "\n                          is below v                               "
+        "\n    --usb-laser           Switch the USB laser, not relay 0        "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+/* Relay 0 as align --laser does, or the USB laser */
+class LaserSwitch {
+    public:
+        LaserSwitch(bool usb) : relay_(NULL), laser_(NULL)
+        {
+            if (usb)
+                laser_ = new Laser;
+            else
+                relay_ = new Relay;
+        }
+        ~LaserSwitch() { delete relay_; delete laser_; }
+
+        bool isOpen() const { return relay_ ? relay_->isOpen() : laser_->isOpen(); }
+
+        void set(bool on)
+        {
+            if (relay_)
+                relay_->setState(0, on);
+            else if (on)
+                laser_->setOn();
+            else
+                laser_->setOff();
+        }
+
+    private:
+        Relay *relay_;
+        Laser *laser_;
+};
+
+static void printResult(FILE *f, const char *name, const LockInResult &r)
+{
+    static const char *channel[LOCKIN_CHANNELS] = { "x0", "y0", "x1", "y1" };
+    fprintf(f, "%s: %llu cycles, %llu samples (%llu guarded)\n", name,
+            (unsigned long long) r.cycles, (unsigned long long) r.samples,
+            (unsigned long long) r.guarded);
+    for (int c=0; c<LOCKIN_CHANNELS; c++)
+        fprintf(f, "    %s  laser on %+.6f +- %.6f    dark %+.6f +- %.6f    on - dark %+.6f +- %.6f\n",
+                channel[c], r.on[c], r.on_noise[c], r.off[c], r.off_noise[c], r.value[c], r.noise[c]);
+}
+
+/* The noise alone: a centred beam has a value near 0 whatever the noise */
+static bool done(const std::vector<LockIn> &lockins, double noise)
+{
+    if (noise <= 0)
+        return false;
+    for (size_t b=0; b<lockins.size(); b++) {
+        LockInResult r = lockins[b].result();
+        if (r.cycles < 2)
+            return false;
+        for (int c=0; c<LOCKIN_CHANNELS; c++)
+            if (r.on_noise[c] > noise)
+                return false;
+    }
+    return true;
+}
+
+static int acquire(PSDHub *hub, PSDBus *bus, LaserSwitch *laser, int half_ms, int guard_ms,
+                   int cycles, double noise)
+{
+    std::vector<LockIn> lockins(hub->boards(), LockIn((int64_t) guard_ms * 1000000));
+    hub->start();
+
+    uint64_t cursor = bus->head();
+    PSDSample samples[256];
+    auto feed = [&]() {
+        size_t n = bus->read(&cursor, samples, 256);
+        for (size_t i=0; i<n; i++)
+            if (samples[i].board < lockins.size())
+                lockins[samples[i].board].add(samples[i]);
+        return n;
+    };
+    bool on = false;
+    laser->set(on);
+    int64_t t = timestampNs();
+    for (size_t b=0; b<lockins.size(); b++)
+        lockins[b].setReference(on, t);
+    int64_t next = t + (int64_t) half_ms * 1000000;
+    int switches = 0;
+
+    // Ends on an off block so the last on block counts
+    while (switches < 2 * cycles + 1) {
+        int wait_ms = (int) ((next - timestampNs()) / 1000000);
+        if (wait_ms > 0 && bus->wait(cursor, wait_ms)) {
+            feed();
+            continue;
+        }
+        if (timestampNs() < next)
+            continue;
+
+        // What is still in the ring belongs to the block being closed
+        while (feed() > 0);
+        if (!on && done(lockins, noise))
+            break;
+        on = !on;
+        laser->set(on);
+        t = timestampNs();
+        for (size_t b=0; b<lockins.size(); b++)
+            lockins[b].setReference(on, t);
+        next += (int64_t) half_ms * 1000000;
+        switches++;
+    }
+    laser->set(false);
+    hub->stop();
+
+    for (size_t b=0; b<lockins.size(); b++)
+        printResult(stdout, hub->boardName(b), lockins[b].result());
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    PSDBus bus;
+    PSDHub hub(&bus);
+    PSDCalibration cal = PSDCalibration::identity();
+    int half_ms = 100;
+    int guard_ms = 20;
+    int cycles = 200;
+    double noise = 0;
+    bool usb_laser = false;
+
+    static struct option long_options[] = {
+        {"port"     , required_argument , 0    , 'p'} ,
+        {"cal"      , required_argument , 0    , 'c'} ,
+        {"half"     , required_argument , 0    , 'H'} ,
+        {"guard"    , required_argument , 0    , 'g'} ,
+        {"cycles"   , required_argument , 0    , 'n'} ,
+        {"noise"    , required_argument , 0    , 'N'} ,
+        {"usb-laser", no_argument       , 0    , 'u'} ,
+        {"help"     , no_argument       , 0    , 'h'} ,
+        {NULL       , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "p:c:H:g:n:N:uh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'p':
+                if (hub.addBoard(optarg, cal) < 0)
+                    return EXIT_FAILURE;
+                break;
+            case 'c':
+                if (cal.load(optarg) != EXIT_SUCCESS)
+                    return EXIT_FAILURE;
+                break;
+            case 'H':
+                half_ms = atoi(optarg);
+                break;
+            case 'g':
+                guard_ms = atoi(optarg);
+                break;
+            case 'n':
+                cycles = atoi(optarg);
+                break;
+            case 'N':
+                noise = atof(optarg);
+                break;
+            case 'u':
+                usb_laser = true;
+                break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+
+    if (hub.boards() == 0 && hub.discover() == 0) {
+        fprintf(stderr, "ERROR: No PSD boards\n");
+        return EXIT_FAILURE;
+    }
+    LaserSwitch laser(usb_laser);
+    if (!laser.isOpen()) {
+        fprintf(stderr, "ERROR: Cannot switch the laser\n");
+        return EXIT_FAILURE;
+    }
+    return acquire(&hub, &bus, &laser, half_ms, guard_ms, cycles, noise);
+}
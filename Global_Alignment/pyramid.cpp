@@ -0,0 +1,317 @@
+#include "pyramid.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const PyramidBucket EMPTY = { 0, 0, 0, 0, 0 };
+
+static inline void merge(PyramidBucket *b, const PyramidBucket &other)
+{
+    if (other.count == 0)
+        return;
+    if (b->count == 0 || other.min < b->min) b->min = other.min;
+    if (b->count == 0 || other.max > b->max) b->max = other.max;
+    b->sum += other.sum;
+    b->count += other.count;
+}
+
+/* Finest level that covers [t_from, t_to] in at most max_points buckets */
+static int pickLevel(int64_t t_from, int64_t t_to, size_t max_points,
+                     int64_t base_ns, int fanout, int levels)
+{
+    int64_t width = base_ns;
+    for (int k=0; k<levels; k++, width *= fanout)
+        if ((t_to - t_from) / width + 2 <= (int64_t) max_points)
+            return k;
+    return levels - 1;
+}
+
+static void collect(const PyramidBucket *b, size_t n, int64_t t0, int64_t width,
+                    int64_t t_from, int64_t t_to, std::vector<PyramidPoint> *out)
+{
+    int64_t first = t_from > t0 ? (t_from - t0) / width : 0;
+    int64_t last = t_to >= t0 ? (t_to - t0) / width : -1;
+    if (last >= (int64_t) n)
+        last = n - 1;
+
+    for (int64_t i=first; i<=last; i++) {
+        if (b[i].count == 0)
+            continue;
+        PyramidPoint p;
+        p.t_ns = t0 + i * width;
+        p.min = b[i].min;
+        p.max = b[i].max;
+        p.mean = b[i].sum / b[i].count;
+        p.count = b[i].count;
+        out->push_back(p);
+    }
+}
+
+/*
+ * PyramidBuilder
+ */
+
+PyramidBuilder::PyramidBuilder(int64_t base_ns, int fanout)
+{
+    base_ns_ = base_ns > 0 ? base_ns : 1;
+    fanout_ = fanout > 1 ? fanout : 2;
+    t0_ = 0;
+    started_ = false;
+    width_.push_back(base_ns_);
+    levels_.resize(1);
+}
+
+int PyramidBuilder::channel(const char *name)
+{
+    for (size_t i=0; i<names_.size(); i++)
+        if (names_[i] == name)
+            return i;
+
+    names_.push_back(name);
+    for (size_t k=0; k<levels_.size(); k++)
+        levels_[k].push_back(std::vector<PyramidBucket>());
+    return names_.size() - 1;
+}
+
+void PyramidBuilder::grow(size_t level, size_t buckets)
+{
+    for (size_t c=0; c<levels_[level].size(); c++)
+        if (levels_[level][c].size() < buckets)
+            levels_[level][c].resize(buckets, EMPTY);
+}
+
+void PyramidBuilder::append(int channel, int64_t t_ns, double value)
+{
+    if (!started_) {
+        t0_ = t_ns;
+        started_ = true;
+    }
+    if (t_ns < t0_)
+        return;
+
+    PyramidBucket s;
+    s.min = s.max = s.sum = value;
+    s.count = 1;
+    s.reserved = 0;
+
+    for (size_t k=0; k<levels_.size(); k++) {
+        size_t i = (t_ns - t0_) / width_[k];
+        if (i >= levels_[k][channel].size())
+            grow(k, i < 1024 ? 1024 : i + i / 2);
+        merge(&levels_[k][channel][i], s);
+    }
+
+    // Keep adding levels until the top one is a single bucket
+    while ((t_ns - t0_) / width_.back() > 0) {
+        size_t top = levels_.size() - 1;
+        int64_t width = width_.back() * fanout_;
+        std::vector<std::vector<PyramidBucket> > level(names_.size());
+        for (size_t c=0; c<names_.size(); c++) {
+            const std::vector<PyramidBucket> &below = levels_[top][c];
+            level[c].assign(below.size() / fanout_ + 1, EMPTY);
+            for (size_t i=0; i<below.size(); i++)
+                merge(&level[c][i / fanout_], below[i]);
+        }
+        width_.push_back(width);
+        levels_.push_back(level);
+    }
+}
+
+int PyramidBuilder::query(int channel, int64_t t_from, int64_t t_to, size_t max_points,
+                          std::vector<PyramidPoint> *out) const
+{
+    int k = pickLevel(t_from, t_to, max_points, base_ns_, fanout_, levels_.size());
+    const std::vector<PyramidBucket> &b = levels_[k][channel];
+    collect(b.data(), b.size(), t0_, width_[k], t_from, t_to, out);
+    return k;
+}
+
+int PyramidBuilder::channels() const
+{
+    return names_.size();
+}
+
+int PyramidBuilder::levels() const
+{
+    return levels_.size();
+}
+
+int PyramidBuilder::save(const char *path) const
+{
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Cannot write %s\n", tmp);
+        return EXIT_FAILURE;
+    }
+
+    PyramidHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC));
+    header.version = PYRAMID_VERSION;
+    header.channels = names_.size();
+    header.levels = levels_.size();
+    header.fanout = fanout_;
+    header.base_ns = base_ns_;
+    header.t0_ns = t0_;
+    fwrite(&header, sizeof(header), 1, f);
+
+    for (size_t c=0; c<names_.size(); c++) {
+        char name[PYRAMID_NAME_SIZE] = {0};
+        strncpy(name, names_[c].c_str(), PYRAMID_NAME_SIZE - 1);
+        fwrite(name, PYRAMID_NAME_SIZE, 1, f);
+    }
+
+    // Levels are stored trimmed to the last bucket in use, the same length for every channel
+    std::vector<PyramidLevel> table(levels_.size());
+    uint64_t offset = sizeof(header) + names_.size() * PYRAMID_NAME_SIZE + table.size() * sizeof(PyramidLevel);
+    for (size_t k=0; k<levels_.size(); k++) {
+        size_t n = 0;
+        for (size_t c=0; c<names_.size(); c++)
+            for (size_t i=levels_[k][c].size(); i>n; i--)
+                if (levels_[k][c][i-1].count) {
+                    n = i;
+                    break;
+                }
+        table[k].buckets = n;
+        table[k].offset = offset;
+        offset += n * names_.size() * sizeof(PyramidBucket);
+    }
+    fwrite(table.data(), sizeof(PyramidLevel), table.size(), f);
+
+    for (size_t k=0; k<levels_.size(); k++)
+        for (size_t c=0; c<names_.size(); c++) {
+            const std::vector<PyramidBucket> &b = levels_[k][c];
+            size_t n = table[k].buckets;
+            size_t have = b.size() < n ? b.size() : n;
+            fwrite(b.data(), sizeof(PyramidBucket), have, f);
+            for (size_t i=have; i<n; i++)
+                fwrite(&EMPTY, sizeof(PyramidBucket), 1, f);
+        }
+
+    bool ok = !ferror(f);
+    fclose(f);
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "ERROR: Cannot write %s\n", path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/*
+ * PyramidReader
+ */
+
+PyramidReader::PyramidReader()
+{
+    map_ = NULL;
+    size_ = 0;
+}
+
+PyramidReader::~PyramidReader()
+{
+    close();
+}
+
+int PyramidReader::open(const char *path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Cannot open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(PyramidHeader)) {
+        fprintf(stderr, "ERROR: %s is not a pyramid\n", path);
+        ::close(fd);
+        return EXIT_FAILURE;
+    }
+
+    size_ = st.st_size;
+    void *map = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Cannot map %s: %s\n", path, strerror(errno));
+        size_ = 0;
+        return EXIT_FAILURE;
+    }
+    map_ = (const char *) map;
+
+    const PyramidHeader &h = header();
+    size_t table = sizeof(h) + h.channels * PYRAMID_NAME_SIZE;
+    bool ok = memcmp(h.magic, PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC)) == 0 &&
+              h.version == PYRAMID_VERSION && h.levels > 0 &&
+              table + h.levels * sizeof(PyramidLevel) <= size_;
+    for (uint32_t k=0; ok && k<h.levels; k++) {
+        const PyramidLevel &l = ((const PyramidLevel *) (map_ + table))[k];
+        ok = l.offset + l.buckets * h.channels * sizeof(PyramidBucket) <= size_;
+    }
+    if (!ok) {
+        fprintf(stderr, "ERROR: %s is not a version %d pyramid\n", path, PYRAMID_VERSION);
+        close();
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+int PyramidReader::close()
+{
+    if (map_)
+        munmap((void *) map_, size_);
+    map_ = NULL;
+    size_ = 0;
+    return EXIT_SUCCESS;
+}
+
+const PyramidHeader &PyramidReader::header() const
+{
+    return *(const PyramidHeader *) map_;
+}
+
+int PyramidReader::channel(const char *name) const
+{
+    for (uint32_t c=0; c<header().channels; c++)
+        if (!strncmp(this->name(c), name, PYRAMID_NAME_SIZE))
+            return c;
+    return -1;
+}
+
+const char *PyramidReader::name(int channel) const
+{
+    return map_ + sizeof(PyramidHeader) + channel * PYRAMID_NAME_SIZE;
+}
+
+int64_t PyramidReader::endTime() const
+{
+    const PyramidHeader &h = header();
+    const PyramidLevel *table = (const PyramidLevel *) (map_ + sizeof(h) + h.channels * PYRAMID_NAME_SIZE);
+    return h.t0_ns + (int64_t) table[0].buckets * h.base_ns;
+}
+
+int PyramidReader::query(int channel, int64_t t_from, int64_t t_to, size_t max_points,
+                         std::vector<PyramidPoint> *out) const
+{
+    const PyramidHeader &h = header();
+    const PyramidLevel *table = (const PyramidLevel *) (map_ + sizeof(h) + h.channels * PYRAMID_NAME_SIZE);
+
+    int k = pickLevel(t_from, t_to, max_points, h.base_ns, h.fanout, h.levels);
+    int64_t width = h.base_ns;
+    for (int i=0; i<k; i++)
+        width *= h.fanout;
+
+    const PyramidBucket *b = (const PyramidBucket *) (map_ + table[k].offset) + channel * table[k].buckets;
+    collect(b, table[k].buckets, h.t0_ns, width, t_from, t_to, out);
+    return k;
+}
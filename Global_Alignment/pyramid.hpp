@@ -0,0 +1,124 @@
+#ifndef _PYRAMID_HPP_
+#define _PYRAMID_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * Min/max/mean decimation pyramid for plotting long recordings.
+ *
+ * Level 0 splits time into buckets of base_ns, level k into buckets of
+ * base_ns * fanout^k, all aligned on the first sample. Every bucket keeps
+ * min, max, sum and count per channel, so a plot of any time range at any
+ * zoom reads at most N buckets from the one level where they fit: O(N),
+ * whatever the length of the recording. Zooms finer than base_ns are
+ * served from the raw samples (SampleLogReader::find).
+ *
+ * File (<log>.pyr): PyramidHeader, channel names (char[32] each), one
+ * PyramidLevel per level, then the buckets, level by level and channel by
+ * channel.
+ */
+
+#define PYRAMID_MAGIC     "STEWPYR"
+#define PYRAMID_VERSION   1
+#define PYRAMID_NAME_SIZE 32
+
+struct PyramidHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t channels;
+    uint32_t levels;
+    uint32_t fanout;
+    int64_t  base_ns;
+    int64_t  t0_ns;             // start of bucket 0
+};
+
+struct PyramidLevel {
+    uint64_t buckets;           // per channel
+    uint64_t offset;            // of the first bucket in the file
+};
+
+struct PyramidBucket {
+    double   min;
+    double   max;
+    double   sum;
+    uint32_t count;             // 0: no sample in this bucket
+    uint32_t reserved;
+};
+
+struct PyramidPoint {
+    int64_t  t_ns;              // start of the bucket
+    double   min;
+    double   max;
+    double   mean;
+    uint32_t count;
+};
+
+/*
+ * Builds a pyramid in memory as samples arrive (or from a finished log).
+ * Each append() updates one bucket per level, ~10 levels for a day.
+ */
+class PyramidBuilder {
+    public:
+        PyramidBuilder(int64_t base_ns = 250000000, int fanout = 4);
+
+        /* Index of the named channel, created on first use */
+        int channel(const char *name);
+
+        /* Samples before the first one appended are dropped */
+        void append(int channel, int64_t t_ns, double value);
+
+        /* Same as PyramidReader::query, on the data so far */
+        int query(int channel, int64_t t_from, int64_t t_to, size_t max_points,
+                  std::vector<PyramidPoint> *out) const;
+
+        int channels() const;
+        int levels() const;
+
+        int save(const char *path) const;
+
+    private:
+        void grow(size_t level, size_t buckets);
+
+        int64_t base_ns_;
+        int64_t t0_;
+        int fanout_;
+        bool started_;
+        std::vector<std::string> names_;
+        std::vector<int64_t> width_;                                    // per level
+        std::vector<std::vector<std::vector<PyramidBucket> > > levels_; // [level][channel][bucket]
+};
+
+/* A saved pyramid through mmap */
+class PyramidReader {
+    public:
+        PyramidReader();
+        ~PyramidReader();
+
+        int open(const char *path);
+        int close();
+
+        const PyramidHeader &header() const;
+        /* -1 if there is no such channel */
+        int channel(const char *name) const;
+        const char *name(int channel) const;
+
+        /* End of the last level 0 bucket */
+        int64_t endTime() const;
+
+        /*
+         * Appends at most max_points points covering [t_from, t_to] (empty
+         * buckets are skipped). Returns the level they were taken from.
+         */
+        int query(int channel, int64_t t_from, int64_t t_to, size_t max_points,
+                  std::vector<PyramidPoint> *out) const;
+
+    private:
+        const char *map_;
+        size_t size_;
+};
+
+#endif
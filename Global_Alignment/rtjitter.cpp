@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <getopt.h>  // Argument parsing
+#include <sys/resource.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "histogram.hpp"
+#include "psd.hpp"
+#include "rtprofile.hpp"
+#include "timestamp.hpp"
+
+#define LOAD_BYTES  (4 * 1024 * 1024)
+
+static std::atomic<bool> loading;
+
+static int help()
+{
+    char usage [] = "\nrtjitter: timing jitter without and with the real-time profile    "
+        "\n                                                                   "
+        "\nRuns a periodic control loop (and optionally reads a PSD board)    "
+        "\ntwice, as ordinary threads and then under the RT profile, and      "
+        "\ncompares the wake-up latency and sample intervals. The memory lock "
+        "\nof the profile stays once applied, so the normal run comes first.  "
+        "\n                                                                   "
+        "\nUsage: rtjitter [arguments]                                        "
+        "\n   e.g. rtjitter --period 1000 --seconds 5 --load 4                "
+        "\n        rtjitter --psd /dev/ttyACM0 --rt 80@2                      "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --period <us>         Control loop period (default 1000)       "
+        "\n    --seconds <s>         Length of each run (default 5)           "
+        "\n    --rt <prio>[@<cpus>]  Profile of the RT run (default           "
+        "\n                          RT_PROFILE, else 80)                     "
+        "\n    --mode <m>            normal, rt or both (default both)        "
+        "\n    --load <n>            Threads allocating and touching memory   "
+        "\n                          during the runs, as a GUI or other       "
+        "\n                          processes would (default 0)              "
+        "\n    --psd <tty>           Also time the samples of a PSD board     "
+        "\n    --histogram           Print the latency histograms             "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+struct LoopResult {
+    std::string policy;
+    LogHistogram late;      // wake-up after the deadline [ns]
+    uint64_t faults;        // page faults of the loop thread
+    uint64_t overruns;      // wake-ups later than one period
+};
+
+static uint64_t threadFaults()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+/* Sleeps to absolute deadlines every period_ns, as the control threads do */
+static void controlLoop(int64_t period_ns, int64_t end_ns, LoopResult *result)
+{
+    rtEnterThread(RT_CONTROL, "rtjitter");
+    result->policy = rtDescribeThread();
+    uint64_t faults = threadFaults();
+
+    int64_t next = timestampNs() + period_ns;
+    while (next < end_ns) {
+        struct timespec ts = { (time_t) (next / 1000000000), (long) (next % 1000000000) };
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        int64_t late = timestampNs() - next;
+        result->late.record(late);
+        if (late > period_ns)
+            result->overruns++;
+        next += period_ns;
+    }
+    result->faults = threadFaults() - faults;
+}
+
+/* Allocates, touches and frees memory in a loop: faults, cache misses, preemption */
+static void load()
+{
+    while (loading) {
+        char *block = (char *) malloc(LOAD_BYTES);
+        if (block) {
+            memset(block, 1, LOAD_BYTES);
+            free(block);
+        }
+    }
+}
+
+/* Deviation of every sample interval of board 0 from the mean interval */
+static void sampleJitter(PSDBus *bus, uint64_t cursor, LogHistogram *deviation, double *mean_ms)
+{
+    std::vector<int64_t> t;
+    PSDSample samples[256];
+    size_t n;
+    while ((n = bus->read(&cursor, samples, 256)) > 0)
+        for (size_t i=0; i<n; i++)
+            if (samples[i].board == 0)
+                t.push_back(samples[i].t_ns);
+    *mean_ms = 0;
+    if (t.size() < 2)
+        return;
+    double mean = (double) (t.back() - t.front()) / (t.size() - 1);
+    *mean_ms = mean * 1e-6;
+    for (size_t i=1; i<t.size(); i++)
+        deviation->record((int64_t) fabs((double) (t[i] - t[i - 1]) - mean));
+}
+
+int main(int argc, char* argv[])
+{
+    int period_us = 1000;
+    double seconds = 5;
+    RTProfile rt;
+    if (rtProfile())
+        rt = *rtProfile();
+    bool run_normal = true;
+    bool run_rt = true;
+    int load_threads = 0;
+    const char *psd_port = NULL;
+    bool histogram = false;
+
+    static struct option long_options[] = {
+        {"period"    , required_argument , 0    , 'p'} ,
+        {"seconds"   , required_argument , 0    , 's'} ,
+        {"rt"        , required_argument , 0    , 'r'} ,
+        {"mode"      , required_argument , 0    , 'm'} ,
+        {"load"      , required_argument , 0    , 'l'} ,
+        {"psd"       , required_argument , 0    , 'P'} ,
+        {"histogram" , no_argument       , 0    , 'H'} ,
+        {"help"      , no_argument       , 0    , 'h'} ,
+        {NULL        , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "p:s:r:m:l:P:Hh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'p': period_us = atoi(optarg);     break;
+            case 's': seconds = atof(optarg);       break;
+            case 'r':
+                if (parseRTProfile(optarg, &rt) != EXIT_SUCCESS) {
+                    fprintf(stderr, "ERROR: --rt %s: expected <priority>[@<cpus>]\n", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                run_normal = strcmp(optarg, "rt") != 0;
+                run_rt = strcmp(optarg, "normal") != 0;
+                break;
+            case 'l': load_threads = atoi(optarg);  break;
+            case 'P': psd_port = optarg;            break;
+            case 'H': histogram = true;             break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+    if (period_us <= 0 || seconds <= 0) {
+        fprintf(stderr, "ERROR: --period and --seconds must be positive\n");
+        return EXIT_FAILURE;
+    }
+
+    const char *modes[2] = { "normal", "rt" };
+    bool runs[2] = { run_normal, run_rt };
+    LoopResult loops[2];
+    LogHistogram deviations[2];
+    double interval_ms[2] = { 0, 0 };
+    uint64_t samples[2] = { 0, 0 };
+
+    for (int m=0; m<2; m++) {
+        if (!runs[m])
+            continue;
+        setRTProfile(m == 1 ? &rt : NULL);
+        rtLockMemory();
+        loops[m].faults = loops[m].overruns = 0;
+
+        PSDBus bus;
+        PSDHub hub(&bus);
+        if (psd_port && hub.addBoard(psd_port, PSDCalibration::identity()) < 0) {
+            fprintf(stderr, "ERROR: Cannot open %s\n", psd_port);
+            return EXIT_FAILURE;
+        }
+        uint64_t cursor = bus.head();
+        if (psd_port)
+            hub.start();
+
+        loading = true;
+        std::vector<std::thread> loaders;
+        for (int i=0; i<load_threads; i++)
+            loaders.push_back(std::thread(load));
+
+        fprintf(stderr, "%s: %.1f s ...\n", modes[m], seconds);
+        int64_t end = timestampNs() + (int64_t) (seconds * 1e9);
+        std::thread loop(controlLoop, (int64_t) period_us * 1000, end, &loops[m]);
+        loop.join();
+
+        loading = false;
+        for (size_t i=0; i<loaders.size(); i++)
+            loaders[i].join();
+        if (psd_port) {
+            hub.stop();
+            samples[m] = bus.head() - cursor;
+            sampleJitter(&bus, cursor, &deviations[m], &interval_ms[m]);
+        }
+    }
+
+    printf("\nControl loop, %d us period, %d load threads: wake-up after the deadline\n",
+           period_us, load_threads);
+    printf("%-7s %-28s %8s %7s %9s %9s %9s %9s %9s\n", "mode", "policy", "wakeups", "faults",
+           "p50 us", "p99 us", "p99.9 us", "max us", "overruns");
+    for (int m=0; m<2; m++) {
+        if (!runs[m])
+            continue;
+        const LogHistogram &h = loops[m].late;
+        printf("%-7s %-28s %8llu %7llu %9.1f %9.1f %9.1f %9.1f %9llu\n", modes[m],
+               loops[m].policy.c_str(), (unsigned long long) h.count(),
+               (unsigned long long) loops[m].faults, h.percentile(50) * 1e-3, h.percentile(99) * 1e-3,
+               h.percentile(99.9) * 1e-3, h.max() * 1e-3, (unsigned long long) loops[m].overruns);
+    }
+
+    if (psd_port) {
+        printf("\nPSD %s: deviation of the sample intervals from the mean\n", psd_port);
+        printf("%-7s %8s %11s %9s %9s %9s %9s\n", "mode", "samples", "interval ms", "p50 us",
+               "p99 us", "p99.9 us", "max us");
+        for (int m=0; m<2; m++) {
+            if (!runs[m])
+                continue;
+            const LogHistogram &h = deviations[m];
+            printf("%-7s %8llu %11.3f %9.1f %9.1f %9.1f %9.1f\n", modes[m],
+                   (unsigned long long) samples[m], interval_ms[m], h.percentile(50) * 1e-3,
+                   h.percentile(99) * 1e-3, h.percentile(99.9) * 1e-3, h.max() * 1e-3);
+        }
+    }
+
+    if (histogram) {
+        for (int m=0; m<2; m++) {
+            if (!runs[m])
+                continue;
+            printf("\n%s wake-up latency:\n", modes[m]);
+            loops[m].late.print(stdout, "    ");
+            if (psd_port) {
+                printf("%s sample interval deviation:\n", modes[m]);
+                deviations[m].print(stdout, "    ");
+            }
+        }
+    }
+    return EXIT_SUCCESS;
+}
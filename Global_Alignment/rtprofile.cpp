@@ -0,0 +1,234 @@
+#include "rtprofile.hpp"
+
+#include <alloca.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <mutex>
+
+#define ACQUIRE_TO_CONTROL  10
+
+enum Refusal {
+    REFUSED_SCHED = 0,
+    REFUSED_AFFINITY,
+    REFUSED_MLOCK,
+    REFUSED_COUNT
+};
+
+static std::mutex profile_mutex;
+static bool profile_checked = false;
+static bool profile_set = false;
+static RTProfile profile;
+static bool memory_locked = false;
+static bool refused_once[REFUSED_COUNT];
+
+RTProfile::RTProfile()
+{
+    priority = 80;
+    lock_memory = true;
+    stack_bytes = 256 * 1024;
+    heap_bytes = 8 * 1024 * 1024;
+}
+
+/* "2-3,5" into a CPU set. false if malformed or empty */
+static bool parseCpus(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0 || first >= CPU_SETSIZE)
+            return false;
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first || last >= CPU_SETSIZE)
+                return false;
+            p = end;
+        }
+        for (long c=first; c<=last; c++)
+            CPU_SET(c, set);
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return false;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+int parseRTProfile(const char *spec, RTProfile *out)
+{
+    char *end;
+    long priority = strtol(spec, &end, 10);
+    if (end == spec || priority < 1 || priority > 99)
+        return EXIT_FAILURE;
+    std::string cpus;
+    if (*end == '@') {
+        cpu_set_t set;
+        if (!parseCpus(end + 1, &set))
+            return EXIT_FAILURE;
+        cpus = end + 1;
+    } else if (*end) {
+        return EXIT_FAILURE;
+    }
+    out->priority = priority;
+    out->cpus = cpus;
+    return EXIT_SUCCESS;
+}
+
+const RTProfile *rtProfile()
+{
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    if (!profile_checked) {
+        profile_checked = true;
+        const char *spec = getenv("RT_PROFILE");
+        if (spec && *spec) {
+            if (parseRTProfile(spec, &profile) == EXIT_SUCCESS)
+                profile_set = true;
+            else
+                fprintf(stderr, "ERROR: RT_PROFILE=%s: expected <priority>[@<cpus>]\n", spec);
+        }
+    }
+    return profile_set ? &profile : NULL;
+}
+
+void setRTProfile(const RTProfile *p)
+{
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    profile_checked = true;
+    profile_set = p != NULL;
+    if (p)
+        profile = *p;
+}
+
+/* Reports a refused step the first time only: every thread would hit it */
+static void refused(Refusal which, const char *what, int error)
+{
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    if (refused_once[which])
+        return;
+    refused_once[which] = true;
+    fprintf(stderr, "WARNING: RT profile: %s: %s\n", what, strerror(error));
+}
+
+/* Touches bytes of stack below the caller, so the pages are there when needed */
+static void __attribute__((noinline)) prefaultStack(size_t bytes)
+{
+    volatile char *stack = (volatile char *) alloca(bytes);
+    for (size_t i=0; i<bytes; i+=4096)
+        stack[i] = 0;
+}
+
+int rtLockMemory()
+{
+    const RTProfile *p = rtProfile();
+    if (!p || !p->lock_memory)
+        return EXIT_SUCCESS;
+
+    size_t heap_bytes;
+    {
+        std::lock_guard<std::mutex> lock(profile_mutex);
+        if (memory_locked)
+            return EXIT_SUCCESS;
+        memory_locked = true;
+        heap_bytes = p->heap_bytes;
+    }
+
+    // Freed memory stays in the one heap, where it is locked and faulted in
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_ARENA_MAX, 1);
+    int status = EXIT_SUCCESS;
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        refused(REFUSED_MLOCK, "mlockall", errno);
+        status = EXIT_FAILURE;
+    }
+    char *reserve = (char *) malloc(heap_bytes);
+    if (reserve) {
+        for (size_t i=0; i<heap_bytes; i+=4096)
+            reserve[i] = 0;
+        free(reserve);
+    }
+    return status;
+}
+
+int rtEnterThread(RTRole role, const char *name)
+{
+    if (name) {
+        char short_name[16];
+        snprintf(short_name, sizeof short_name, "%s", name);
+        pthread_setname_np(pthread_self(), short_name);
+    }
+
+    const RTProfile *p = rtProfile();
+    if (!p)
+        return EXIT_SUCCESS;
+
+    int status = rtLockMemory();
+    if (!p->cpus.empty()) {
+        cpu_set_t set;
+        parseCpus(p->cpus.c_str(), &set);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+        if (error) {
+            refused(REFUSED_AFFINITY, "CPU affinity", error);
+            status = EXIT_FAILURE;
+        }
+    }
+
+    struct sched_param param;
+    memset(&param, 0, sizeof param);
+    param.sched_priority = role == RT_ACQUIRE ? p->priority : p->priority - ACQUIRE_TO_CONTROL;
+    if (param.sched_priority < 1)
+        param.sched_priority = 1;
+    int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error) {
+        refused(REFUSED_SCHED, "SCHED_FIFO", error);
+        status = EXIT_FAILURE;
+    }
+
+    prefaultStack(p->stack_bytes);
+    return status;
+}
+
+std::string rtDescribeThread()
+{
+    int policy;
+    struct sched_param param;
+    pthread_getschedparam(pthread_self(), &policy, &param);
+
+    char text[256];
+    int n;
+    if (policy == SCHED_FIFO || policy == SCHED_RR)
+        n = snprintf(text, sizeof text, "%s %d", policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR",
+                     param.sched_priority);
+    else
+        n = snprintf(text, sizeof text, "SCHED_OTHER");
+
+    cpu_set_t set;
+    if (pthread_getaffinity_np(pthread_self(), sizeof set, &set) == 0) {
+        n += snprintf(text + n, sizeof text - n, " cpus");
+        const char *sep = " ";
+        for (int c=0; c<CPU_SETSIZE && n < (int) sizeof text - 8; c++) {
+            if (!CPU_ISSET(c, &set))
+                continue;
+            int last = c;
+            while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set))
+                last++;
+            if (last > c)
+                n += snprintf(text + n, sizeof text - n, "%s%d-%d", sep, c, last);
+            else
+                n += snprintf(text + n, sizeof text - n, "%s%d", sep, c);
+            sep = ",";
+            c = last;
+        }
+    }
+    return text;
+}
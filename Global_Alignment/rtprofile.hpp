@@ -0,0 +1,65 @@
+#ifndef _RTPROFILE_HPP_
+#define _RTPROFILE_HPP_
+
+#include <stddef.h>
+
+#include <string>
+
+/*
+ * Opt-in real-time profile for the acquisition and control threads.
+ *
+ * Off unless RT_PROFILE is set or setRTProfile() is called:
+ *    RT_PROFILE=<priority>[@<cpus>]        e.g. RT_PROFILE=80@2-3
+ *
+ * A thread entering the profile is switched to SCHED_FIFO, pinned to the
+ * CPU list and touches its stack so that later calls do not fault.
+ * Acquisition threads (PSD hub, DLS tracking), which timestamp samples,
+ * run at the priority; control threads (leg moves, position polls) 10
+ * below, so a move never delays a sample.
+ *
+ * The first thread also locks the process in memory: mlockall, no malloc
+ * trimming or mmap, one malloc arena and a prefaulted heap reserve, so
+ * buffers allocated afterwards are resident. This stays for the life of
+ * the process.
+ *
+ * Needs CAP_SYS_NICE and CAP_IPC_LOCK (or root); a step that is refused
+ * is reported once and the others still apply.
+ */
+enum RTRole {
+    RT_ACQUIRE = 0,
+    RT_CONTROL = 1
+};
+
+struct RTProfile {
+    int priority;           // SCHED_FIFO priority of RT_ACQUIRE, 1-99
+    std::string cpus;       // "2-3", "0,2"; empty: any CPU
+    bool lock_memory;
+    size_t stack_bytes;     // prefaulted in every thread
+    size_t heap_bytes;      // prefaulted once
+
+    RTProfile();
+};
+
+/* "<priority>[@<cpus>]". EXIT_FAILURE if malformed */
+int parseRTProfile(const char *spec, RTProfile *profile);
+
+/* The profile in use, NULL if off */
+const RTProfile *rtProfile();
+
+/* Replaces RT_PROFILE; NULL turns the profile off for threads started later */
+void setRTProfile(const RTProfile *profile);
+
+/*
+ * Applies the profile to the calling thread and names it (15 characters
+ * shown by ps and top). Nothing to do if off. EXIT_FAILURE if a step was
+ * refused.
+ */
+int rtEnterThread(RTRole role, const char *name);
+
+/* Memory part of the profile only: call from main before starting threads */
+int rtLockMemory();
+
+/* Policy, priority and CPUs of the calling thread, e.g. "SCHED_FIFO 80 cpus 2-3" */
+std::string rtDescribeThread();
+
+#endif
@@ -0,0 +1,399 @@
+#include "samplelog.hpp"
+#include "timestamp.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#define PREALLOCATE (4 * 1024 * 1024)
+
+namespace {
+struct CrcTable {
+    uint32_t t[256];
+    CrcTable()
+    {
+        for (uint32_t i=0; i<256; i++) {
+            uint32_t c = i;
+            for (int k=0; k<8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+    }
+};
+}
+
+uint32_t logCrc32(const void *data, size_t size, uint32_t crc)
+{
+    static const CrcTable table;
+
+    const unsigned char *p = (const unsigned char *) data;
+    crc = ~crc;
+    for (size_t i=0; i<size; i++)
+        crc = table.t[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+const char *logValueName(int type, int column)
+{
+    static const char *dls[] = { "distance", "temperature", "signal" };
+    static const char *psd[] = { "x0", "y0", "x1", "y1", "sx0", "sy0", "sx1", "sy1", "temperature" };
+    static const char *actuator[] = { "position", "target" };
+    static const char *row[] = { "X0", "Y0", "X1", "Y1", "sX0", "sY0", "sX1", "sY1",
+                                 "Actuator_x", "Actuator_y" };
+
+    if (column < 0)
+        return NULL;
+    switch (type) {
+        case LOG_DLS:      return column < 3 ? dls[column] : NULL;
+        case LOG_PSD:      return column < 9 ? psd[column] : NULL;
+        case LOG_ACTUATOR: return column < 2 ? actuator[column] : NULL;
+        case LOG_ROW:      return column < 10 ? row[column] : NULL;
+        default:           return NULL;
+    }
+}
+
+/*
+ * SampleLogWriter
+ */
+
+SampleLogWriter::SampleLogWriter()
+{
+    fd_ = -1;
+    count_ = 0;
+    last_t_ns_ = INT64_MIN;
+    records_ = 0;
+    rejected_ = 0;
+    size_ = 0;
+    allocated_ = 0;
+}
+
+SampleLogWriter::~SampleLogWriter()
+{
+    close();
+}
+
+int SampleLogWriter::open(const char *path, const char *description, uint32_t block_records)
+{
+    if (fd_ >= 0)
+        close();
+
+    fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        fprintf(stderr, "ERROR: Cannot create %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (block_records == 0)
+        block_records = 1;
+    block_.assign(block_records, LogRecord());
+    count_ = 0;
+    last_t_ns_ = INT64_MIN;
+    records_ = 0;
+    rejected_ = 0;
+    allocated_ = 0;
+
+    SampleLogHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SAMPLELOG_MAGIC, sizeof(SAMPLELOG_MAGIC));
+    header.version = SAMPLELOG_VERSION;
+    header.header_size = sizeof(SampleLogHeader);
+    header.record_size = sizeof(LogRecord);
+    header.block_records = block_records;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    header.start_t_ns = timestampNs();
+    header.start_unix_ns = (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    strncpy(header.description, description, sizeof(header.description) - 1);
+
+    if (write(fd_, &header, sizeof(header)) != sizeof(header)) {
+        fprintf(stderr, "ERROR: Cannot write %s\n", path);
+        ::close(fd_);
+        fd_ = -1;
+        return EXIT_FAILURE;
+    }
+    size_ = sizeof(header);
+    return EXIT_SUCCESS;
+}
+
+int SampleLogWriter::close()
+{
+    if (fd_ < 0)
+        return EXIT_SUCCESS;
+
+    int status = writeBlock();
+    // Give back what fallocate reserved past the end
+    if (ftruncate(fd_, size_) != 0)
+        status = EXIT_FAILURE;
+    ::close(fd_);
+    fd_ = -1;
+    return status;
+}
+
+int SampleLogWriter::append(const LogRecord &record)
+{
+    if (fd_ < 0 || record.t_ns < last_t_ns_) {
+        rejected_++;
+        return EXIT_FAILURE;
+    }
+
+    block_[count_++] = record;
+    last_t_ns_ = record.t_ns;
+    records_++;
+
+    if (count_ == block_.size())
+        return writeBlock();
+    return EXIT_SUCCESS;
+}
+
+int SampleLogWriter::append(int64_t t_ns, int type, int source, uint32_t seq, const double *v, int n)
+{
+    LogRecord record;
+    record.t_ns = t_ns;
+    record.type = type;
+    record.source = source;
+    record.seq = seq;
+    if (n > SAMPLELOG_VALUES)
+        n = SAMPLELOG_VALUES;
+    for (int i=0; i<SAMPLELOG_VALUES; i++)
+        record.v[i] = i < n ? v[i] : 0.0;
+    return append(record);
+}
+
+int SampleLogWriter::flush()
+{
+    if (fd_ < 0)
+        return EXIT_FAILURE;
+    return writeBlock();
+}
+
+int SampleLogWriter::writeBlock()
+{
+    if (count_ == 0)
+        return EXIT_SUCCESS;
+
+    SampleLogBlock head;
+    head.magic = SAMPLELOG_BLOCK_MAGIC;
+    head.count = count_;
+    head.crc = logCrc32(&block_[0], count_ * sizeof(LogRecord));
+    head.reserved = 0;
+    head.t_first = block_[0].t_ns;
+    head.t_last = block_[count_-1].t_ns;
+
+    size_t bytes = sizeof(head) + count_ * sizeof(LogRecord);
+    if (size_ + bytes > allocated_) {
+        // Reserve ahead without changing the file size, so a crash leaves no zero tail
+        if (fallocate(fd_, FALLOC_FL_KEEP_SIZE, size_, PREALLOCATE) == 0)
+            allocated_ = size_ + PREALLOCATE;
+        else
+            allocated_ = size_ + bytes;     // not supported here (tmpfs, NFS)
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = &head;
+    iov[0].iov_len = sizeof(head);
+    iov[1].iov_base = &block_[0];
+    iov[1].iov_len = count_ * sizeof(LogRecord);
+
+    count_ = 0;
+    if (writev(fd_, iov, 2) != (ssize_t) bytes) {
+        fprintf(stderr, "ERROR: Sample log write failed: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    size_ += bytes;
+    return EXIT_SUCCESS;
+}
+
+bool SampleLogWriter::isOpen() const
+{
+    return fd_ >= 0;
+}
+
+uint64_t SampleLogWriter::records() const
+{
+    return records_;
+}
+
+uint64_t SampleLogWriter::rejected() const
+{
+    return rejected_;
+}
+
+/*
+ * SampleLogReader
+ */
+
+SampleLogReader::SampleLogReader()
+{
+    map_ = NULL;
+    size_ = 0;
+    records_ = 0;
+    trailing_ = 0;
+}
+
+SampleLogReader::~SampleLogReader()
+{
+    close();
+}
+
+int SampleLogReader::open(const char *path, bool verify)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Cannot open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SampleLogHeader)) {
+        fprintf(stderr, "ERROR: %s is not a sample log\n", path);
+        ::close(fd);
+        return EXIT_FAILURE;
+    }
+
+    size_ = st.st_size;
+    void *map = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Cannot map %s: %s\n", path, strerror(errno));
+        size_ = 0;
+        return EXIT_FAILURE;
+    }
+    map_ = (const char *) map;
+
+    const SampleLogHeader &h = header();
+    if (memcmp(h.magic, SAMPLELOG_MAGIC, sizeof(SAMPLELOG_MAGIC)) != 0 ||
+        h.version != SAMPLELOG_VERSION ||
+        h.header_size != sizeof(SampleLogHeader) ||
+        h.record_size != sizeof(LogRecord)) {
+        fprintf(stderr, "ERROR: %s is not a version %d sample log\n", path, SAMPLELOG_VERSION);
+        close();
+        return EXIT_FAILURE;
+    }
+
+    madvise(map, size_, MADV_SEQUENTIAL);
+
+    // Walk the block headers; the records themselves are only touched with verify
+    size_t offset = sizeof(SampleLogHeader);
+    int64_t t_last = INT64_MIN;
+    while (offset + sizeof(SampleLogBlock) <= size_) {
+        const SampleLogBlock *head = (const SampleLogBlock *) (map_ + offset);
+        size_t bytes = sizeof(SampleLogBlock) + (size_t) head->count * sizeof(LogRecord);
+
+        if (head->magic != SAMPLELOG_BLOCK_MAGIC || head->count == 0 ||
+            head->count > h.block_records || offset + bytes > size_ ||
+            head->t_first < t_last || head->t_last < head->t_first)
+            break;
+        if (verify && logCrc32(head + 1, head->count * sizeof(LogRecord)) != head->crc) {
+            fprintf(stderr, "WARNING: %s: bad checksum in block %zu\n", path, blocks_.size());
+            break;
+        }
+
+        Block b;
+        b.head = head;
+        b.first = records_;
+        blocks_.push_back(b);
+        records_ += head->count;
+        t_last = head->t_last;
+        offset += bytes;
+    }
+    trailing_ = size_ - offset;
+
+    madvise(map, size_, MADV_RANDOM);
+    return EXIT_SUCCESS;
+}
+
+int SampleLogReader::close()
+{
+    if (map_)
+        munmap((void *) map_, size_);
+    map_ = NULL;
+    size_ = 0;
+    blocks_.clear();
+    records_ = 0;
+    trailing_ = 0;
+    return EXIT_SUCCESS;
+}
+
+const SampleLogHeader &SampleLogReader::header() const
+{
+    return *(const SampleLogHeader *) map_;
+}
+
+uint64_t SampleLogReader::records() const
+{
+    return records_;
+}
+
+const LogRecord *SampleLogReader::record(uint64_t index) const
+{
+    if (index >= records_)
+        return NULL;
+
+    // Last block starting at or before index
+    size_t lo = 0, hi = blocks_.size();
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (blocks_[mid].first <= index)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    const LogRecord *records = (const LogRecord *) (blocks_[lo].head + 1);
+    return &records[index - blocks_[lo].first];
+}
+
+size_t SampleLogReader::blocks() const
+{
+    return blocks_.size();
+}
+
+const LogRecord *SampleLogReader::block(size_t b, uint32_t *count) const
+{
+    if (b >= blocks_.size()) {
+        *count = 0;
+        return NULL;
+    }
+    *count = blocks_[b].head->count;
+    return (const LogRecord *) (blocks_[b].head + 1);
+}
+
+uint64_t SampleLogReader::find(int64_t t_ns) const
+{
+    // First block that ends at or after t_ns, then search inside it
+    size_t lo = 0, hi = blocks_.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (blocks_[mid].head->t_last < t_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == blocks_.size())
+        return records_;
+
+    const LogRecord *records = (const LogRecord *) (blocks_[lo].head + 1);
+    uint32_t a = 0, z = blocks_[lo].head->count;
+    while (a < z) {
+        uint32_t mid = (a + z) / 2;
+        if (records[mid].t_ns < t_ns)
+            a = mid + 1;
+        else
+            z = mid;
+    }
+    return blocks_[lo].first + a;
+}
+
+uint64_t SampleLogReader::trailing() const
+{
+    return trailing_;
+}
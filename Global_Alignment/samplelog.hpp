@@ -0,0 +1,149 @@
+#ifndef _SAMPLELOG_HPP_
+#define _SAMPLELOG_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+/*
+ * Binary sample log.
+ *
+ *    SampleLogHeader                         64 bytes
+ *    block: SampleLogBlock + count records   32 + count * 96 bytes
+ *    block: ...
+ *
+ * Every record has the same size, whatever its type. A block holds up to
+ * header.block_records records and a CRC-32 of them; a crash loses at most
+ * the block being filled, and a torn last block is detected and ignored.
+ * Timestamps never go backwards within a file.
+ *
+ * All fields are little endian (the file is the in-memory layout).
+ */
+
+#define SAMPLELOG_MAGIC         "STEWLOG"
+#define SAMPLELOG_VERSION       1
+#define SAMPLELOG_BLOCK_MAGIC   0x4B4C4253      // "SBLK"
+#define SAMPLELOG_VALUES        10
+
+enum LogRecordType {
+    LOG_DLS      = 1,   // v0 distance [0.1 mm], v1 temperature [C] or NaN, v2 signal
+    LOG_PSD      = 2,   // v0-v3 x0 y0 x1 y1, v4-v7 sigma x0 y0 x1 y1, v8 temperature
+    LOG_ACTUATOR = 3,   // v0 position [steps], v1 target [steps]; source = 0 motor, 1 twister
+    LOG_ROW      = 4    // the 10 columns of a data*.txt line (X0 ... Actuator_y)
+};
+
+struct SampleLogHeader {
+    char     magic[8];          // SAMPLELOG_MAGIC
+    uint32_t version;
+    uint32_t header_size;       // sizeof(SampleLogHeader)
+    uint32_t record_size;       // sizeof(LogRecord)
+    uint32_t block_records;     // records per full block
+    int64_t  start_unix_ns;     // CLOCK_REALTIME when the file was created ...
+    int64_t  start_t_ns;        // ... and timestampNs() at the same instant
+    char     description[24];
+};
+
+struct SampleLogBlock {
+    uint32_t magic;             // SAMPLELOG_BLOCK_MAGIC
+    uint32_t count;             // records in this block
+    uint32_t crc;               // CRC-32 of the records
+    uint32_t reserved;
+    int64_t  t_first;
+    int64_t  t_last;
+};
+
+struct LogRecord {
+    int64_t  t_ns;              // timestampNs()
+    uint16_t type;              // LogRecordType
+    uint16_t source;            // board, device or stream index
+    uint32_t seq;
+    double   v[SAMPLELOG_VALUES];
+};
+
+/* Column name of a record value ("x0", "distance", ...), NULL if the column is unused */
+const char *logValueName(int type, int column);
+
+/* CRC-32 (zlib polynomial) */
+uint32_t logCrc32(const void *data, size_t size, uint32_t crc = 0);
+
+/*
+ * Appends records to a log. One writer thread per file.
+ *
+ * Records are copied into a block buffer allocated once in open(); a full
+ * block is written with a single write(). The file is grown with
+ * fallocate() a few MB at a time and trimmed to its real size in close().
+ */
+class SampleLogWriter {
+    public:
+        SampleLogWriter();
+        ~SampleLogWriter();
+
+        int open(const char *path, const char *description = "", uint32_t block_records = 256);
+        int close();
+
+        /* EXIT_FAILURE if the file is not open or t_ns is older than the last record */
+        int append(const LogRecord &record);
+        int append(int64_t t_ns, int type, int source, uint32_t seq, const double *v, int n);
+
+        /* Writes the partial block now (it then stays a short block in the file) */
+        int flush();
+
+        bool isOpen() const;
+        uint64_t records() const;
+        uint64_t rejected() const;
+
+    private:
+        int writeBlock();
+
+        int fd_;
+        std::vector<LogRecord> block_;
+        uint32_t count_;
+        int64_t last_t_ns_;
+        uint64_t records_;
+        uint64_t rejected_;
+        uint64_t size_;         // bytes written
+        uint64_t allocated_;    // bytes reserved with fallocate
+};
+
+/*
+ * Read-only view of a log through mmap. record() and block() return
+ * pointers into the mapping, valid until close().
+ */
+class SampleLogReader {
+    public:
+        SampleLogReader();
+        ~SampleLogReader();
+
+        /* With verify, blocks failing their CRC end the log like a torn block */
+        int open(const char *path, bool verify = false);
+        int close();
+
+        const SampleLogHeader &header() const;
+
+        uint64_t records() const;
+        const LogRecord *record(uint64_t index) const;
+
+        size_t blocks() const;
+        const LogRecord *block(size_t b, uint32_t *count) const;
+
+        /* Index of the first record with t_ns >= t_ns (records() if none) */
+        uint64_t find(int64_t t_ns) const;
+
+        /* Bytes past the last valid block (torn or corrupt tail) */
+        uint64_t trailing() const;
+
+    private:
+        struct Block {
+            const SampleLogBlock *head;
+            uint64_t first;     // index of its first record
+        };
+
+        const char *map_;
+        size_t size_;
+        std::vector<Block> blocks_;
+        uint64_t records_;
+        uint64_t trailing_;
+};
+
+#endif
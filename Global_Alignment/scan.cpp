@@ -0,0 +1,533 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <fcntl.h>   // For file handling
+#include <getopt.h>  // Argument parsing
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "histogram.hpp"
+#include "rtprofile.hpp"
+#include "scanner.hpp"
+#include "solver.hpp"
+#include "timestamp.hpp"
+
+static int help()
+{
+    char usage [] = "\nscan: actuator scan with a PSD (and DLS) row per set-point         "
+        "\n                                                                   "
+        "\nMoves Actuator_x and Actuator_y through the set-points, waits      "
+        "\n--settle, averages --window PSD samples and appends the row as the "
+        "\nGUI's Save Data does (X0, Y0, ... Actuator_x, Actuator_y). With    "
+        "\n--dls the distance over the same window is appended as two more   "
+        "\ncolumns. Prints the time per point and the points per minute.      "
+        "\n                                                                   "
+        "\nUsage: scan [arguments]                                            "
+        "\n   e.g. scan --grid 900:1000:10,-40:40:20 --psd /dev/ttyACM0       "
+        "\n             --out data.txt                                        "
+        "\n        scan --points setpoints.txt --x twister --y none           "
+        "\n        scan --search spiral --step 20 --radius 15                 "
+        "\n        scan --align --target 0,0 --tolerance 5e-4                 "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --grid <x0:x1:dx,y0:y1:dy>  Set-points in steps, y serpentine  "
+        "\n    --points <file>       Set-points, \"x y\" per line               "
+        "\n    --x <axis>            Actuator_x: motor[:select], twister or   "
+        "\n                          none (default motor)                     "
+        "\n    --y <axis>            Actuator_y (default twister)             "
+        "\n    --velocity <1-10>     Actuator velocity (default 10)           "
+        "\n    --psd <tty>           PSD board (default: first /dev/ttyACM*)  "
+        "\n    --cal <file>          Its calibration                          "
+        "\n    --dls <tty>           Also average the DIMETIX distance        "
+        "\n    --window <n>          PSD samples per point (default 10)       "
+        "\n    --settle <ms|auto>    Wait after each move (default 200), or   "
+        "\n                          until the PSD is at rest (settle.hpp)    "
+        "\n    --settle-max <ms>     Longest auto settle (default 2000)       "
+        "\n    --settle-window <n>   Samples tested for rest (default 20)     "
+        "\n    --out <file>          Append rows here (default stdout)        "
+        "\n    --log <file>          Also write them to a sample log          "
+        "\n    --pipeline            Average and write each point on a worker "
+        "\n                          while the next move runs                 "
+        "\n                                                                   "
+        "\nBeam acquisition, when the spot is off the PSD:                    "
+        "\n    --search <pattern>    spiral (nearest first) or raster, one    "
+        "\n                          --step per move; stops on the spot       "
+        "\n    --center <x,y>        Around here (default: where they are)    "
+        "\n    --step <n>            Steps between points (default 10)        "
+        "\n    --radius <n>          Points out from the center (default 10)  "
+        "\n    --detector <0|1>      x0/y0 or x1/y1 (default 0)               "
+        "\n    --limit <v>           Spot when |x| and |y| are below v        "
+        "\n                          (default 0.9; off the PSD they saturate) "
+        "\n    --hold <n>            for n samples in a row (default 3)       "
+        "\n    --dwell <ms>          Longest look after a move (default 50)   "
+        "\n                                                                   "
+        "\nAlignment, the spot of --detector onto a target (solver.hpp):      "
+        "\n    --align               Quasi-Newton from where the actuators    "
+        "\n                          are, a --window average per move         "
+        "\n    --target <x,y>        Centroid to reach (default 0,0)          "
+        "\n    --tolerance <v>       |x| and |y| error below v (default 1e-3) "
+        "\n    --jacobian <a,b,c,d>  Starting dx/dX,dx/dY,dy/dX,dy/dY per     "
+        "\n                          step (default: probe each axis)          "
+        "\n    --probe <n>           Probe move in steps (default 10)         "
+        "\n    --trust <n>           First trust radius in steps (default 100)"
+        "\n    --max-moves <n>       Give up after n moves (default 30)       "
+        "\n    --gain <g>            Fixed-gain servo instead, no updates     "
+        "\n    --bench               Compare them on a simulated mirror       "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+/* One actuator column: the device, or none */
+struct AxisDevice {
+    std::string spec;
+    Motor *motor;
+    Twister *twister;
+};
+
+static int openAxis(Scanner *scanner, int axis, AxisDevice *device, int velocity)
+{
+    device->motor = NULL;
+    device->twister = NULL;
+    const std::string &spec = device->spec;
+    if (spec == "none")
+        return EXIT_SUCCESS;
+    if (spec == "twister") {
+        device->twister = new Twister;
+        if (!device->twister->isOpen() || device->twister->setVelocity(velocity) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        scanner->setAxis(axis, device->twister);
+        return EXIT_SUCCESS;
+    }
+    if (spec == "motor" || spec.compare(0, 6, "motor:") == 0) {
+        device->motor = new Motor(spec.size() > 6 ? spec.c_str() + 6 : NULL);
+        if (!device->motor->isOpen() || device->motor->setVelocity(velocity) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        scanner->setAxis(axis, device->motor);
+        return EXIT_SUCCESS;
+    }
+    fprintf(stderr, "ERROR: Unknown axis %s\n", spec.c_str());
+    return EXIT_FAILURE;
+}
+
+/* Motor::setPosition()/Twister::setPosition() wait forever for a position out of range */
+static bool inRange(const AxisDevice &device, int position)
+{
+    if (device.motor)
+        return position >= MOTOR_MIN_POSITION && position <= MOTOR_MAX_POSITION;
+    if (device.twister)
+        return position >= -0x7FF && position <= 0x7FF;
+    return true;
+}
+
+/* Beam acquisition along a spiral or raster around center */
+static int searchSpot(Scanner *scanner, PSDHub *hub, const AxisDevice axis[2], const char *pattern,
+                      const char *center_arg, int step, int radius, const SpotCriterion &spot)
+{
+    ScanPoint from = scanner->where();
+    ScanPoint center = from;
+    if (center_arg && sscanf(center_arg, "%d,%d", &center.x, &center.y) != 2) {
+        fprintf(stderr, "ERROR: --center takes x,y\n");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<ScanPoint> spiral, raster, path;
+    scanSpiral(center, step, radius, &spiral);
+    scanRaster(center, step, radius, from, &raster);
+    if (strcmp(pattern, "spiral") != 0 && strcmp(pattern, "raster") != 0) {
+        fprintf(stderr, "ERROR: --search takes spiral or raster\n");
+        return EXIT_FAILURE;
+    }
+    const std::vector<ScanPoint> &chosen = pattern[0] == 's' ? spiral : raster;
+    for (size_t i=0; i<chosen.size(); i++)
+        if (inRange(axis[0], chosen[i].x) && inRange(axis[1], chosen[i].y))
+            path.push_back(chosen[i]);
+
+    int64_t travel;
+    int reversals;
+    scanPathCost(from, spiral, &travel, &reversals);
+    fprintf(stderr, "spiral: %zu points, %lld steps, %d reversals to cover\n", spiral.size(),
+            (long long) travel, reversals);
+    scanPathCost(from, raster, &travel, &reversals);
+    fprintf(stderr, "raster: %zu points, %lld steps, %d reversals to cover\n", raster.size(),
+            (long long) travel, reversals);
+    if (path.size() < chosen.size())
+        fprintf(stderr, "%zu points out of the actuators' range left out\n", chosen.size() - path.size());
+
+    hub->start();
+    SearchResult result;
+    int status = scanner->search(path, spot, &result);
+    hub->stop();
+    if (status != EXIT_SUCCESS)
+        return status;
+
+    if (result.found)
+        printf("Spot on detector %d at %d, %d", spot.detector, result.at.x, result.at.y);
+    else
+        printf("No spot, back at %d, %d is up to the operator", result.at.x, result.at.y);
+    printf(" after %zu moves, %lld steps, %d reversals, %.2f s\n", result.moves,
+           (long long) result.travel, result.reversals, result.ns * 1e-9);
+    return result.found ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+struct AlignSettings {
+    int detector;
+    double target[2];
+    double tolerance;
+    bool have_jacobian;
+    double jacobian[2][2];
+    int probe;
+    double trust;
+    int max_moves;
+    double gain;
+};
+
+static void configure(AlignSolver *solver, const AlignSettings &a)
+{
+    if (a.have_jacobian)
+        solver->setJacobian(a.jacobian);
+    solver->setProbe(a.probe);
+    solver->setTolerance(a.tolerance);
+    solver->setTrustRadius(a.trust, 10 * a.trust);
+    solver->setMaxMoves(a.max_moves);
+    solver->setFixedGain(a.gain);
+}
+
+/* Aligns the detector's centroid on the target from where the actuators are */
+static int alignSpot(Scanner *scanner, PSDHub *hub, const AxisDevice axis[2], const AlignSettings &a)
+{
+    AlignSolver solver([&](const ScanPoint &point, double r[2]) {
+        if (!inRange(axis[0], point.x) || !inRange(axis[1], point.y)) {
+            fprintf(stderr, "ERROR: Align: %d, %d is out of range\n", point.x, point.y);
+            return EXIT_FAILURE;
+        }
+        ScanRow row;
+        if (scanner->measure(point, &row) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        r[0] = row.psd[2 * a.detector] - a.target[0];
+        r[1] = row.psd[2 * a.detector + 1] - a.target[1];
+        return EXIT_SUCCESS;
+    });
+    configure(&solver, a);
+
+    hub->start();
+    AlignResult result;
+    int status = solver.align(scanner->where(), &result);
+    hub->stop();
+    if (status != EXIT_SUCCESS)
+        return status;
+    AlignSolver::printResult(stdout, result);
+    return result.converged ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*
+ * The solvers on a simulated mirror: the PSD response to the actuators
+ * rotates by ~35 degrees and changes scale across the range, with 1e-4
+ * noise on every window. Moves to reach the tolerance from 200 random
+ * starts up to 250 steps away.
+ */
+static void alignBench(AlignSettings a)
+{
+    const ScanPoint aligned = { 950, 20 };
+    std::mt19937_64 rng(1);
+    std::normal_distribution<double> noise(0, 1e-4);
+    std::uniform_int_distribution<int> offset(-250, 250);
+    auto model = [&](const ScanPoint &p, double r[2]) {
+        double dx = p.x - aligned.x, dy = p.y - aligned.y;
+        double theta = 0.6 * dx / 300;
+        double scale = 1 + 0.4 * dy / 300;
+        double u = dx / 1500 * scale, v = dy / 1200;
+        r[0] = cos(theta) * u - sin(theta) * v + noise(rng);
+        r[1] = sin(theta) * u + cos(theta) * v + noise(rng);
+        return EXIT_SUCCESS;
+    };
+
+    const char *name[4] = { "fixed gain 0.5", "fixed gain 1.0", "fixed gain 0.7", "Broyden + trust" };
+    double gains[4] = { 0.5, 1.0, 0.7, 0 };
+    printf("%-16s %10s %10s %10s %10s\n", "", "converged", "mean moves", "p90 moves", "max moves");
+    for (int m=0; m<4; m++) {
+        a.gain = gains[m];
+        AlignSolver solver(model);
+        configure(&solver, a);
+        std::vector<int> moves;
+        int converged = 0;
+        rng.seed(1);
+        for (int trial=0; trial<200; trial++) {
+            ScanPoint start = { aligned.x + offset(rng), aligned.y + offset(rng) };
+            AlignResult result;
+            solver.align(start, &result);
+            if (result.converged) {
+                converged++;
+                moves.push_back(result.moves);
+            }
+        }
+        std::sort(moves.begin(), moves.end());
+        double mean = 0;
+        for (size_t i=0; i<moves.size(); i++)
+            mean += moves[i];
+        if (moves.empty())
+            printf("%-16s %10d\n", name[m], 0);
+        else
+            printf("%-16s %10d %10.1f %10d %10d\n", name[m], converged, mean / moves.size(),
+                   moves[moves.size() * 9 / 10], moves.back());
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc==1) return help();
+
+    std::vector<ScanPoint> points;
+    AxisDevice axis[2];
+    axis[0].spec = "motor";
+    axis[1].spec = "twister";
+    int velocity = 10;
+    const char *psd_port = NULL;
+    PSDCalibration cal = PSDCalibration::identity();
+    const char *dls_port = NULL;
+    int window = 10;
+    int settle_ms = 200;
+    bool settle_auto = false;
+    int settle_max_ms = 2000;
+    int settle_window = 20;
+    const char *out_path = NULL;
+    const char *log_path = NULL;
+    bool pipeline = false;
+    const char *search = NULL;
+    const char *center = NULL;
+    int search_step = 10;
+    int search_radius = 10;
+    SpotCriterion spot = { 0, 0.9, 3, 50 };
+    bool align = false;
+    bool bench = false;
+    AlignSettings settings = { 0, {0, 0}, 1e-3, false, {{0, 0}, {0, 0}}, 10, 100, 30, 0 };
+
+    static struct option long_options[] = {
+        {"grid"         , required_argument , 0    , 'g'} ,
+        {"points"       , required_argument , 0    , 'P'} ,
+        {"x"            , required_argument , 0    , 'x'} ,
+        {"y"            , required_argument , 0    , 'y'} ,
+        {"velocity"     , required_argument , 0    , 'v'} ,
+        {"psd"          , required_argument , 0    , 'p'} ,
+        {"cal"          , required_argument , 0    , 'c'} ,
+        {"dls"          , required_argument , 0    , 'd'} ,
+        {"window"       , required_argument , 0    , 'w'} ,
+        {"settle"       , required_argument , 0    , 's'} ,
+        {"settle-max"   , required_argument , 0    , 'M'} ,
+        {"settle-window", required_argument , 0    , 'W'} ,
+        {"out"          , required_argument , 0    , 'o'} ,
+        {"log"          , required_argument , 0    , 'l'} ,
+        {"pipeline"     , no_argument       , 0    , 'L'} ,
+        {"search"       , required_argument , 0    , 'S'} ,
+        {"center"       , required_argument , 0    , 'C'} ,
+        {"step"         , required_argument , 0    , 't'} ,
+        {"radius"       , required_argument , 0    , 'r'} ,
+        {"detector"     , required_argument , 0    , 'D'} ,
+        {"limit"        , required_argument , 0    , 'm'} ,
+        {"hold"         , required_argument , 0    , 'H'} ,
+        {"dwell"        , required_argument , 0    , 'e'} ,
+        {"align"        , no_argument       , 0    , 'A'} ,
+        {"target"       , required_argument , 0    , 'T'} ,
+        {"tolerance"    , required_argument , 0    , 'O'} ,
+        {"jacobian"     , required_argument , 0    , 'J'} ,
+        {"probe"        , required_argument , 0    , 'B'} ,
+        {"trust"        , required_argument , 0    , 'R'} ,
+        {"max-moves"    , required_argument , 0    , 'X'} ,
+        {"gain"         , required_argument , 0    , 'G'} ,
+        {"bench"        , no_argument       , 0    , 'K'} ,
+        {"help"         , no_argument       , 0    , 'h'} ,
+        {NULL           , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "g:P:x:y:v:p:c:d:w:s:M:W:o:l:LS:C:t:r:D:m:H:e:AT:O:J:B:R:X:G:Kh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'g':
+                if (scanGrid(optarg, &points) != EXIT_SUCCESS)
+                    return EXIT_FAILURE;
+                break;
+            case 'P':
+                if (scanList(optarg, &points) != EXIT_SUCCESS)
+                    return EXIT_FAILURE;
+                break;
+            case 'x': axis[0].spec = optarg;         break;
+            case 'y': axis[1].spec = optarg;         break;
+            case 'v': velocity = atoi(optarg);       break;
+            case 'p': psd_port = optarg;             break;
+            case 'c':
+                if (cal.load(optarg) != EXIT_SUCCESS)
+                    return EXIT_FAILURE;
+                break;
+            case 'd': dls_port = optarg;             break;
+            case 'w': window = atoi(optarg);         break;
+            case 's':
+                settle_auto = strcmp(optarg, "auto") == 0;
+                settle_ms = atoi(optarg);
+                break;
+            case 'M': settle_max_ms = atoi(optarg);  break;
+            case 'W': settle_window = atoi(optarg);  break;
+            case 'o': out_path = optarg;             break;
+            case 'l': log_path = optarg;             break;
+            case 'L': pipeline = true;               break;
+            case 'S': search = optarg;               break;
+            case 'C': center = optarg;               break;
+            case 't': search_step = atoi(optarg);    break;
+            case 'r': search_radius = atoi(optarg);  break;
+            case 'D': spot.detector = atoi(optarg) ? 1 : 0;  break;
+            case 'm': spot.limit = atof(optarg);     break;
+            case 'H': spot.hold = atoi(optarg);      break;
+            case 'e': spot.dwell_ms = atoi(optarg);  break;
+            case 'A': align = true;                  break;
+            case 'T':
+                if (sscanf(optarg, "%lf,%lf", &settings.target[0], &settings.target[1]) != 2) {
+                    fprintf(stderr, "ERROR: --target takes x,y\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'O': settings.tolerance = atof(optarg);  break;
+            case 'J':
+                if (sscanf(optarg, "%lf,%lf,%lf,%lf", &settings.jacobian[0][0], &settings.jacobian[0][1],
+                           &settings.jacobian[1][0], &settings.jacobian[1][1]) != 4) {
+                    fprintf(stderr, "ERROR: --jacobian takes dx/dX,dx/dY,dy/dX,dy/dY\n");
+                    return EXIT_FAILURE;
+                }
+                settings.have_jacobian = true;
+                break;
+            case 'B': settings.probe = atoi(optarg);      break;
+            case 'R': settings.trust = atof(optarg);      break;
+            case 'X': settings.max_moves = atoi(optarg);  break;
+            case 'G': settings.gain = atof(optarg);       break;
+            case 'K': bench = true;                       break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+    settings.detector = spot.detector;
+    if (align && bench) {
+        alignBench(settings);
+        return EXIT_SUCCESS;
+    }
+    if (points.empty() && !search && !align) {
+        fprintf(stderr, "ERROR: No set-points, use --grid, --points, --search or --align\n");
+        return EXIT_FAILURE;
+    }
+
+    rtLockMemory();     // RT_PROFILE: before the buffers and threads
+    PSDBus bus;
+    PSDHub hub(&bus);
+    if (psd_port ? hub.addBoard(psd_port, cal) < 0 : hub.discover() == 0) {
+        fprintf(stderr, "ERROR: No PSD board\n");
+        return EXIT_FAILURE;
+    }
+
+    Scanner scanner(&bus);
+    scanner.setWindow(window);
+    scanner.setSettle(settle_ms);
+    SettleDetector detector(settle_window);
+    if (settle_auto)
+        scanner.setSettleDetector(&detector, settle_max_ms);
+    for (int a=0; a<2; a++)
+        if (openAxis(&scanner, a, &axis[a], velocity) != EXIT_SUCCESS) {
+            fprintf(stderr, "ERROR: Cannot open the %s for Actuator_%c\n", axis[a].spec.c_str(), "xy"[a]);
+            return EXIT_FAILURE;
+        }
+    if (search || align) {
+        int status = search ? searchSpot(&scanner, &hub, axis, search, center, search_step, search_radius, spot)
+                            : alignSpot(&scanner, &hub, axis, settings);
+        for (int a=0; a<2; a++) {
+            delete axis[a].motor;
+            delete axis[a].twister;
+        }
+        return status;
+    }
+    for (size_t i=0; i<points.size(); i++)
+        if (!inRange(axis[0], points[i].x) || !inRange(axis[1], points[i].y)) {
+            fprintf(stderr, "ERROR: Set-point %d, %d is out of range\n", points[i].x, points[i].y);
+            return EXIT_FAILURE;
+        }
+
+    DLS *dls = NULL;
+    if (dls_port) {
+        int fd = open (dls_port, O_RDWR | O_NOCTTY | O_SYNC);
+        if (fd < 0) {
+            fprintf(stderr, "ERROR: %d opening %s: %s\n", errno, dls_port, strerror (errno));
+            return EXIT_FAILURE;
+        }
+        dls = new DLS;
+        dls->setFD(fd);
+        scanner.setDLS(dls);
+    }
+
+    FILE *out = stdout;
+    if (out_path) {
+        out = fopen(out_path, "a");
+        if (out == NULL) {
+            fprintf(stderr, "ERROR: Cannot open %s: %s\n", out_path, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+    if (ftell(out) <= 0)
+        scanner.writeHeader(out);
+
+    SampleLogWriter log;
+    if (log_path && log.open(log_path, "scan") != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    hub.start();
+    scanner.begin();
+
+    LogHistogram settle_times;
+    int timeouts = 0;
+    auto sink = [&](size_t i, const ScanRow &row) {
+        scanner.writeRow(out, row);
+        fflush(out);
+        if (log.isOpen())
+            scanner.logRow(&log, i, row);
+
+        settle_times.record(row.settle_ns);
+        timeouts += row.settle_timeout;
+        fprintf(stderr, "%zu/%zu  %d, %d  move %.0f ms  settle %.0f ms%s  acquire %.0f ms (%llu samples)\n",
+                i + 1, points.size(), row.point.x, row.point.y, row.move_ns * 1e-6,
+                row.settle_ns * 1e-6, row.settle_timeout ? " (limit)" : "",
+                row.acquire_ns * 1e-6, (unsigned long long) row.samples);
+    };
+
+    ScanTiming timing;
+    size_t done = scanner.run(points, pipeline, sink, &timing);
+    int status = done == points.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    scanner.end();
+    hub.stop();
+    log.close();
+    if (out != stdout)
+        fclose(out);
+    delete dls;
+    for (int a=0; a<2; a++) {
+        delete axis[a].motor;
+        delete axis[a].twister;
+    }
+
+    int64_t total = timing.wall_ns;
+    if (done && total > 0) {
+        fprintf(stderr, "%zu points in %.1f s: %.1f points/min%s\n", done, total * 1e-9,
+                done * 60e9 / total, pipeline ? " (pipelined)" : "");
+        fprintf(stderr, "per point ms: move %.1f  settle %.1f  acquire %.1f  average+write %.1f%s  stalled %.1f\n",
+                timing.move_ns * 1e-6 / timing.points, timing.settle_ns * 1e-6 / timing.points,
+                timing.acquire_ns * 1e-6 / timing.points, timing.reduce_ns * 1e-6 / done,
+                pipeline ? " (overlapped)" : "", timing.stall_ns * 1e-6 / timing.points);
+    }
+    if (done && settle_auto)
+        fprintf(stderr, "settle ms: min %.0f  mean %.0f  p50 %.0f  p90 %.0f  max %.0f, %d at the %d ms limit\n",
+                settle_times.min() * 1e-6, settle_times.mean() * 1e-6, settle_times.percentile(50) * 1e-6,
+                settle_times.percentile(90) * 1e-6, settle_times.max() * 1e-6, timeouts, settle_max_ms);
+    return status;
+}
@@ -0,0 +1,602 @@
+#include "scanner.hpp"
+#include "rtprofile.hpp"
+#include "timestamp.hpp"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <condition_variable>
+#include <deque>
+
+static int parseRange(const char *p, const char **rest, int v[3])
+{
+    for (int i=0; i<3; i++) {
+        char *end;
+        long n = strtol(p, &end, 10);
+        if (end == p)
+            return EXIT_FAILURE;
+        v[i] = (int) n;
+        p = end;
+        if (i < 2) {
+            if (*p != ':')
+                return EXIT_FAILURE;
+            p++;
+        }
+    }
+    *rest = p;
+    if (v[2] == 0 || (v[1] - v[0]) / v[2] < 0)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
+
+int scanGrid(const char *spec, std::vector<ScanPoint> *points)
+{
+    int x[3], y[3];
+    const char *p = spec;
+    if (parseRange(p, &p, x) != EXIT_SUCCESS || *p++ != ',' ||
+        parseRange(p, &p, y) != EXIT_SUCCESS || *p != '\0') {
+        fprintf(stderr, "ERROR: Scan grid %s is not from:to:step,from:to:step\n", spec);
+        return EXIT_FAILURE;
+    }
+
+    int nx = (x[1] - x[0]) / x[2] + 1;
+    int ny = (y[1] - y[0]) / y[2] + 1;
+    for (int i=0; i<nx; i++)
+        for (int j=0; j<ny; j++) {
+            int k = i % 2 ? ny - 1 - j : j;
+            ScanPoint point = { x[0] + i * x[2], y[0] + k * y[2] };
+            points->push_back(point);
+        }
+    return EXIT_SUCCESS;
+}
+
+int scanList(const char *path, std::vector<ScanPoint> *points)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        fprintf(stderr, "ERROR: Cannot open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    char line[256];
+    int number = 0;
+    while (fgets(line, sizeof(line), f)) {
+        number++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0')
+            continue;
+        for (char *c = p; *c; c++)
+            if (*c == ',')
+                *c = ' ';
+        ScanPoint point;
+        if (sscanf(p, "%d %d", &point.x, &point.y) != 2) {
+            fprintf(stderr, "ERROR: %s:%d: expected \"x y\"\n", path, number);
+            fclose(f);
+            return EXIT_FAILURE;
+        }
+        points->push_back(point);
+    }
+    fclose(f);
+    return EXIT_SUCCESS;
+}
+
+void scanSpiral(const ScanPoint &center, int step, int radius, std::vector<ScanPoint> *path)
+{
+    // Legs of 1, 1, 2, 2, 3, 3, ... steps turning left fill the square exactly
+    static const int dx[4] = { 1, 0, -1, 0 };
+    static const int dy[4] = { 0, 1, 0, -1 };
+    int64_t n = (int64_t) (2 * radius + 1) * (2 * radius + 1);
+    ScanPoint p = center;
+    path->push_back(p);
+    for (int leg = 0; (int64_t) path->size() < n; leg++)
+        for (int k = 0; k < leg / 2 + 1 && (int64_t) path->size() < n; k++) {
+            p.x += dx[leg % 4] * step;
+            p.y += dy[leg % 4] * step;
+            path->push_back(p);
+        }
+}
+
+void scanRaster(const ScanPoint &center, int step, int radius, const ScanPoint &from,
+                std::vector<ScanPoint> *path)
+{
+    int sx = from.x > center.x ? -1 : 1;
+    int sy = from.y > center.y ? -1 : 1;
+    for (int j = -radius; j <= radius; j++) {
+        int row = j + radius;
+        for (int i = -radius; i <= radius; i++) {
+            int k = row % 2 ? -i : i;
+            ScanPoint p = { center.x + sx * k * step, center.y + sy * j * step };
+            path->push_back(p);
+        }
+    }
+}
+
+void scanPathCost(const ScanPoint &from, const std::vector<ScanPoint> &path,
+                  int64_t *travel, int *reversals)
+{
+    *travel = 0;
+    *reversals = 0;
+    ScanPoint at = from;
+    int direction[2] = { 0, 0 };
+    for (size_t i=0; i<path.size(); i++) {
+        int d[2] = { path[i].x - at.x, path[i].y - at.y };
+        for (int a=0; a<2; a++) {
+            *travel += abs(d[a]);
+            int sign = (d[a] > 0) - (d[a] < 0);
+            if (sign && direction[a] && sign != direction[a])
+                (*reversals)++;
+            if (sign)
+                direction[a] = sign;
+        }
+        at = path[i];
+    }
+}
+
+Scanner::Scanner(PSDBus *bus, int board)
+{
+    bus_ = bus;
+    board_ = board;
+    memset(axis_, 0, sizeof(axis_));
+    dls_ = NULL;
+    window_ = 10;
+    settle_ms_ = 200;
+    detector_ = NULL;
+    settle_max_ms_ = 0;
+    memset(rest_ss_, 0, sizeof(rest_ss_));
+    rest_dof_ = 0;
+    timeout_ms_ = 1000;
+    tracking_ = false;
+}
+
+Scanner::~Scanner()
+{
+    end();
+}
+
+void Scanner::setAxis(int axis, Motor *motor)
+{
+    axis_[axis].motor = motor;
+    axis_[axis].twister = NULL;
+}
+
+void Scanner::setAxis(int axis, Twister *twister)
+{
+    axis_[axis].motor = NULL;
+    axis_[axis].twister = twister;
+}
+
+void Scanner::setDLS(DLS *dls)
+{
+    dls_ = dls;
+}
+
+void Scanner::setWindow(int samples)
+{
+    window_ = samples > 0 ? samples : 1;
+}
+
+void Scanner::setSettle(int ms)
+{
+    settle_ms_ = ms;
+}
+
+void Scanner::setSettleDetector(SettleDetector *detector, int max_ms)
+{
+    detector_ = detector;
+    settle_max_ms_ = max_ms;
+    memset(rest_ss_, 0, sizeof(rest_ss_));
+    rest_dof_ = 0;
+}
+
+void Scanner::setTimeout(int ms)
+{
+    timeout_ms_ = ms;
+}
+
+void Scanner::trackDLS()
+{
+    rtEnterThread(RT_ACQUIRE, "dls");
+    dls_->stopTracking();
+    dls_->startTracking();
+    while (tracking_) {
+        int distance = dls_->readTracking();
+        int64_t t = timestampNs();
+        if (distance < 0)
+            continue;
+        std::lock_guard<std::mutex> lock(mutex_);
+        distances_.push_back(std::make_pair(t, distance / 10.0));
+    }
+    dls_->stopTracking();
+}
+
+int Scanner::begin()
+{
+    if (dls_ && !tracking_) {
+        distances_.reserve(SCAN_DISTANCES);
+        tracking_ = true;
+        dls_thread_ = std::thread(&Scanner::trackDLS, this);
+    }
+    return EXIT_SUCCESS;
+}
+
+int Scanner::end()
+{
+    if (tracking_) {
+        tracking_ = false;
+        dls_thread_.join();
+    }
+    return EXIT_SUCCESS;
+}
+
+int Scanner::moveAxis(int axis, int position)
+{
+    if (axis_[axis].motor)
+        return axis_[axis].motor->setPosition(position);
+    if (axis_[axis].twister)
+        return axis_[axis].twister->setPosition(position);
+    return EXIT_SUCCESS;
+}
+
+int Scanner::moveTo(const ScanPoint &point)
+{
+    // setPosition() blocks until the axis is there: one thread per axis
+    int status_y = EXIT_SUCCESS;
+    std::thread y([&] { status_y = moveAxis(1, point.y); });
+    int status_x = moveAxis(0, point.x);
+    y.join();
+    if (status_x != EXIT_SUCCESS || status_y != EXIT_SUCCESS) {
+        fprintf(stderr, "ERROR: Scan: cannot move to %d, %d\n", point.x, point.y);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+ScanPoint Scanner::where()
+{
+    int p[2] = { 0, 0 };
+    for (int a=0; a<2; a++) {
+        if (axis_[a].motor)
+            p[a] = axis_[a].motor->getPosition();
+        else if (axis_[a].twister)
+            p[a] = axis_[a].twister->getPosition();
+    }
+    ScanPoint point = { p[0], p[1] };
+    return point;
+}
+
+int Scanner::position(const ScanPoint &point, ScanRow *row, Window *window)
+{
+    memset(row, 0, sizeof(*row));
+    row->point = point;
+
+    if (detector_) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (rest_dof_) {
+            double rest[4];
+            for (int c=0; c<4; c++)
+                rest[c] = rest_ss_[c] / rest_dof_;
+            detector_->setNoise(rest);
+        }
+    }
+
+    int64_t t0 = timestampNs();
+    if (moveTo(point) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    int64_t t1 = timestampNs();
+
+    uint64_t cursor = bus_->head();
+    PSDSample samples[256];
+    if (detector_) {
+        detector_->reset(t1);
+        int64_t give_up = t1 + (int64_t) settle_max_ms_ * 1000000;
+        while (!detector_->settled() && timestampNs() < give_up) {
+            if (!bus_->wait(cursor, timeout_ms_)) {
+                fprintf(stderr, "ERROR: Scan: no PSD sample for %d ms at %d, %d\n",
+                        timeout_ms_, point.x, point.y);
+                return EXIT_FAILURE;
+            }
+            size_t got = bus_->read(&cursor, samples, 256);
+            for (size_t i=0; i<got; i++)
+                if (samples[i].board == (uint32_t) board_)
+                    detector_->add(samples[i]);
+        }
+        row->settle_timeout = !detector_->settled();
+    } else {
+        struct timespec settle = { settle_ms_ / 1000, (settle_ms_ % 1000) * 1000000L };
+        while (nanosleep(&settle, &settle) != 0 && errno == EINTR);
+    }
+    int64_t t2 = timestampNs();
+
+    window->cursor = bus_->head();
+    window->start_ns = t2;
+    row->move_ns = t1 - t0;
+    row->settle_ns = t2 - t1;
+    return EXIT_SUCCESS;
+}
+
+int Scanner::acquire(const ScanPoint &point, ScanRow *row, Window *window)
+{
+    // Only counts: the window's end is the timestamp of its last sample
+    uint64_t cursor = window->cursor;
+    PSDSample samples[256];
+    uint64_t n = 0;
+    while (n < (uint64_t) window_) {
+        if (!bus_->wait(cursor, timeout_ms_)) {
+            fprintf(stderr, "ERROR: Scan: no PSD sample for %d ms at %d, %d\n",
+                    timeout_ms_, point.x, point.y);
+            return EXIT_FAILURE;
+        }
+        size_t got = bus_->read(&cursor, samples, 256);
+        for (size_t i=0; i<got && n < (uint64_t) window_; i++)
+            if (samples[i].board == (uint32_t) board_ && samples[i].t_ns >= window->start_ns) {
+                window->end_ns = samples[i].t_ns;
+                n++;
+            }
+    }
+    window->samples = n;
+    row->acquire_ns = timestampNs() - window->start_ns;
+    return EXIT_SUCCESS;
+}
+
+int Scanner::reduce(const Window &window, ScanRow *row)
+{
+    int64_t t0 = timestampNs();
+    uint64_t cursor = window.cursor;
+    uint64_t lost = 0;
+    PSDSample samples[256];
+    double sum[4] = {0}, sq[4] = {0}, sigma_sq[4] = {0};
+    bool sent_sigma = false;
+    uint64_t n = 0;
+    while (n < window.samples) {
+        size_t got = bus_->read(&cursor, samples, 256, &lost);
+        if (lost) {
+            fprintf(stderr, "ERROR: Scan: the window at %d, %d left the bus before it was averaged\n",
+                    row->point.x, row->point.y);
+            return EXIT_FAILURE;
+        }
+        if (got == 0) {
+            fprintf(stderr, "ERROR: Scan: the window at %d, %d is incomplete\n", row->point.x, row->point.y);
+            return EXIT_FAILURE;
+        }
+        for (size_t i=0; i<got; i++) {
+            const PSDSample &s = samples[i];
+            if (s.board != (uint32_t) board_ || s.t_ns < window.start_ns || s.t_ns > window.end_ns)
+                continue;
+            double v[4] = { s.x[0], s.y[0], s.x[1], s.y[1] };
+            for (int c=0; c<4; c++) {
+                sum[c] += v[c];
+                sq[c] += v[c] * v[c];
+                sigma_sq[c] += s.sigma[c] * s.sigma[c];
+                if (s.sigma[c] != 0)
+                    sent_sigma = true;
+            }
+            n++;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    row->samples = n;
+    bool learn = detector_ && !row->settle_timeout && n > 1;
+    if (learn)
+        rest_dof_ += n - 1;
+    for (int c=0; c<4; c++) {
+        row->psd[c] = sum[c] / n;
+        // Boards without sigma columns: the scatter of the window instead
+        double variance = n > 1 ? (sq[c] - sum[c] * sum[c] / n) / (n - 1) : 0;
+        double mean_sq = sent_sigma ? sigma_sq[c] / n : (variance > 0 ? variance : 0);
+        row->sigma[c] = sqrt(mean_sq) / sqrt((double) n);
+        if (learn)
+            rest_ss_[c] += (variance > 0 ? variance : 0) * (n - 1);
+    }
+
+    row->distance = row->distance_sigma = NAN;
+    if (dls_) {
+        double d_sum = 0, d_sq = 0;
+        uint64_t m = 0;
+        size_t used = 0;
+        for (size_t i=0; i<distances_.size(); i++) {
+            if (distances_[i].first > window.end_ns)
+                break;
+            used = i + 1;
+            if (distances_[i].first >= window.start_ns) {
+                d_sum += distances_[i].second;
+                d_sq += distances_[i].second * distances_[i].second;
+                m++;
+            }
+        }
+        // Later readings belong to the next points
+        distances_.erase(distances_.begin(), distances_.begin() + used);
+        row->distance_samples = m;
+        if (m) {
+            row->distance = d_sum / m;
+            double variance = m > 1 ? (d_sq - d_sum * d_sum / m) / (m - 1) : 0;
+            row->distance_sigma = sqrt(variance > 0 ? variance : 0) / sqrt((double) m);
+        }
+    }
+    row->reduce_ns = timestampNs() - t0;
+    return EXIT_SUCCESS;
+}
+
+int Scanner::measure(const ScanPoint &point, ScanRow *row)
+{
+    Window window;
+    if (position(point, row, &window) != EXIT_SUCCESS ||
+        acquire(point, row, &window) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    return reduce(window, row);
+}
+
+size_t Scanner::run(const std::vector<ScanPoint> &points, bool pipelined,
+                    std::function<void(size_t, const ScanRow &)> sink, ScanTiming *timing)
+{
+    memset(timing, 0, sizeof(*timing));
+    int64_t t0 = timestampNs();
+
+    struct Job {
+        size_t index;
+        Window window;
+        ScanRow row;
+    };
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Job> queue;
+    bool closed = false;
+    std::atomic<bool> failed(false);
+    size_t reduced = 0;
+
+    auto finish = [&](Job &job) {
+        if (failed || reduce(job.window, &job.row) != EXIT_SUCCESS) {
+            failed = true;
+            return;
+        }
+        int64_t t = timestampNs();
+        sink(job.index, job.row);
+        job.row.reduce_ns += timestampNs() - t;
+        timing->reduce_ns += job.row.reduce_ns;
+        reduced++;
+    };
+
+    std::thread worker;
+    if (pipelined)
+        worker = std::thread([&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                cond.wait(lock, [&] { return closed || !queue.empty(); });
+                if (queue.empty())
+                    break;
+                Job job = queue.front();
+                queue.pop_front();
+                cond.notify_all();
+                lock.unlock();
+                finish(job);
+                lock.lock();
+            }
+        });
+
+    for (size_t i=0; i<points.size() && !failed; i++) {
+        Job job;
+        job.index = i;
+        if (position(points[i], &job.row, &job.window) != EXIT_SUCCESS ||
+            acquire(points[i], &job.row, &job.window) != EXIT_SUCCESS) {
+            failed = true;
+            break;
+        }
+        timing->move_ns += job.row.move_ns;
+        timing->settle_ns += job.row.settle_ns;
+        timing->acquire_ns += job.row.acquire_ns;
+        timing->points++;
+
+        if (!pipelined) {
+            finish(job);
+            continue;
+        }
+        int64_t t = timestampNs();
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return queue.size() < SCAN_QUEUE; });
+        timing->stall_ns += timestampNs() - t;
+        queue.push_back(job);
+        cond.notify_all();
+    }
+
+    if (pipelined) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+            cond.notify_all();
+        }
+        worker.join();
+    }
+    timing->wall_ns = timestampNs() - t0;
+    return reduced;
+}
+
+int Scanner::watchSpot(uint64_t cursor, const SpotCriterion &spot)
+{
+    int64_t until = timestampNs() + (int64_t) spot.dwell_ms * 1000000;
+    PSDSample samples[256];
+    int valid = 0, seen = 0;
+    while (true) {
+        if (!bus_->wait(cursor, timeout_ms_)) {
+            fprintf(stderr, "ERROR: Scan: no PSD sample for %d ms while searching\n", timeout_ms_);
+            return -1;
+        }
+        size_t got = bus_->read(&cursor, samples, 256);
+        for (size_t i=0; i<got; i++) {
+            const PSDSample &s = samples[i];
+            if (s.board != (uint32_t) board_)
+                continue;
+            seen++;
+            double x = s.x[spot.detector], y = s.y[spot.detector];
+            // NaN compares false: a broken line is not a spot
+            if (fabs(x) < spot.limit && fabs(y) < spot.limit)
+                valid++;
+            else
+                valid = 0;
+            if (valid >= spot.hold)
+                return 1;
+        }
+        // At least hold samples, however short the dwell
+        if (seen >= spot.hold && valid == 0 && timestampNs() >= until)
+            return 0;
+    }
+}
+
+int Scanner::search(const std::vector<ScanPoint> &path, const SpotCriterion &spot,
+                    SearchResult *result)
+{
+    memset(result, 0, sizeof(*result));
+    int64_t t0 = timestampNs();
+    ScanPoint from = where();
+    result->at = from;
+    std::vector<ScanPoint> visited;
+
+    // Maybe it is already there
+    int found = watchSpot(bus_->head(), spot);
+    for (size_t i=0; found == 0 && i<path.size(); i++) {
+        if (path[i].x == result->at.x && path[i].y == result->at.y)
+            continue;
+        if (moveTo(path[i]) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+        visited.push_back(path[i]);
+        result->at = path[i];
+        // Only samples from after the move count
+        found = watchSpot(bus_->head(), spot);
+    }
+    result->found = found > 0;
+    result->moves = visited.size();
+    scanPathCost(from, visited, &result->travel, &result->reversals);
+    result->ns = timestampNs() - t0;
+    return found < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+void Scanner::writeHeader(FILE *f) const
+{
+    fprintf(f, "X0, Y0, X1, Y1, σ_X0, σ_Y0, σ_X1, σ_Y1,Actuator_x, Actuator_y%s\n",
+            dls_ ? ", Distance, σ_Distance" : "");
+}
+
+void Scanner::writeRow(FILE *f, const ScanRow &row) const
+{
+    // PSD_GUI save_data() formatting
+    fprintf(f, "%.4e, %.4e,%.4e, %.4e, ", row.psd[0], row.psd[1], row.psd[2], row.psd[3]);
+    fprintf(f, "%.5e,%.5e,%.5e, %.5e, ", row.sigma[0], row.sigma[1], row.sigma[2], row.sigma[3]);
+    fprintf(f, "%.4e, %.4e", (double) row.point.x, (double) row.point.y);
+    if (dls_)
+        fprintf(f, ", %.4e, %.5e", row.distance, row.distance_sigma);
+    fprintf(f, "\n");
+}
+
+int Scanner::logRow(SampleLogWriter *log, uint32_t seq, const ScanRow &row) const
+{
+    double v[10];
+    memcpy(v, row.psd, sizeof(row.psd));
+    memcpy(v + 4, row.sigma, sizeof(row.sigma));
+    v[8] = row.point.x;
+    v[9] = row.point.y;
+    return log->append(timestampNs(), LOG_ROW, board_, seq, v, 10);
+}
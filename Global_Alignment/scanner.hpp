@@ -0,0 +1,220 @@
+#ifndef _SCANNER_HPP_
+#define _SCANNER_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "dls.hpp"
+#include "piusb.hpp"
+#include "psd.hpp"
+#include "samplelog.hpp"
+#include "settle.hpp"
+
+/* One set-point of the two actuators, in steps */
+struct ScanPoint {
+    int x;
+    int y;
+};
+
+/*
+ * "from:to:step" for x, then for y, e.g. "0:100:10,-50:50:25". The y axis
+ * goes back and forth (serpentine) so x never travels back across the grid.
+ * Returns EXIT_FAILURE on a malformed spec.
+ */
+int scanGrid(const char *spec, std::vector<ScanPoint> *points);
+
+/* "x y" per line (commas or blanks), '#' comments. Returns EXIT_FAILURE if unreadable */
+int scanList(const char *path, std::vector<ScanPoint> *points);
+
+/*
+ * Search paths over the square of half-width radius around center, one
+ * step between neighbours so every move is a single step:
+ *
+ *    spiral   outward square rings, nearest points first; each axis turns
+ *             round once per ring
+ *    raster   serpentine rows in x from the corner nearest `from`; y
+ *             never turns, x once per row
+ */
+void scanSpiral(const ScanPoint &center, int step, int radius, std::vector<ScanPoint> *path);
+void scanRaster(const ScanPoint &center, int step, int radius, const ScanPoint &from,
+                std::vector<ScanPoint> *path);
+
+/* Steps travelled (both axes) and direction reversals along path, starting at from */
+void scanPathCost(const ScanPoint &from, const std::vector<ScanPoint> &path,
+                  int64_t *travel, int *reversals);
+
+/* A data*.txt row and how long it took */
+struct ScanRow {
+    ScanPoint point;
+    double psd[4];              // x0 y0 x1 y1 window mean
+    double sigma[4];            // the GUI's sqrt(mean(sigma^2)) / sqrt(n)
+    uint64_t samples;
+    double distance;            // DLS window mean [mm], NaN without a DLS
+    double distance_sigma;
+    uint64_t distance_samples;
+    int64_t move_ns;
+    int64_t settle_ns;
+    bool settle_timeout;        // the detector gave up at its limit
+    int64_t acquire_ns;
+    int64_t reduce_ns;          // averaging and the sink, possibly on the worker
+};
+
+/* Where a scan's time went */
+struct ScanTiming {
+    size_t points;
+    int64_t wall_ns;
+    int64_t move_ns;
+    int64_t settle_ns;
+    int64_t acquire_ns;
+    int64_t reduce_ns;
+    int64_t stall_ns;           // pipelined: waiting for a full queue to drain
+};
+
+/* When the beam is on a detector of the board */
+struct SpotCriterion {
+    int detector;               // 0: x0/y0, 1: x1/y1
+    double limit;               // |x| and |y| below it; off the PSD they saturate
+    int hold;                   // samples in a row
+    int dwell_ms;               // longest wait for them after each move
+};
+
+struct SearchResult {
+    bool found;
+    ScanPoint at;
+    size_t moves;
+    int64_t travel;             // steps, both axes
+    int reversals;
+    int64_t ns;
+};
+
+/* Rows handed to the worker before the next move has to wait */
+#define SCAN_QUEUE 8
+
+/* DLS readings reserved up front, so the tracking thread does not allocate */
+#define SCAN_DISTANCES 4096
+
+/*
+ * Replaces setting Actuator_x/Actuator_y by hand and clicking "Save Data":
+ * drives the actuators to every set-point (both at once), waits settle_ms
+ * or until a SettleDetector sees the centroids at rest, averages the next
+ * window PSD samples of one board (and the DLS over the same time) and
+ * appends the row in the data*.txt layout.
+ *
+ * An axis may be a USB-MO Motor, the USB-Twister or nothing (the column
+ * then keeps the set-point). The scanner only borrows the devices.
+ *
+ * A window is the samples of the board with timestamps from the end of
+ * the settle to the window-th sample; it is cut by timestamp from the
+ * bus, so it can be averaged after the actuators have moved on.
+ */
+class Scanner {
+    public:
+        Scanner(PSDBus *bus, int board = 0);
+        ~Scanner();
+
+        void setAxis(int axis, Motor *motor);
+        void setAxis(int axis, Twister *twister);
+
+        /* Tracks the DLS from its own thread between begin() and end() */
+        void setDLS(DLS *dls);
+
+        /* Samples averaged per point (the GUI's moving average window) */
+        void setWindow(int samples);
+        void setSettle(int ms);
+
+        /*
+         * Settles on the PSD stream instead, giving up after max_ms. The
+         * scatter of every window acquired after settling is pooled into
+         * the detector's noise at rest.
+         */
+        void setSettleDetector(SettleDetector *detector, int max_ms);
+
+        /* No PSD sample for this long while acquiring fails the point */
+        void setTimeout(int ms);
+
+        int begin();
+        int end();
+
+        /* Moves, settles, acquires. EXIT_FAILURE if the PSD stayed silent */
+        int measure(const ScanPoint &point, ScanRow *row);
+
+        /*
+         * measure() for every point, handing the rows to sink in order.
+         * Pipelined, the averaging and the sink run on a worker thread
+         * while the move to the next point is already issued. Returns the
+         * number of points done.
+         */
+        size_t run(const std::vector<ScanPoint> &points, bool pipelined,
+                   std::function<void(size_t, const ScanRow &)> sink, ScanTiming *timing);
+
+        /*
+         * Beam acquisition: checks the spot where the actuators are, then
+         * moves along path until it is on the detector and stops there.
+         * EXIT_FAILURE on a device error or a silent PSD; not finding the
+         * spot is result->found = false.
+         */
+        int search(const std::vector<ScanPoint> &path, const SpotCriterion &spot,
+                   SearchResult *result);
+
+        /* Where the actuators are (an axis without a device reads 0) */
+        ScanPoint where();
+
+        /* The GUI's header; with a DLS ", Distance, σ_Distance" is appended */
+        void writeHeader(FILE *f) const;
+        void writeRow(FILE *f, const ScanRow &row) const;
+
+        /* The same row as a LOG_ROW record (logconv --to-csv prints it back) */
+        int logRow(SampleLogWriter *log, uint32_t seq, const ScanRow &row) const;
+
+    private:
+        struct Axis {
+            Motor *motor;
+            Twister *twister;
+        };
+
+        struct Window {
+            uint64_t cursor;    // bus position from before start_ns
+            int64_t start_ns;
+            int64_t end_ns;
+            uint64_t samples;
+        };
+
+        int moveAxis(int axis, int position);
+        int moveTo(const ScanPoint &point);
+
+        /* Reads the bus from cursor: 1 spot found, 0 not within dwell_ms, -1 silent PSD */
+        int watchSpot(uint64_t cursor, const SpotCriterion &spot);
+        void trackDLS();
+
+        /* The three stages of measure() */
+        int position(const ScanPoint &point, ScanRow *row, Window *window);
+        int acquire(const ScanPoint &point, ScanRow *row, Window *window);
+        int reduce(const Window &window, ScanRow *row);
+
+        PSDBus *bus_;
+        int board_;
+        Axis axis_[2];
+        DLS *dls_;
+        int window_;
+        int settle_ms_;
+        SettleDetector *detector_;
+        int settle_max_ms_;
+        int timeout_ms_;
+
+        // Written by reduce(), possibly on the worker
+        std::mutex mutex_;
+        double rest_ss_[4];     // pooled sum of squares of the settled windows
+        uint64_t rest_dof_;
+        std::vector<std::pair<int64_t, double> > distances_;
+
+        std::atomic<bool> tracking_;
+        std::thread dls_thread_;
+};
+
+#endif
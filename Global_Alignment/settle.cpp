@@ -0,0 +1,127 @@
+#include "settle.hpp"
+
+#include <math.h>
+#include <string.h>
+
+SettleDetector::SettleDetector(int window, double max_t, double max_ratio, double max_drift,
+                               int hold)
+{
+    window_ = window < 3 ? 3 : window;
+    max_t_ = max_t;
+    max_ratio_ = max_ratio;
+    max_drift_ = max_drift;
+    hold_ = hold < 1 ? 1 : hold;
+    memset(noise_, 0, sizeof(noise_));
+    ring_.resize(window_);
+    reset(0);
+}
+
+void SettleDetector::setNoise(const double variance[4])
+{
+    memcpy(noise_, variance, sizeof(noise_));
+}
+
+void SettleDetector::reset(int64_t t_ns)
+{
+    count_ = 0;
+    passed_ = 0;
+    start_ns_ = t_ns;
+    settled_ns_ = -1;
+    trend_ = ratio_ = NAN;
+}
+
+bool SettleDetector::test()
+{
+    // Sample index as the abscissa: the boards stream at a steady rate
+    const double n = window_;
+    const double mean_i = (n - 1) / 2;
+    const double sxx = n * (n * n - 1) / 12;
+
+    double worst_t = 0, worst_ratio = 0;
+    bool pass = true;
+    for (int c=0; c<4; c++) {
+        double mean = 0;
+        for (int k=0; k<window_; k++)
+            mean += ring_[k].v[c];
+        mean /= n;
+
+        double sxy = 0, syy = 0;
+        for (int k=0; k<window_; k++) {
+            // Oldest first: the ring's slot of the k-th oldest sample
+            const Point &p = ring_[(count_ + k) % window_];
+            double dy = p.v[c] - mean;
+            sxy += (k - mean_i) * dy;
+            syy += dy * dy;
+        }
+
+        double slope = sxy / sxx;
+        double residual = (syy - slope * sxy) / (n - 2);
+        double t = residual > 0 ? fabs(slope) / sqrt(residual / sxx) : (slope != 0 ? INFINITY : 0);
+        if (t > worst_t)
+            worst_t = t;
+        if (t > max_t_)
+            pass = false;
+
+        double rest = noise_[c];
+        if (rest > 0) {
+            // Movement across the window, in noise units
+            if (fabs(slope) * (n - 1) > max_drift_ * sqrt(rest))
+                pass = false;
+            double ratio = syy / (n - 1) / rest;
+            if (ratio > worst_ratio)
+                worst_ratio = ratio;
+            if (ratio > max_ratio_)
+                pass = false;
+        }
+    }
+    trend_ = worst_t;
+    ratio_ = worst_ratio;
+    return pass;
+}
+
+bool SettleDetector::add(const PSDSample &sample)
+{
+    if (settled_ns_ >= 0)
+        return true;
+    if (sample.t_ns < start_ns_)
+        return false;
+
+    Point &p = ring_[count_ % window_];
+    p.t_ns = sample.t_ns;
+    double v[4] = { sample.x[0], sample.y[0], sample.x[1], sample.y[1] };
+    for (int c=0; c<4; c++)
+        p.v[c] = v[c];
+    count_++;
+    if (count_ < (uint64_t) window_)
+        return false;
+
+    passed_ = test() ? passed_ + 1 : 0;
+    if (passed_ >= hold_)
+        settled_ns_ = sample.t_ns - start_ns_;
+    return settled_ns_ >= 0;
+}
+
+bool SettleDetector::settled() const
+{
+    return settled_ns_ >= 0;
+}
+
+int64_t SettleDetector::settleNs() const
+{
+    return settled_ns_;
+}
+
+double SettleDetector::trend() const
+{
+    return trend_;
+}
+
+double SettleDetector::ratio() const
+{
+    return ratio_;
+}
+
+int SettleDetector::window() const
+{
+    return window_;
+}
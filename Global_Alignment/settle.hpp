@@ -0,0 +1,78 @@
+#ifndef _SETTLE_HPP_
+#define _SETTLE_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "psd.hpp"
+
+/*
+ * Tells when the PSD centroids have stopped moving after an actuator
+ * move, instead of waiting a fixed conservative time.
+ *
+ * Over the last `window` samples, each channel (x0, y0, x1, y1) must pass
+ * three tests:
+ *
+ *    trend     the least-squares slope is within max_t standard errors
+ *              of zero (creep, the tail of the move)
+ *    drift     the fitted line moves less than max_drift sigma at rest
+ *              across the window (creep too slow for the trend test)
+ *    variance  the scatter is at most max_ratio times the variance of
+ *              the centroid at rest (ringing, vibration)
+ *
+ * The variance at rest comes from setNoise(), measured on a window known
+ * to be still (the boards' own sigma column is not trusted for this);
+ * until then only the trend is tested. All must hold for `hold` samples
+ * in a row.
+ */
+class SettleDetector {
+    public:
+        SettleDetector(int window = 20, double max_t = 3.0, double max_ratio = 2.0,
+                       double max_drift = 1.0, int hold = 3);
+
+        /* Per-sample variance of x0, y0, x1, y1 at rest (0: unknown) */
+        void setNoise(const double variance[4]);
+
+        /* The move ended at t_ns: forget the samples before */
+        void reset(int64_t t_ns);
+
+        /* Returns true once settled */
+        bool add(const PSDSample &sample);
+
+        bool settled() const;
+
+        /* From reset() to the sample that completed the test, -1 if not settled */
+        int64_t settleNs() const;
+
+        /* Of the worst channel in the last full window */
+        double trend() const;
+        double ratio() const;
+
+        int window() const;
+
+    private:
+        struct Point {
+            int64_t t_ns;
+            double v[4];
+        };
+
+        bool test();
+
+        int window_;
+        double max_t_;
+        double max_ratio_;
+        double max_drift_;
+        int hold_;
+        double noise_[4];
+
+        std::vector<Point> ring_;
+        uint64_t count_;
+        int passed_;
+        int64_t start_ns_;
+        int64_t settled_ns_;
+        double trend_;
+        double ratio_;
+};
+
+#endif
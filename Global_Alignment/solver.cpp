@@ -0,0 +1,216 @@
+#include "solver.hpp"
+#include "timestamp.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+AlignSolver::AlignSolver(Measure measure)
+{
+    measure_ = measure;
+    have_jacobian_ = false;
+    memset(jacobian_, 0, sizeof(jacobian_));
+    probe_ = 10;
+    tolerance_ = 1e-3;
+    radius_ = 100;
+    max_radius_ = 1000;
+    max_moves_ = 30;
+    gain_ = 0;
+    start_ns_ = 0;
+}
+
+void AlignSolver::setJacobian(const double jacobian[2][2])
+{
+    memcpy(jacobian_, jacobian, sizeof(jacobian_));
+    have_jacobian_ = true;
+}
+
+void AlignSolver::setProbe(int steps)
+{
+    probe_ = steps;
+}
+
+void AlignSolver::setTolerance(double tolerance)
+{
+    tolerance_ = tolerance;
+}
+
+void AlignSolver::setTrustRadius(double initial, double max)
+{
+    radius_ = initial;
+    max_radius_ = max;
+}
+
+void AlignSolver::setMaxMoves(int moves)
+{
+    max_moves_ = moves;
+}
+
+void AlignSolver::setFixedGain(double gain)
+{
+    gain_ = gain;
+}
+
+static double norm2(const double r[2])
+{
+    return r[0] * r[0] + r[1] * r[1];
+}
+
+/*
+ * Measures at point and records it, counting a move unless it is where the
+ * actuators already are. EXIT_FAILURE if the measurement failed
+ */
+static int record(AlignSolver::Measure &measure, const ScanPoint &point, double r[2],
+                  double radius, double rho, bool accepted, int64_t start_ns, AlignResult *result,
+                  bool move = true)
+{
+    if (measure(point, r) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    AlignStep s;
+    s.at = point;
+    s.r[0] = r[0];
+    s.r[1] = r[1];
+    s.radius = radius;
+    s.rho = rho;
+    s.accepted = accepted;
+    s.t_ns = timestampNs() - start_ns;
+    result->steps.push_back(s);
+    if (move)
+        result->moves++;
+    return EXIT_SUCCESS;
+}
+
+int AlignSolver::probe(const ScanPoint &at, const double r[2], AlignResult *result)
+{
+    // One axis, then the other from there: no move back
+    ScanPoint a = { at.x + probe_, at.y };
+    ScanPoint b = { at.x + probe_, at.y + probe_ };
+    double ra[2], rb[2];
+    if (record(measure_, a, ra, 0, NAN, true, start_ns_, result) != EXIT_SUCCESS ||
+        record(measure_, b, rb, 0, NAN, true, start_ns_, result) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    for (int i=0; i<2; i++) {
+        result->jacobian[i][0] = (ra[i] - r[i]) / probe_;
+        result->jacobian[i][1] = (rb[i] - ra[i]) / probe_;
+    }
+    result->at = b;
+    result->r[0] = rb[0];
+    result->r[1] = rb[1];
+    return EXIT_SUCCESS;
+}
+
+int AlignSolver::align(const ScanPoint &start, AlignResult *result)
+{
+    result->converged = false;
+    result->iterations = 0;
+    result->moves = 0;
+    result->steps.clear();
+    start_ns_ = timestampNs();
+
+    result->at = start;
+    if (record(measure_, start, result->r, 0, NAN, true, start_ns_, result, false) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    if (have_jacobian_)
+        memcpy(result->jacobian, jacobian_, sizeof(jacobian_));
+    else if (probe(start, result->r, result) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    double (*J)[2] = result->jacobian;
+    double *r = result->r;
+    double radius = radius_;
+    while (result->moves < max_moves_) {
+        if (fabs(r[0]) < tolerance_ && fabs(r[1]) < tolerance_) {
+            result->converged = true;
+            break;
+        }
+        result->iterations++;
+
+        double det = J[0][0] * J[1][1] - J[0][1] * J[1][0];
+        if (fabs(det) < 1e-30) {
+            fprintf(stderr, "ERROR: Align: the Jacobian is singular\n");
+            break;
+        }
+        // Newton step -J^-1 r, then the gain or the trust region
+        double dx[2] = { -( J[1][1] * r[0] - J[0][1] * r[1]) / det,
+                         -(-J[1][0] * r[0] + J[0][0] * r[1]) / det };
+        double limit = gain_ > 0 ? max_radius_ : radius;
+        if (gain_ > 0) {
+            dx[0] *= gain_;
+            dx[1] *= gain_;
+        }
+        double length = sqrt(dx[0] * dx[0] + dx[1] * dx[1]);
+        if (length > limit) {
+            dx[0] *= limit / length;
+            dx[1] *= limit / length;
+        }
+        int step[2] = { (int) lround(dx[0]), (int) lround(dx[1]) };
+        if (step[0] == 0 && step[1] == 0)
+            break;      // below one step: as close as the actuators get
+        length = sqrt((double) (step[0] * step[0] + step[1] * step[1]));
+
+        double predicted[2];
+        for (int i=0; i<2; i++)
+            predicted[i] = r[i] + J[i][0] * step[0] + J[i][1] * step[1];
+
+        ScanPoint next = { result->at.x + step[0], result->at.y + step[1] };
+        double r_new[2];
+        if (record(measure_, next, r_new, radius, NAN, true, start_ns_, result) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+
+        if (gain_ > 0) {
+            result->at = next;
+            r[0] = r_new[0];
+            r[1] = r_new[1];
+            continue;
+        }
+
+        // Broyden: J += (dr - J dx) dx^T / (dx^T dx)
+        double ss = step[0] * step[0] + step[1] * step[1];
+        for (int i=0; i<2; i++) {
+            double miss = r_new[i] - predicted[i];
+            J[i][0] += miss * step[0] / ss;
+            J[i][1] += miss * step[1] / ss;
+        }
+
+        double actual = norm2(r) - norm2(r_new);
+        double expected = norm2(r) - norm2(predicted);
+        double rho = expected > 0 ? actual / expected : (actual > 0 ? 1 : -1);
+        result->steps.back().rho = rho;
+        if (rho < 0.25)
+            radius = length / 4 > 1 ? length / 4 : 1;
+        else if (rho > 0.75 && length > 0.9 * radius)
+            radius = 2 * radius < max_radius_ ? 2 * radius : max_radius_;
+
+        bool done = fabs(r_new[0]) < tolerance_ && fabs(r_new[1]) < tolerance_;
+        if (actual > 0 || done) {
+            result->at = next;
+            r[0] = r_new[0];
+            r[1] = r_new[1];
+            continue;
+        }
+        // Worse: back to where it was
+        result->steps.back().accepted = false;
+        if (record(measure_, result->at, r, radius, NAN, true, start_ns_, result) != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+    if (fabs(r[0]) < tolerance_ && fabs(r[1]) < tolerance_)
+        result->converged = true;
+    result->ns = timestampNs() - start_ns_;
+    return EXIT_SUCCESS;
+}
+
+void AlignSolver::printResult(FILE *f, const AlignResult &result)
+{
+    fprintf(f, "%4s %7s %7s %11s %11s %7s %6s %9s\n", "move", "x", "y", "r_x", "r_y",
+            "radius", "rho", "ms");
+    for (size_t i=0; i<result.steps.size(); i++) {
+        const AlignStep &s = result.steps[i];
+        fprintf(f, "%4zu %7d %7d %+11.4e %+11.4e %7.1f %6.2f %9.1f%s\n", i, s.at.x, s.at.y,
+                s.r[0], s.r[1], s.radius, s.rho, s.t_ns * 1e-6, s.accepted ? "" : "  undone");
+    }
+    fprintf(f, "%s at %d, %d: |r| %.3e after %d iterations, %d moves, %.2f s\n",
+            result.converged ? "Converged" : "Not converged", result.at.x, result.at.y,
+            sqrt(norm2(result.r)), result.iterations, result.moves, result.ns * 1e-9);
+    fprintf(f, "Jacobian [per step]: %+.4e %+.4e / %+.4e %+.4e\n", result.jacobian[0][0],
+            result.jacobian[0][1], result.jacobian[1][0], result.jacobian[1][1]);
+}
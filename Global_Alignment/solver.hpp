@@ -0,0 +1,82 @@
+#ifndef _SOLVER_HPP_
+#define _SOLVER_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <functional>
+#include <vector>
+
+#include "scanner.hpp"
+
+/* One measured point of an alignment */
+struct AlignStep {
+    ScanPoint at;
+    double r[2];                // PSD minus target
+    double radius;              // trust radius the step was taken with [steps]
+    double rho;                 // actual / predicted reduction of |r|^2
+    bool accepted;
+    int64_t t_ns;               // since the start
+};
+
+struct AlignResult {
+    bool converged;
+    ScanPoint at;
+    double r[2];
+    int iterations;
+    int moves;
+    int64_t ns;
+    double jacobian[2][2];      // the last estimate, dr/dstep
+    std::vector<AlignStep> steps;
+};
+
+/*
+ * Drives two actuators until a PSD centroid (x, y) reaches its target.
+ *
+ * Quasi-Newton: the step is -J^-1 r, cut to a trust radius, rounded to
+ * whole steps. After every move J gets a Broyden rank-1 update from the
+ * step and the measured change of r, so it follows the coupling as it
+ * changes across the mirror's range. A step that makes |r| worse is
+ * undone and the radius shrinks; one that does as predicted grows it.
+ *
+ * J starts from setJacobian() or, without one, from a probe move on each
+ * axis. setFixedGain() instead keeps J and takes gain times the Newton
+ * step, the plain servo it replaces, for comparison.
+ *
+ * measure moves to a point, waits for it and fills r = PSD - target.
+ */
+class AlignSolver {
+    public:
+        typedef std::function<int(const ScanPoint &point, double r[2])> Measure;
+
+        AlignSolver(Measure measure);
+
+        void setJacobian(const double jacobian[2][2]);
+        void setProbe(int steps);
+
+        /* Converged when |r_x| and |r_y| are both below tolerance */
+        void setTolerance(double tolerance);
+        void setTrustRadius(double initial, double max);
+        void setMaxMoves(int moves);
+        void setFixedGain(double gain);
+
+        int align(const ScanPoint &start, AlignResult *result);
+
+        static void printResult(FILE *f, const AlignResult &result);
+
+    private:
+        int probe(const ScanPoint &at, const double r[2], AlignResult *result);
+
+        Measure measure_;
+        bool have_jacobian_;
+        double jacobian_[2][2];
+        int probe_;
+        double tolerance_;
+        double radius_;
+        double max_radius_;
+        int max_moves_;
+        double gain_;
+        int64_t start_ns_;
+};
+
+#endif
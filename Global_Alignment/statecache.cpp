@@ -0,0 +1,166 @@
+#include "statecache.hpp"
+#include "devlog.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+StateCache::StateCache(const char *path)
+{
+    if (path == NULL)
+        path = getenv("PIUSB_STATE");
+    if (path)
+        path_ = path;
+    else if (getenv("HOME"))
+        path_ = std::string(getenv("HOME")) + "/.piusb_state";
+}
+
+const char *StateCache::path() const
+{
+    return path_.c_str();
+}
+
+int StateCache::load()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    devices_.clear();
+    FILE *f = fopen(path_.c_str(), "r");
+    if (f == NULL)
+        return EXIT_SUCCESS;
+
+    char line[512];
+    char id[256];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#')
+            continue;
+
+        DeviceState s;
+        int confirmed, calibrated;
+        if (sscanf(line, "%255s %d %d %d %d %d", id, &s.position, &confirmed, &calibrated,
+                   &s.velocity, &s.relay) != 6) {
+            DEVLOG_WARN("{}: bad line {}", path_, line);
+            continue;
+        }
+        s.confirmed = confirmed;
+        s.calibrated = calibrated;
+        devices_[id] = s;
+    }
+    fclose(f);
+    return EXIT_SUCCESS;
+}
+
+int StateCache::save()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return saveLocked();
+}
+
+int StateCache::saveLocked()
+{
+    if (path_.empty())
+        return EXIT_FAILURE;
+
+    std::string tmp = path_ + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (f == NULL) {
+        DEVLOG_ERROR("Cannot write {}", tmp);
+        return EXIT_FAILURE;
+    }
+
+    fprintf(f, "# device position confirmed calibrated velocity relay\n");
+    for (std::map<std::string, DeviceState>::const_iterator i = devices_.begin(); i != devices_.end(); ++i) {
+        const DeviceState &s = i->second;
+        fprintf(f, "%s %d %d %d %d %d\n", i->first.c_str(), s.position, s.confirmed, s.calibrated,
+                s.velocity, s.relay);
+    }
+
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+
+    if (rename(tmp.c_str(), path_.c_str()) != 0) {
+        DEVLOG_ERROR("Cannot replace {}", path_);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+DeviceState &StateCache::entry(const std::string &id)
+{
+    std::map<std::string, DeviceState>::iterator i = devices_.find(id);
+    if (i == devices_.end()) {
+        DeviceState s = { 0, false, false, 0, -1 };
+        i = devices_.insert(std::make_pair(id, s)).first;
+    }
+    return i->second;
+}
+
+bool StateCache::lookup(const std::string &id, DeviceState *state)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, DeviceState>::const_iterator i = devices_.find(id);
+    if (i == devices_.end())
+        return false;
+    *state = i->second;
+    return true;
+}
+
+bool StateCache::verify(const std::string &id, int position)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (id.empty())
+        return false;
+    DeviceState &s = entry(id);
+    if (s.calibrated && s.confirmed && s.position == position && position != POWER_ON_POSITION)
+        return true;
+
+    if (s.calibrated) {
+        DEVLOG_WARN("{} at {}, expected {}{}: calibration dropped", id, position, s.position,
+                    !s.confirmed ? " (unfinished move)" :
+                    position == POWER_ON_POSITION ? " (may have been power-cycled)" : "");
+        s.calibrated = false;
+        saveLocked();
+    }
+    return false;
+}
+
+void StateCache::commanded(const std::string &id, int position, int velocity)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (id.empty())
+        return;
+    DeviceState &s = entry(id);
+    s.position = position;
+    s.confirmed = false;
+    s.velocity = velocity;
+    saveLocked();
+}
+
+void StateCache::confirmed(const std::string &id, int position, bool calibrated)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (id.empty())
+        return;
+    DeviceState &s = entry(id);
+    s.position = position;
+    s.confirmed = true;
+    if (calibrated)
+        s.calibrated = true;
+    saveLocked();
+}
+
+void StateCache::relay(const std::string &id, int bits)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (id.empty())
+        return;
+    entry(id).relay = bits;
+    saveLocked();
+}
+
+void StateCache::forget(const std::string &id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    devices_.erase(id);
+    saveLocked();
+}
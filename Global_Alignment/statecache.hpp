@@ -0,0 +1,71 @@
+#ifndef _STATECACHE_HPP_
+#define _STATECACHE_HPP_
+
+#include <map>
+#include <mutex>
+#include <string>
+
+class Picard;
+
+/* What a USB-MO or Twister counts after power-up: never taken as calibrated */
+#define POWER_ON_POSITION   0
+
+/* What is known of one Picard device between sessions */
+struct DeviceState {
+    int position;           // last commanded position (Motor, Twister)
+    bool confirmed;         // the device was seen at position
+    bool calibrated;        // calibrated since it was last seen powered up
+    int velocity;           // last velocity code, 0: unknown
+    int relay;              // relay bits, -1: unknown
+};
+
+/*
+ * Device state kept in a file across runs, one line per device id
+ * (Picard::usbId). Every change is saved at once through a temporary
+ * file and rename, so a crash leaves either the old or the new file.
+ *
+ * A move is saved as commanded before it is sent and confirmed once the
+ * device got there: a run killed mid-move leaves it unconfirmed, and the
+ * next run calibrates again.
+ *
+ * The file is PIUSB_STATE, or ~/.piusb_state.
+ */
+class StateCache {
+    public:
+        /* path NULL: PIUSB_STATE or ~/.piusb_state */
+        StateCache(const char *path = NULL);
+
+        /* Missing file: empty cache */
+        int load();
+        int save();
+
+        /* The entry of a device, false if there is none */
+        bool lookup(const std::string &id, DeviceState *state);
+
+        /*
+         * Handshake on open: the entry is calibrated and confirmed at
+         * the position the device reports, and that is not
+         * POWER_ON_POSITION, which a power-cycled device reads too.
+         * Anything else (power cycle, moved by hand, killed mid-move)
+         * drops the calibration, so calibration parks off that position.
+         */
+        bool verify(const std::string &id, int position);
+
+        /* Record and save a move before it is sent / once it arrived */
+        void commanded(const std::string &id, int position, int velocity);
+        void confirmed(const std::string &id, int position, bool calibrated = false);
+        void relay(const std::string &id, int bits);
+        void forget(const std::string &id);
+
+        const char *path() const;
+
+    private:
+        DeviceState &entry(const std::string &id);
+        int saveLocked();
+
+        std::mutex mutex_;
+        std::string path_;
+        std::map<std::string, DeviceState> devices_;
+};
+
+#endif
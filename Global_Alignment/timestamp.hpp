@@ -0,0 +1,28 @@
+#ifndef _TIMESTAMP_HPP_
+#define _TIMESTAMP_HPP_
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Shared clock for every acquisition path (PSD, DLS, actuators).
+ *
+ * CLOCK_MONOTONIC is system wide, so timestamps taken by separate
+ * processes can be merged onto one timeline.
+ */
+inline int64_t timestampNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Per-thread CPU time, used by the benchmarks */
+inline int64_t threadCpuNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#endif
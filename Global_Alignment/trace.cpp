@@ -0,0 +1,424 @@
+#include "trace.hpp"
+#include "timestamp.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BUFFER_SIZE (64 * 1024)
+
+static inline size_t padded(size_t length)
+{
+    return (length + 7) & ~(size_t) 7;
+}
+
+/*
+ * TraceWriter
+ */
+
+TraceWriter::TraceWriter()
+{
+    fd_ = -1;
+    used_ = 0;
+    channels_ = 0;
+}
+
+TraceWriter::~TraceWriter()
+{
+    close();
+}
+
+int TraceWriter::open(const char *path)
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    fd_ = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd_ < 0) {
+        fprintf(stderr, "ERROR: Cannot create %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    TraceHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    header.start_t_ns = timestampNs();
+
+    buffer_.resize(BUFFER_SIZE);
+    memcpy(&buffer_[0], &header, sizeof(header));
+    used_ = sizeof(header);
+    channels_ = 0;
+    return EXIT_SUCCESS;
+}
+
+int TraceWriter::close()
+{
+    if (fd_ < 0)
+        return EXIT_SUCCESS;
+
+    int status = flush();
+    std::lock_guard<std::mutex> lock(mutex_);
+    ::close(fd_);
+    fd_ = -1;
+    return status;
+}
+
+bool TraceWriter::isOpen() const
+{
+    return fd_ >= 0;
+}
+
+int TraceWriter::channel(const char *name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    int channel = channels_++;
+    put(channel, TRACE_NAME, name, strlen(name));
+    return channel;
+}
+
+void TraceWriter::record(int channel, int kind, const void *data, size_t length)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    put(channel, kind, data, length);
+}
+
+void TraceWriter::put(int channel, int kind, const void *data, size_t length)
+{
+    if (fd_ < 0)
+        return;
+
+    size_t bytes = sizeof(TraceEvent) + padded(length);
+    if (used_ + bytes > buffer_.size()) {
+        if (write(fd_, buffer_.data(), used_) != (ssize_t) used_)
+            fprintf(stderr, "ERROR: Trace write failed: %s\n", strerror(errno));
+        used_ = 0;
+        if (bytes > buffer_.size())
+            buffer_.resize(bytes);
+    }
+
+    TraceEvent event;
+    event.t_ns = timestampNs();
+    event.kind = kind;
+    event.channel = channel;
+    event.length = length;
+    memcpy(&buffer_[used_], &event, sizeof(event));
+    if (length)
+        memcpy(&buffer_[used_ + sizeof(event)], data, length);
+    memset(&buffer_[used_ + sizeof(event) + length], 0, padded(length) - length);
+    used_ += bytes;
+}
+
+int TraceWriter::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0)
+        return EXIT_FAILURE;
+    ssize_t written = write(fd_, buffer_.data(), used_);
+    bool ok = written == (ssize_t) used_;
+    used_ = 0;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static TraceWriter *writer = NULL;
+static bool writer_checked = false;
+static std::mutex writer_mutex;
+
+static void closeTrace()
+{
+    if (writer)
+        writer->close();
+}
+
+TraceWriter *traceWriter()
+{
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    if (!writer_checked) {
+        writer_checked = true;
+        const char *path = getenv("IOTRACE_FILE");
+        if (path && !writer) {
+            static TraceWriter env_writer;
+            if (env_writer.open(path) == EXIT_SUCCESS) {
+                writer = &env_writer;
+                atexit(closeTrace);
+            }
+        }
+    }
+    return writer;
+}
+
+void setTraceWriter(TraceWriter *w)
+{
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    writer = w;
+    writer_checked = true;
+}
+
+/*
+ * TraceReader
+ */
+
+TraceReader::TraceReader()
+{
+    map_ = NULL;
+    size_ = 0;
+}
+
+TraceReader::~TraceReader()
+{
+    close();
+}
+
+int TraceReader::open(const char *path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Cannot open %s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(TraceHeader)) {
+        fprintf(stderr, "ERROR: %s is not a trace\n", path);
+        ::close(fd);
+        return EXIT_FAILURE;
+    }
+
+    size_ = st.st_size;
+    void *map = mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Cannot map %s: %s\n", path, strerror(errno));
+        size_ = 0;
+        return EXIT_FAILURE;
+    }
+    map_ = (const char *) map;
+
+    const TraceHeader *h = (const TraceHeader *) map_;
+    if (memcmp(h->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || h->version != TRACE_VERSION) {
+        fprintf(stderr, "ERROR: %s is not a version %d trace\n", path, TRACE_VERSION);
+        close();
+        return EXIT_FAILURE;
+    }
+
+    // A trace cut short by a crash simply ends at the last whole event
+    size_t offset = sizeof(TraceHeader);
+    while (offset + sizeof(TraceEvent) <= size_) {
+        const TraceEvent *e = (const TraceEvent *) (map_ + offset);
+        size_t bytes = sizeof(TraceEvent) + padded(e->length);
+        if (offset + bytes > size_)
+            break;
+
+        if (e->kind == TRACE_NAME) {
+            if (e->channel >= names_.size()) {
+                names_.resize(e->channel + 1);
+                events_.resize(e->channel + 1);
+            }
+            names_[e->channel].assign((const char *) payload(e), e->length);
+        }
+        else if (e->channel < events_.size())
+            events_[e->channel].push_back(e);
+        offset += bytes;
+    }
+    return EXIT_SUCCESS;
+}
+
+int TraceReader::close()
+{
+    if (map_)
+        munmap((void *) map_, size_);
+    map_ = NULL;
+    size_ = 0;
+    names_.clear();
+    events_.clear();
+    return EXIT_SUCCESS;
+}
+
+int64_t TraceReader::startTime() const
+{
+    return ((const TraceHeader *) map_)->start_t_ns;
+}
+
+int TraceReader::channels() const
+{
+    return names_.size();
+}
+
+const char *TraceReader::name(int channel) const
+{
+    return names_[channel].c_str();
+}
+
+int TraceReader::channel(const char *name) const
+{
+    for (size_t i=0; i<names_.size(); i++)
+        if (names_[i] == name)
+            return i;
+    return -1;
+}
+
+const std::vector<const TraceEvent *> &TraceReader::events(int channel) const
+{
+    return events_[channel];
+}
+
+const uint8_t *TraceReader::payload(const TraceEvent *event)
+{
+    return (const uint8_t *) (event + 1);
+}
+
+/*
+ * TtyReplay
+ */
+
+TtyReplay::TtyReplay(const TraceReader *trace, int channel, bool paced)
+{
+    trace_ = trace;
+    channel_ = channel;
+    paced_ = paced;
+    master_ = -1;
+    stop_fd_ = -1;
+    slave_[0] = '\0';
+    base_ns_ = 0;
+    done_ = false;
+    memset(&stats_, 0, sizeof(stats_));
+}
+
+TtyReplay::~TtyReplay()
+{
+    stop();
+    if (master_ >= 0)
+        ::close(master_);
+    if (stop_fd_ >= 0)
+        ::close(stop_fd_);
+}
+
+const char *TtyReplay::open()
+{
+    master_ = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master_ < 0 || grantpt(master_) != 0 || unlockpt(master_) != 0) {
+        fprintf(stderr, "ERROR: Cannot create a pseudo terminal\n");
+        return NULL;
+    }
+    snprintf(slave_, sizeof(slave_), "%s", ptsname(master_));
+
+    // Raw, no echo: what the program writes must come back to us untouched
+    int slave = ::open(slave_, O_RDWR | O_NOCTTY);
+    struct termios tty;
+    if (slave >= 0 && tcgetattr(slave, &tty) == 0) {
+        cfmakeraw(&tty);
+        tcsetattr(slave, TCSANOW, &tty);
+    }
+    if (slave >= 0)
+        ::close(slave);
+
+    stop_fd_ = eventfd(0, EFD_NONBLOCK);
+    return slave_;
+}
+
+int TtyReplay::start(int64_t base_ns)
+{
+    if (master_ < 0)
+        return EXIT_FAILURE;
+    base_ns_ = base_ns;
+    done_ = false;
+    thread_ = std::thread(&TtyReplay::run, this);
+    return EXIT_SUCCESS;
+}
+
+bool TtyReplay::wait(int timeout_ms)
+{
+    int64_t end = timestampNs() + (int64_t) timeout_ms * 1000000;
+    while (!done_) {
+        if (timeout_ms >= 0 && timestampNs() > end)
+            return false;
+        usleep(1000);
+    }
+    return true;
+}
+
+int TtyReplay::stop()
+{
+    if (!thread_.joinable())
+        return EXIT_SUCCESS;
+    uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof(one)) != sizeof(one))
+        return EXIT_FAILURE;
+    thread_.join();
+    return EXIT_SUCCESS;
+}
+
+ReplayStats TtyReplay::stats() const
+{
+    return stats_;
+}
+
+void TtyReplay::run()
+{
+    const std::vector<const TraceEvent *> &events = trace_->events(channel_);
+    int64_t start = trace_->startTime();
+
+    struct pollfd fds[2];
+    fds[0].fd = master_;
+    fds[1].fd = stop_fd_;
+    fds[1].events = POLLIN;
+
+    std::vector<uint8_t> rx;
+    for (size_t i=0; i<events.size(); i++) {
+        const TraceEvent *e = events[i];
+        const uint8_t *data = TraceReader::payload(e);
+
+        if (e->kind == TRACE_TTY_RX) {
+            if (paced_) {
+                int64_t due = base_ns_ + (e->t_ns - start);
+                struct timespec ts = { (time_t) (due / 1000000000LL), (long) (due % 1000000000LL) };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+                int64_t late = timestampNs() - due;
+                if (late > stats_.max_late_ns)
+                    stats_.max_late_ns = late;
+            }
+            size_t off = 0;
+            while (off < e->length) {
+                fds[0].events = POLLOUT;
+                if (poll(fds, 2, -1) < 0 || (fds[1].revents & POLLIN))
+                    goto out;
+                ssize_t n = write(master_, data + off, e->length - off);
+                if (n > 0)
+                    off += n;
+            }
+        }
+        else if (e->kind == TRACE_TTY_TX) {
+            // Wait for the program to send what it sent in the recording
+            rx.resize(e->length);
+            size_t off = 0;
+            while (off < e->length) {
+                fds[0].events = POLLIN;
+                if (poll(fds, 2, -1) < 0 || (fds[1].revents & POLLIN))
+                    goto out;
+                ssize_t n = read(master_, &rx[off], e->length - off);
+                if (n > 0)
+                    off += n;
+            }
+            if (memcmp(rx.data(), data, e->length) != 0)
+                stats_.mismatches++;
+        }
+        else
+            continue;
+
+        stats_.events++;
+        stats_.bytes += e->length;
+    }
+out:
+    done_ = true;
+}
@@ -0,0 +1,161 @@
+#ifndef _TRACE_HPP_
+#define _TRACE_HPP_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * I/O traces: raw tty bytes and Picard USB transfers, timestamped, for
+ * replaying a real session without the hardware.
+ *
+ *    TraceHeader
+ *    TraceEvent + payload (padded to 8 bytes)
+ *    ...
+ *
+ * Every stream (a tty, one opened USB device) is a channel, introduced by
+ * a TRACE_NAME event whose payload is its name:
+ *    "/dev/ttyUSB0", "/dev/ttyACM1"         serial ports
+ *    "usb 0461:0020 #0"                     first USB-MO opened, ...
+ */
+
+#define TRACE_MAGIC     "STEWTRC"
+#define TRACE_VERSION   1
+
+enum TraceKind {
+    TRACE_NAME      = 0,    // payload: channel name
+    TRACE_TTY_RX    = 1,    // bytes read from the tty
+    TRACE_TTY_TX    = 2,    // bytes written to the tty
+    TRACE_USB_OPEN  = 3,
+    TRACE_USB_CLOSE = 4,
+    TRACE_USB_WRITE = 5,    // payload: the transfer
+    TRACE_USB_READ  = 6
+};
+
+struct TraceHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    int64_t  start_t_ns;    // timestampNs() when recording started
+};
+
+struct TraceEvent {
+    int64_t  t_ns;          // timestampNs() when the transfer completed
+    uint16_t kind;          // TraceKind
+    uint16_t channel;
+    uint32_t length;        // payload bytes
+};
+
+/* Appends events to a trace. Safe to share between threads */
+class TraceWriter {
+    public:
+        TraceWriter();
+        ~TraceWriter();
+
+        int open(const char *path);
+        int close();
+        bool isOpen() const;
+
+        /* Allocates a channel and records its name */
+        int channel(const char *name);
+
+        void record(int channel, int kind, const void *data, size_t length);
+
+        int flush();
+
+    private:
+        void put(int channel, int kind, const void *data, size_t length);
+
+        int fd_;
+        std::mutex mutex_;
+        std::vector<char> buffer_;
+        size_t used_;
+        int channels_;
+};
+
+/*
+ * The writer the libraries record into, set by the application or by the
+ * environment: IOTRACE_FILE=<file> starts a trace on first use (closed at
+ * exit). NULL when not recording.
+ */
+TraceWriter *traceWriter();
+void setTraceWriter(TraceWriter *writer);
+
+/* A trace through mmap */
+class TraceReader {
+    public:
+        TraceReader();
+        ~TraceReader();
+
+        int open(const char *path);
+        int close();
+
+        int64_t startTime() const;
+
+        int channels() const;
+        const char *name(int channel) const;
+        /* -1 if there is no such channel */
+        int channel(const char *name) const;
+
+        /* Events of one channel, in time order (TRACE_NAME excluded) */
+        const std::vector<const TraceEvent *> &events(int channel) const;
+
+        static const uint8_t *payload(const TraceEvent *event);
+
+    private:
+        const char *map_;
+        size_t size_;
+        std::vector<std::string> names_;
+        std::vector<std::vector<const TraceEvent *> > events_;
+};
+
+struct ReplayStats {
+    uint64_t events;
+    uint64_t bytes;
+    uint64_t mismatches;    // writes that differ from the recording
+    int64_t  max_late_ns;   // paced replay: worst delay behind the recorded time
+};
+
+/*
+ * Plays a recorded tty channel on a pseudo terminal: RX bytes are written
+ * for the program to read, TX bytes are waited for (and compared) before
+ * going on, so request/response devices like the DLS stay in step.
+ *
+ * Paced replay keeps the recorded timing relative to base_ns (give every
+ * player the same base to keep channels in step); otherwise as fast as
+ * the reader goes.
+ */
+class TtyReplay {
+    public:
+        TtyReplay(const TraceReader *trace, int channel, bool paced);
+        ~TtyReplay();
+
+        /* Creates the pty; returns the slave path to hand to the program */
+        const char *open();
+        int start(int64_t base_ns);
+        /* Waits for the end of the channel (timeout_ms < 0: forever) */
+        bool wait(int timeout_ms);
+        int stop();
+
+        ReplayStats stats() const;
+
+    private:
+        void run();
+
+        const TraceReader *trace_;
+        int channel_;
+        bool paced_;
+        int master_;
+        int stop_fd_;
+        char slave_[64];
+        int64_t base_ns_;
+        std::thread thread_;
+        volatile bool done_;
+        ReplayStats stats_;
+};
+
+#endif
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <getopt.h>  // Argument parsing
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "piusb.hpp"
+#include "platform.hpp"
+#include "timestamp.hpp"
+
+static int help()
+{
+    char usage [] = "\nusbbench: motion and polling benchmarks on the Picard devices    "
+        "\n                                                                   "
+        "\nRuns against the simulated boards unless --hardware is given.      "
+        "\n                                                                   "
+        "\nUsage: usbbench [arguments]                                        "
+        "\n   e.g. usbbench --steps 200                                       "
+        "\n        usbbench --latency 125 --relay 100                         "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --steps <n>           Length of the benchmark moves (default   "
+        "\n                          100)                                     "
+        "\n    --relay <n>           Relay switch operations (default 50)     "
+        "\n    --legs <n>            USB-MOs opened at startup (default 6)    "
+        "\n    --poses <n>           Random leg poses, each reached and left  "
+        "\n                          one leg after the other vs. planned      "
+        "\n                          (default 5)                              "
+        "\n    --latency <us>        Simulated time per transfer (default     "
+        "\n                          1000)                                    "
+        "\n    --histogram           Print the transfer latency histograms    "
+        "\n    --hardware            Use the real devices (moves the motor!)  "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+/*
+ * Motion completion at every velocity, two ways:
+ *   poll     Motor::setPosition, getPosition until there
+ *   predict  send the move, sleep the expected time, then poll
+ */
+static void benchMotor(int steps, bool histogram)
+{
+    Motor motor;
+    if (!motor.isOpen()) {
+        fprintf(stderr, "ERROR: No USB-MO\n");
+        return;
+    }
+    motor.goHome();
+
+    printf("%8s %10s %10s %8s %10s %8s\n", "velocity", "ideal ms", "poll ms", "reads", "predict ms", "reads");
+    for (int v=1; v<=10; v++) {
+        motor.setVelocity(v);
+        double ideal = (double) steps * Motor::stepPeriodMs(v);
+
+        uint64_t reads = motor.usbStats().read.transfers;
+        int64_t t = timestampNs();
+        motor.setPosition(steps);
+        double poll = (timestampNs() - t) * 1e-6;
+        uint64_t poll_reads = motor.usbStats().read.transfers - reads;
+
+        // The same move back, without reading while it cannot have arrived
+        reads = motor.usbStats().read.transfers;
+        t = timestampNs();
+        unsigned char data[8] = {0};
+        data[0] = ((0xF & (16-v)) << 4) | 0x8;
+        motor.usbWrite(data, sizeof(data));
+        usleep((useconds_t) (ideal * 1000));
+        while (motor.getPosition() != 0);
+        double predict = (timestampNs() - t) * 1e-6;
+        uint64_t predict_reads = motor.usbStats().read.transfers - reads;
+
+        printf("%8d %10.0f %10.1f %8llu %10.1f %8llu\n", v, ideal, poll, (unsigned long long) poll_reads,
+               predict, (unsigned long long) predict_reads);
+    }
+    printUsbStats(stdout, motor.usbStats(), histogram);
+}
+
+/* Platform startup: n legs opened one after the other, then all at once */
+static void benchOpen(int n)
+{
+    std::vector<Motor *> legs(n);
+
+    int64_t t = timestampNs();
+    int opened = 0;
+    for (int i=0; i<n; i++) {
+        char select[32];
+        snprintf(select, sizeof(select), "index:%d", i);
+        legs[i] = new Motor(select);
+        opened += legs[i]->isOpen();
+    }
+    double serial = (timestampNs() - t) * 1e-6;
+    for (int i=0; i<n; i++)
+        delete legs[i];
+
+    t = timestampNs();
+    int parallel_opened = openMotors(n, NULL, legs.data());
+    double parallel = (timestampNs() - t) * 1e-6;
+    for (int i=0; i<n; i++)
+        delete legs[i];
+
+    printf("Open %d legs: one by one %.1f ms (%d opened), openMotors %.1f ms (%d opened)\n",
+           n, serial, opened, parallel, parallel_opened);
+}
+
+static double serialPose(Platform *platform, const std::vector<int> &pose, double *spread)
+{
+    int64_t t = timestampNs();
+    int64_t first = 0;
+    for (size_t i=0; i<pose.size(); i++) {
+        platform->leg(i)->setVelocity(10);
+        platform->leg(i)->setPosition(pose[i]);
+        if (i == 0)
+            first = timestampNs();
+    }
+    *spread += (timestampNs() - first) * 1e-6;
+    return (timestampNs() - t) * 1e-6;
+}
+
+static double plannedPose(Platform *platform, const std::vector<int> &pose, double *spread, double *worst)
+{
+    std::vector<LegMove> moves;
+    int64_t t = timestampNs();
+    platform->moveLegs(pose.data(), &moves);
+    double ms = (timestampNs() - t) * 1e-6;
+
+    int64_t early = INT64_MAX, late = 0;
+    for (size_t i=0; i<moves.size(); i++) {
+        if (moves[i].velocity == 0)
+            continue;
+        early = std::min(early, moves[i].actual_ns);
+        late = std::max(late, moves[i].actual_ns);
+        *worst = std::max(*worst, fabs(moves[i].actual_ns - moves[i].predicted_ns) * 1e-6);
+    }
+    if (late > 0)
+        *spread += (late - early) * 1e-6;
+    return ms;
+}
+
+/*
+ * Pose changes of the legs within 0..2*steps, two ways:
+ *   serial   every leg at velocity 10, one after the other (align today)
+ *   planned  Platform::moveLegs, all legs arriving together
+ * Each pose is reached and left once each way, so both do the same moves.
+ */
+static void benchPoses(int legs, int poses, int steps)
+{
+    Platform platform;
+    if (platform.addLegs(legs) != legs) {
+        fprintf(stderr, "ERROR: Not all %d legs opened\n", legs);
+        return;
+    }
+    for (int i=0; i<legs; i++)
+        platform.leg(i)->goHome();
+
+    srand(1);
+    std::vector<int> home(legs, 0), pose(legs);
+    double serial = 0, serial_spread = 0, planned = 0, planned_spread = 0, worst = 0;
+    for (int p=0; p<poses; p++) {
+        for (int i=0; i<legs; i++)
+            pose[i] = rand() % (2 * steps + 1);
+        serial += serialPose(&platform, pose, &serial_spread);
+        planned += plannedPose(&platform, home, &planned_spread, &worst);
+        planned += plannedPose(&platform, pose, &planned_spread, &worst);
+        serial += serialPose(&platform, home, &serial_spread);
+    }
+    // Per move: every pose is reached and left
+    int n = 2 * poses;
+    printf("%d poses of %d legs, per move: serial %.1f ms (arrivals spread %.1f ms), "
+           "planned %.1f ms (spread %.1f ms, worst prediction error %.1f ms)\n",
+           poses, legs, serial / n, serial_spread / n, planned / n, planned_spread / n, worst);
+}
+
+static void benchRelay(int n, bool histogram)
+{
+    Relay relay;
+    if (!relay.isOpen()) {
+        fprintf(stderr, "ERROR: No relay board\n");
+        return;
+    }
+    int64_t t = timestampNs();
+    int errors = 0;
+    for (int i=0; i<n; i++) {
+        bool on = i % 2 == 0;
+        relay.setState(0, on);
+        if (((relay.getState() & 1) != 0) != on)
+            errors++;
+    }
+    double seconds = (timestampNs() - t) * 1e-9;
+    printf("Relay: %d switch+check in %.3f s, %.1f ms each, %d wrong\n",
+           n, seconds, seconds * 1e3 / n, errors);
+    printUsbStats(stdout, relay.usbStats(), histogram);
+}
+
+int main(int argc, char* argv[])
+{
+    int steps = 100;
+    int relay = 50;
+    int legs = 6;
+    int poses = 5;
+    const char *latency = NULL;
+    bool hardware = false;
+    bool histogram = false;
+
+    static struct option long_options[] = {
+        {"steps"    , required_argument , 0    , 's'} ,
+        {"relay"    , required_argument , 0    , 'r'} ,
+        {"legs"     , required_argument , 0    , 'n'} ,
+        {"poses"    , required_argument , 0    , 'p'} ,
+        {"latency"  , required_argument , 0    , 'l'} ,
+        {"histogram", no_argument       , 0    , 'g'} ,
+        {"hardware" , no_argument       , 0    , 'H'} ,
+        {"help"     , no_argument       , 0    , 'h'} ,
+        {NULL       , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "s:r:n:p:l:gHh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 's':
+                steps = atoi(optarg);
+                break;
+            case 'r':
+                relay = atoi(optarg);
+                break;
+            case 'n':
+                legs = atoi(optarg);
+                break;
+            case 'p':
+                poses = atoi(optarg);
+                break;
+            case 'l':
+                latency = optarg;
+                break;
+            case 'g':
+                histogram = true;
+                break;
+            case 'H':
+                hardware = true;
+                break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+
+    if (!hardware) {
+        setenv("PIUSB_SIM", "1", 1);
+        if (latency)
+            setenv("PIUSB_SIM_LATENCY_US", latency, 1);
+    }
+
+    benchOpen(legs);
+    benchMotor(steps, histogram);
+    benchPoses(legs, poses, steps);
+    benchRelay(relay, histogram);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,144 @@
+#include "usbsim.hpp"
+#include "devlog.hpp"
+#include "timestamp.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define VENDOR_ID   0x0461
+#define MOTOR_ID    0x0020
+#define TWISTER_ID  0x0021
+#define RELAY_ID    0x0010
+#define LASER_ID    0x0011
+
+SimTransport::SimTransport(int latency_us)
+{
+    if (latency_us < 0) {
+        const char *env = getenv("PIUSB_SIM_LATENCY_US");
+        latency_us = env ? atoi(env) : 1000;
+    }
+    latency_us_ = latency_us;
+    pid_ = 0;
+    velocity_ = 1;
+    const char *position = getenv("PIUSB_SIM_POSITION");
+    start_ = target_ = position ? atoi(position) : 0;
+    start_ns_ = 0;
+    state_ = 0;
+    latched_ = 0xFF;
+}
+
+int SimTransport::open(int vid, int pid, const char *select)
+{
+    if (vid != VENDOR_ID || (pid != MOTOR_ID && pid != TWISTER_ID && pid != RELAY_ID && pid != LASER_ID)) {
+        DEVLOG_ERROR("Cannot open USB Device {:04x}:{:04x}. Not simulated", vid, pid);
+        return EXIT_FAILURE;
+    }
+    // Descriptors, configuration and claiming the interface
+    for (int i=0; i<10; i++)
+        wait();
+
+    pid_ = pid;
+    serial_ = std::string("SIM-") + (select ? select : "index:0");
+    start_ns_ = timestampNs();
+    DEVLOG_DEBUG("USB Device {:04x}:{:04x} {} simulated, {} us per transfer", vid, pid,
+                 select ? select : "", latency_us_);
+    return EXIT_SUCCESS;
+}
+
+int SimTransport::close()
+{
+    pid_ = 0;
+    return EXIT_SUCCESS;
+}
+
+void SimTransport::wait()
+{
+    if (latency_us_ <= 0)
+        return;
+    struct timespec ts = { latency_us_ / 1000000, (latency_us_ % 1000000) * 1000L };
+    nanosleep(&ts, NULL);
+}
+
+int SimTransport::position(int64_t now)
+{
+    int64_t period = (int64_t) Motor::stepPeriodMs(velocity_) * 1000000;
+    int64_t steps = (now - start_ns_) / period;
+    int distance = abs(target_ - start_);
+
+    int position = target_;
+    if (steps < distance)
+        position = start_ + (target_ > start_ ? steps : -steps);
+
+    // Re-anchor on the last whole step so a velocity change keeps the phase
+    start_ns_ += steps < distance ? steps * period : now - start_ns_;
+    start_ = position;
+    return position;
+}
+
+int SimTransport::write(unsigned char *data, int length, int *count)
+{
+    *count = 0;
+    if (pid_ == 0 || length != 8)
+        return EXIT_FAILURE;
+    wait();
+    *count = length;
+
+    int64_t now = timestampNs();
+    switch (pid_) {
+        case MOTOR_ID:
+        case TWISTER_ID: {
+            position(now);
+            int velocity = 16 - (data[0] >> 4);
+            if (velocity >= 1 && velocity <= 10)
+                velocity_ = velocity;
+
+            if (data[0] & 0x8) {
+                int target = data[1] | (data[2] << 8);
+                target_ = pid_ == TWISTER_ID ? (int16_t) target : target;
+            }
+            else if (data[0] & 0x1) {
+                // USB-MO homes back to 0, the Twister zeroes where it is
+                if (pid_ == TWISTER_ID)
+                    start_ = 0;
+                target_ = 0;
+            }
+            break;
+        }
+        case RELAY_ID:
+            state_ = data[0] & 0xF;
+            break;
+        case LASER_ID:
+            state_ = data[0];
+            break;
+    }
+    return EXIT_SUCCESS;
+}
+
+int SimTransport::read (unsigned char *data, int length, int *count)
+{
+    *count = 0;
+    if (pid_ == 0)
+        return EXIT_FAILURE;
+    wait();
+    *count = length;
+
+    memset(data, 0, length);
+    switch (pid_) {
+        case MOTOR_ID:
+        case TWISTER_ID: {
+            int position = this->position(timestampNs());
+            data[1] = 0xFF & position;
+            data[2] = 0xFF & (position >> 8);
+            break;
+        }
+        case RELAY_ID:
+            data[0] = latched_;
+            latched_ = state_;
+            break;
+        case LASER_ID:
+            data[0] = state_;
+            break;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,58 @@
+#ifndef _USBSIM_HPP_
+#define _USBSIM_HPP_
+
+#include <stdint.h>
+
+#include "piusb.hpp"
+
+/*
+ * Stand-in for the Picard boards, selected with PIUSB_SIM=1, so the
+ * motion code can be run and benchmarked on any Linux box:
+ *
+ *    0461:0020  USB-MO       steps at Motor::stepPeriodMs(velocity) towards
+ *                            the commanded position (0x8), home (0x1) runs
+ *                            back to 0
+ *    0461:0021  Twister II   the same with signed 16 bit positions, 0x1
+ *                            zeroes the position in place
+ *    0461:0010  Relay        reads lag one behind: the first read after a
+ *                            change returns the old state (see getState)
+ *    0461:0011  Laser        on/off
+ *
+ * Every transfer takes PIUSB_SIM_LATENCY_US (default 1000 us, one
+ * full-speed frame), opening a device ten of them. Steppers power up at
+ * PIUSB_SIM_POSITION (default 0). Any selector opens a fresh device, so a
+ * platform of identical legs can be simulated; its serial number is
+ * "SIM-" and the selector.
+ */
+class SimTransport : public UsbTransport {
+    public:
+        /* latency_us < 0: PIUSB_SIM_LATENCY_US or the default */
+        SimTransport(int latency_us = -1);
+
+        int open(int vid, int pid, const char *select);
+        int close();
+        int write(unsigned char *data, int length, int *count);
+        int read (unsigned char *data, int length, int *count);
+        std::string serial() const { return serial_; }
+
+    private:
+        /* Where the stepper is now, and re-anchors the move there */
+        int position(int64_t now);
+        void wait();
+
+        int pid_;
+        int latency_us_;
+        std::string serial_;
+
+        /* Motor and Twister */
+        int velocity_;
+        int start_;             // position at start_ns_
+        int target_;
+        int64_t start_ns_;
+
+        /* Relay and Laser */
+        int state_;
+        int latched_;           // what the next Relay read returns
+};
+
+#endif
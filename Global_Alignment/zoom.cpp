@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <getopt.h>  // Argument parsing
+
+#include <map>
+
+#include "pyramid.hpp"
+#include "samplelog.hpp"
+#include "timestamp.hpp"
+
+static int help()
+{
+    char usage [] = "\nzoom: min/max/mean pyramids of sample logs for plotting        "
+        "\n                                                                   "
+        "\nUsage: zoom [arguments]                                            "
+        "\n   e.g. zoom --build run.slog                     (run.slog.pyr)   "
+        "\n        zoom --query run.slog.pyr --channel psd0.x0 --points 2000  "
+        "\n        zoom --query run.slog.pyr --channel psd0.x0 --from 3600    "
+        "\n             --to 7200                                             "
+        "\n                                                                   "
+        "\nArguments:                                                         "
+        "\n    --build <log>         Build <log>.pyr from a sample log        "
+        "\n    --base <ms>           Level 0 bucket width (default 250 ms)    "
+        "\n    --info <pyr>          Channels and levels                      "
+        "\n    --query <pyr>         Print t[s] min max mean count            "
+        "\n    --channel <name>      e.g. psd0.x0, dls0.distance, act1.position"
+        "\n    --from <s> --to <s>   Range, s from the start of the recording "
+        "\n    --points <n>          At most n points (default 1000)          "
+        "\n    --bench               Build and query a simulated 24 h run     "
+        "\n                                                                   "
+        "\n   --help                 Print this message.                      ";
+    printf("%s\n", usage);
+    return 0;
+}
+
+static const char *typePrefix(int type)
+{
+    switch (type) {
+        case LOG_DLS:      return "dls";
+        case LOG_PSD:      return "psd";
+        case LOG_ACTUATOR: return "act";
+        case LOG_ROW:      return "row";
+        default:           return "unknown";
+    }
+}
+
+static int build(const char *path, int64_t base_ns)
+{
+    SampleLogReader log;
+    if (log.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    PyramidBuilder pyramid(base_ns);
+    std::map<uint32_t, std::vector<int> > channels;    // (type, source) -> channel per column
+
+    int64_t t0 = timestampNs();
+    for (size_t b=0; b<log.blocks(); b++) {
+        uint32_t n;
+        const LogRecord *r = log.block(b, &n);
+        for (uint32_t i=0; i<n; i++) {
+            uint32_t key = (uint32_t) r[i].type << 16 | r[i].source;
+            std::vector<int> &ch = channels[key];
+            if (ch.empty()) {
+                for (int k=0; k<SAMPLELOG_VALUES; k++) {
+                    const char *value = logValueName(r[i].type, k);
+                    char name[PYRAMID_NAME_SIZE];
+                    snprintf(name, sizeof(name), "%s%u.%s", typePrefix(r[i].type), r[i].source,
+                             value ? value : "");
+                    ch.push_back(value ? pyramid.channel(name) : -1);
+                }
+            }
+            for (int k=0; k<SAMPLELOG_VALUES; k++)
+                if (ch[k] >= 0)
+                    pyramid.append(ch[k], r[i].t_ns, r[i].v[k]);
+        }
+    }
+
+    char out[512];
+    snprintf(out, sizeof(out), "%s.pyr", path);
+    int status = pyramid.save(out);
+    fprintf(stderr, "%s: %llu records, %d channels, %d levels, %.2f s\n", out,
+            (unsigned long long) log.records(), pyramid.channels(), pyramid.levels(),
+            (timestampNs() - t0) * 1e-9);
+    return status;
+}
+
+static int info(const char *path)
+{
+    PyramidReader pyr;
+    if (pyr.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    const PyramidHeader &h = pyr.header();
+    printf("%s: %u channels, %u levels, %.0f ms x %u^k\n", path, h.channels, h.levels,
+           h.base_ns * 1e-6, h.fanout);
+    for (uint32_t c=0; c<h.channels; c++)
+        printf("  %s\n", pyr.name(c));
+    return EXIT_SUCCESS;
+}
+
+static int query(const char *path, const char *name, double from, double to, size_t points)
+{
+    PyramidReader pyr;
+    if (pyr.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    int c = name ? pyr.channel(name) : 0;
+    if (c < 0 || (uint32_t) c >= pyr.header().channels) {
+        fprintf(stderr, "ERROR: No channel %s in %s\n", name, path);
+        return EXIT_FAILURE;
+    }
+
+    int64_t t0 = pyr.header().t0_ns;
+    std::vector<PyramidPoint> out;
+    int level = pyr.query(c, t0 + (int64_t) (from * 1e9), to < 0 ? pyr.endTime() : t0 + (int64_t) (to * 1e9),
+                          points, &out);
+    for (size_t i=0; i<out.size(); i++)
+        printf("%10.3f % .6e % .6e % .6e %u\n", (out[i].t_ns - t0) * 1e-9,
+               out[i].min, out[i].max, out[i].mean, out[i].count);
+    fprintf(stderr, "# %s: %zu points from level %d\n", pyr.name(c), out.size(), level);
+    return EXIT_SUCCESS;
+}
+
+/* 24 h of 4 PSD channels at 100 Hz: build time, file size and query times */
+static int bench()
+{
+    const char *path = "/tmp/zoom-bench.pyr";
+    const int64_t rate = 100;
+    const int64_t n = 24 * 3600 * rate;
+    const int64_t period = 1000000000LL / rate;
+
+    PyramidBuilder pyramid;
+    int ch[4];
+    ch[0] = pyramid.channel("psd0.x0");
+    ch[1] = pyramid.channel("psd0.y0");
+    ch[2] = pyramid.channel("psd0.x1");
+    ch[3] = pyramid.channel("psd0.y1");
+
+    srand(1);
+    int64_t t0 = timestampNs();
+    for (int64_t i=0; i<n; i++) {
+        double drift = 0.1 * sin(i * 2 * M_PI / (3600.0 * rate));
+        for (int c=0; c<4; c++)
+            pyramid.append(ch[c], i * period, drift + (rand() % 1000) * 1e-5);
+    }
+    double build = (timestampNs() - t0) * 1e-9;
+    pyramid.save(path);
+
+    PyramidReader pyr;
+    if (pyr.open(path) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+
+    FILE *f = fopen(path, "r");
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+
+    printf("%lld samples x 4 channels: build %.2f s (%.0f ns/value), %d levels, %.1f MB "
+           "(raw log %.1f MB)\n", (long long) n, build, build * 1e9 / (n * 4), pyramid.levels(),
+           size / 1e6, n * 96.0 / 1e6);
+
+    const int64_t span[4] = { 24 * 3600, 3600, 60, 1 };
+    const size_t points = 2000;
+    for (int s=0; s<4; s++) {
+        std::vector<PyramidPoint> out;
+        out.reserve(points);
+        int level = 0;
+        const int reps = 1000;
+        t0 = timestampNs();
+        for (int r=0; r<reps; r++) {
+            out.clear();
+            int64_t from = (rand() % (24 * 3600 - span[s] + 1)) * 1000000000LL;
+            level = pyr.query(0, from, from + span[s] * 1000000000LL, points, &out);
+        }
+        double t = (timestampNs() - t0) * 1e-9 / reps;
+        printf("  %6lld s range: %4zu points from level %2d in %7.1f us\n",
+               (long long) span[s], out.size(), level, t * 1e6);
+    }
+    remove(path);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc==1) return help();
+
+    const char *build_path = NULL;
+    const char *info_path = NULL;
+    const char *query_path = NULL;
+    const char *channel = NULL;
+    int64_t base_ns = 250000000;
+    double from = 0, to = -1;
+    size_t points = 1000;
+    bool run_bench = false;
+
+    static struct option long_options[] = {
+        {"build"    , required_argument , 0    , 'b'} ,
+        {"base"     , required_argument , 0    , 'B'} ,
+        {"info"     , required_argument , 0    , 'i'} ,
+        {"query"    , required_argument , 0    , 'q'} ,
+        {"channel"  , required_argument , 0    , 'c'} ,
+        {"from"     , required_argument , 0    , 'f'} ,
+        {"to"       , required_argument , 0    , 't'} ,
+        {"points"   , required_argument , 0    , 'n'} ,
+        {"bench"    , no_argument       , 0    , 'x'} ,
+        {"help"     , no_argument       , 0    , 'h'} ,
+        {NULL       , 0                 , NULL ,  0 }
+    };
+
+    int c;
+    int option_index = 0;
+    while ((c = getopt_long(argc, argv, "b:B:i:q:c:f:t:n:xh", long_options, &option_index)) != -1) {
+        switch (c) {
+            case 'b':
+                build_path = optarg;
+                break;
+            case 'B':
+                base_ns = (int64_t) (atof(optarg) * 1e6);
+                break;
+            case 'i':
+                info_path = optarg;
+                break;
+            case 'q':
+                query_path = optarg;
+                break;
+            case 'c':
+                channel = optarg;
+                break;
+            case 'f':
+                from = atof(optarg);
+                break;
+            case 't':
+                to = atof(optarg);
+                break;
+            case 'n':
+                points = atol(optarg);
+                break;
+            case 'x':
+                run_bench = true;
+                break;
+            case 'h':
+            default:
+                return help();
+        }
+    }
+
+    if (build_path)
+        return build(build_path, base_ns);
+    if (info_path)
+        return info(info_path);
+    if (query_path)
+        return query(query_path, channel, from, to, points);
+    if (run_bench)
+        return bench();
+    return help();
+}